@@ -0,0 +1,601 @@
+#include "arrow-format.h"
+#include "identity.h"
+#include "terminal-safe.h"
+
+extern "C" {
+#include <errno.h>
+#include <string.h>
+} // extern "C"
+
+#include <algorithm>
+#include <string_view>
+
+namespace {
+
+// Entries per record batch, and message bytes before a batch is written
+// early (the string offsets are 32 bit).
+constexpr size_t batchRows = 65536;
+constexpr size_t maxBatchBytes = 256 << 20;
+
+// Just enough of a FlatBuffers builder for the Arrow metadata. Like the real
+// one it builds back to front, children before their parents, so an object
+// is referred to by its distance from the end of the buffer.
+class FlatBuilder
+{
+public:
+    using Offset = uint32_t;
+
+    template<typename T>
+    void addScalar(int field, T value)
+    {
+        prepend(value);
+        m_fields.push_back({ field, size() });
+    }
+
+    void addOffset(int field, Offset offset)
+    {
+        prependOffset(offset);
+        m_fields.push_back({ field, size() });
+    }
+
+    void startTable()
+    {
+        m_fields.clear();
+        m_tableStart = size();
+    }
+
+    Offset endTable()
+    {
+        prepend<int32_t>(0);
+        const Offset table = size();
+
+        int fieldCount = 0;
+        for (const auto &[field, position] : m_fields) {
+            fieldCount = std::max(fieldCount, field + 1);
+        }
+        std::vector<uint16_t> vtable(2 + fieldCount, 0);
+        vtable[0] = vtable.size() * sizeof(uint16_t);
+        vtable[1] = table - m_tableStart;
+        for (const auto &[field, position] : m_fields) {
+            vtable[2 + field] = table - position;
+        }
+        for (auto it = vtable.rbegin(); it != vtable.rend(); ++it) {
+            prepend(*it);
+        }
+
+        // The table points back at its vtable
+        const int32_t vtableOffset = int32_t(size()) - int32_t(table);
+        memcpy(&m_buffer[m_buffer.size() - table], &vtableOffset, sizeof vtableOffset);
+        return table;
+    }
+
+    Offset createString(std::string_view string)
+    {
+        preAlign(string.size() + 1, sizeof(uint32_t));
+        m_buffer.insert(0, 1, '\0');
+        m_buffer.insert(0, string.data(), string.size());
+        prepend<uint32_t>(string.size());
+        return size();
+    }
+
+    Offset createVector(const std::vector<Offset> &offsets)
+    {
+        preAlign(offsets.size() * sizeof(Offset), sizeof(uint32_t));
+        for (auto it = offsets.rbegin(); it != offsets.rend(); ++it) {
+            prependOffset(*it);
+        }
+        prepend<uint32_t>(offsets.size());
+        return size();
+    }
+
+    // The structs have to be laid out like FlatBuffers does, which for the
+    // ones in Arrow is the same as the compiler does.
+    template<typename T>
+    Offset createVector(const std::vector<T> &structs)
+    {
+        const size_t bytes = structs.size() * sizeof(T);
+        preAlign(bytes, sizeof(uint32_t));
+        preAlign(bytes, alignof(T));
+        m_buffer.insert(0, reinterpret_cast<const char*>(structs.data()), bytes);
+        prepend<uint32_t>(structs.size());
+        return size();
+    }
+
+    std::string finish(Offset root)
+    {
+        preAlign(sizeof(Offset), maxAlignment);
+        prependOffset(root);
+        return std::move(m_buffer);
+    }
+
+private:
+    // Everything is aligned relative to the end, which works out because the
+    // finished buffer is padded to a multiple of this.
+    static constexpr size_t maxAlignment = 8;
+
+    Offset size() const { return m_buffer.size(); }
+
+    // Pads so that after another size bytes we're aligned
+    void preAlign(size_t size, size_t alignment)
+    {
+        while ((m_buffer.size() + size) % alignment != 0) {
+            m_buffer.insert(0, 1, '\0');
+        }
+    }
+
+    template<typename T>
+    void prepend(T value)
+    {
+        preAlign(sizeof(T), sizeof(T));
+        m_buffer.insert(0, reinterpret_cast<const char*>(&value), sizeof(T));
+    }
+
+    void prependOffset(Offset offset)
+    {
+        preAlign(sizeof(Offset), sizeof(Offset));
+        prepend<uint32_t>(size() + sizeof(Offset) - offset);
+    }
+
+    std::string m_buffer;
+    std::vector<std::pair<int, Offset>> m_fields;
+    Offset m_tableStart = 0;
+};
+
+// The bits of the Arrow schema (Schema.fbs and Message.fbs) we use
+constexpr int16_t metadataV5 = 4;
+constexpr int16_t microseconds = 2;
+
+enum TypeId : uint8_t {
+    IntType = 2,
+    Utf8Type = 5,
+    TimestampType = 10
+};
+
+enum MessageType : uint8_t {
+    SchemaMessage = 1,
+    DictionaryBatchMessage = 2,
+    RecordBatchMessage = 3
+};
+
+struct FieldNode {
+    int64_t length;
+    int64_t nullCount;
+};
+
+struct BufferLocation {
+    int64_t offset;
+    int64_t length;
+};
+
+struct ColumnInfo {
+    const char *name;
+    TypeId type;
+    // For the ints
+    int32_t bitWidth;
+    bool isSigned;
+    // Dictionary id, or -1 if the values are stored as they are
+    int64_t dictionary;
+};
+
+const ColumnInfo columnInfo[] = {
+    { "timestamp", TimestampType, 0, false, -1 },
+    { "priority", IntType, 8, true, -1 },
+    { "uid", IntType, 32, false, -1 },
+    { "username", Utf8Type, 0, false, 0 },
+    { "gid", IntType, 32, false, -1 },
+    { "groupname", Utf8Type, 0, false, 4 },
+    { "pid", IntType, 32, false, -1 },
+    { "hostname", Utf8Type, 0, false, 1 },
+    { "identifier", Utf8Type, 0, false, 2 },
+    { "unit", Utf8Type, 0, false, 3 },
+    { "message", Utf8Type, 0, false, -1 },
+};
+
+FlatBuilder::Offset createIntType(FlatBuilder *builder, int32_t bitWidth, bool isSigned)
+{
+    builder->startTable();
+    builder->addScalar<int32_t>(0, bitWidth);
+    builder->addScalar<uint8_t>(1, isSigned);
+    return builder->endTable();
+}
+
+FlatBuilder::Offset createSchema(FlatBuilder *builder)
+{
+    std::vector<FlatBuilder::Offset> fields;
+    for (const ColumnInfo &info : columnInfo) {
+        const FlatBuilder::Offset name = builder->createString(info.name);
+
+        FlatBuilder::Offset type;
+        if (info.type == IntType) {
+            type = createIntType(builder, info.bitWidth, info.isSigned);
+        } else if (info.type == TimestampType) {
+            const FlatBuilder::Offset timezone = builder->createString("UTC");
+            builder->startTable();
+            builder->addScalar<int16_t>(0, microseconds);
+            builder->addOffset(1, timezone);
+            type = builder->endTable();
+        } else {
+            builder->startTable();
+            type = builder->endTable();
+        }
+
+        FlatBuilder::Offset dictionary = 0;
+        if (info.dictionary >= 0) {
+            const FlatBuilder::Offset indexType = createIntType(builder, 32, true);
+            builder->startTable();
+            builder->addScalar<int64_t>(0, info.dictionary);
+            builder->addOffset(1, indexType);
+            dictionary = builder->endTable();
+        }
+        const FlatBuilder::Offset children = builder->createVector(std::vector<FlatBuilder::Offset>());
+
+        builder->startTable();
+        builder->addOffset(0, name);
+        builder->addScalar<uint8_t>(1, info.type != TimestampType);
+        builder->addScalar<uint8_t>(2, info.type);
+        builder->addOffset(3, type);
+        if (dictionary) {
+            builder->addOffset(4, dictionary);
+        }
+        builder->addOffset(5, children);
+        fields.push_back(builder->endTable());
+    }
+    const FlatBuilder::Offset fieldVector = builder->createVector(fields);
+
+    builder->startTable();
+    builder->addScalar<int16_t>(0, 0); // little endian
+    builder->addOffset(1, fieldVector);
+    return builder->endTable();
+}
+
+FlatBuilder::Offset createRecordBatch(FlatBuilder *builder, int64_t length, const std::vector<FieldNode> &nodes, const std::vector<BufferLocation> &buffers)
+{
+    const FlatBuilder::Offset nodeVector = builder->createVector(nodes);
+    const FlatBuilder::Offset bufferVector = builder->createVector(buffers);
+    builder->startTable();
+    builder->addScalar<int64_t>(0, length);
+    builder->addOffset(1, nodeVector);
+    builder->addOffset(2, bufferVector);
+    return builder->endTable();
+}
+
+std::string createMessage(FlatBuilder *builder, MessageType type, FlatBuilder::Offset header, int64_t bodyLength)
+{
+    builder->startTable();
+    builder->addScalar<int16_t>(0, metadataV5);
+    builder->addScalar<uint8_t>(1, type);
+    builder->addOffset(2, header);
+    builder->addScalar<int64_t>(3, bodyLength);
+    return builder->finish(builder->endTable());
+}
+
+size_t padded(size_t size)
+{
+    return (size + 7) & ~size_t(7);
+}
+
+// Where the buffers end up in the message body, each aligned to 8 bytes
+std::vector<BufferLocation> layOut(const std::vector<const std::string*> &buffers, int64_t *bodyLength)
+{
+    std::vector<BufferLocation> locations;
+    int64_t offset = 0;
+    for (const std::string *buffer : buffers) {
+        locations.push_back({ offset, int64_t(buffer->size()) });
+        offset += padded(buffer->size());
+    }
+    *bodyLength = offset;
+    return locations;
+}
+
+template<typename T>
+void appendValue(std::string *buffer, T value)
+{
+    buffer->append(reinterpret_cast<const char*>(&value), sizeof(T));
+}
+
+// Empty if everything is valid, which is allowed and saves the space
+void finishBitmap(std::string *bitmap, int64_t nullCount)
+{
+    if (nullCount == 0) {
+        bitmap->clear();
+    }
+}
+
+void setValid(std::string *bitmap, size_t row)
+{
+    (*bitmap)[row / 8] |= 1 << (row % 8);
+}
+
+// Offsets and values of a string column. The strings have to be UTF-8, or
+// pyarrow and DuckDB refuse the whole file, but the fields can be anything.
+void appendString(std::string *offsets, std::string *values, std::string_view string)
+{
+    appendValidUtf8(string, values);
+    appendValue<int32_t>(offsets, values->size());
+}
+
+} // namespace
+
+ArrowWriter::ArrowWriter(FILE *file, ThreadPool *pool) :
+    m_file(file),
+    m_pool(pool),
+    m_rows(batchRows)
+{
+}
+
+void ArrowWriter::write(const void *data, size_t size)
+{
+    if (m_error) {
+        return;
+    }
+    if (fwrite(data, 1, size, m_file) != size) {
+        m_error = errno ? errno : EIO;
+        return;
+    }
+    m_offset += size;
+}
+
+int ArrowWriter::open()
+{
+    // The magic, padded to 8 bytes
+    write("ARROW1\0\0", 8);
+
+    FlatBuilder builder;
+    const std::string schema = createMessage(&builder, SchemaMessage, createSchema(&builder), 0);
+    writeMessage(schema, {}, nullptr);
+    return -m_error;
+}
+
+int ArrowWriter::add(const Entry &entry)
+{
+    if (m_error) {
+        return -m_error;
+    }
+    m_rows[m_rowCount++] = entry;
+    m_entryCount++;
+    m_batchBytes += entry.message.size();
+    if (m_rowCount == m_rows.size() || m_batchBytes >= maxBatchBytes) {
+        return writeBatch();
+    }
+    return 0;
+}
+
+int ArrowWriter::finish()
+{
+    if (m_rowCount > 0) {
+        writeBatch();
+    }
+
+    // End of the stream, so it can be read as a stream as well
+    const uint32_t endOfStream[] = { 0xffffffff, 0 };
+    write(endOfStream, sizeof endOfStream);
+
+    FlatBuilder builder;
+    const FlatBuilder::Offset schema = createSchema(&builder);
+    const FlatBuilder::Offset dictionaries = builder.createVector(m_dictionaryBlocks);
+    const FlatBuilder::Offset batches = builder.createVector(m_batchBlocks);
+    builder.startTable();
+    builder.addScalar<int16_t>(0, metadataV5);
+    builder.addOffset(1, schema);
+    builder.addOffset(2, dictionaries);
+    builder.addOffset(3, batches);
+    const std::string footer = builder.finish(builder.endTable());
+
+    write(footer.data(), footer.size());
+    const int32_t footerLength = footer.size();
+    write(&footerLength, sizeof footerLength);
+    write("ARROW1", 6);
+    if (!m_error && fflush(m_file) != 0) {
+        m_error = errno;
+    }
+    return -m_error;
+}
+
+// Encapsulated message: continuation marker, metadata length, the metadata
+// padded to 8 bytes and then the body.
+int ArrowWriter::writeMessage(const std::string &metadata, const std::vector<const std::string*> &buffers, std::vector<Block> *blocks)
+{
+    const int64_t offset = m_offset;
+    const int32_t metadataLength = padded(metadata.size());
+    const uint32_t continuation = 0xffffffff;
+    write(&continuation, sizeof continuation);
+    write(&metadataLength, sizeof metadataLength);
+    write(metadata.data(), metadata.size());
+
+    static const char zeroes[8] = {};
+    write(zeroes, metadataLength - metadata.size());
+    int64_t bodyLength = 0;
+    for (const std::string *buffer : buffers) {
+        write(buffer->data(), buffer->size());
+        write(zeroes, padded(buffer->size()) - buffer->size());
+        bodyLength += padded(buffer->size());
+    }
+
+    if (blocks) {
+        blocks->push_back({ offset, int32_t(sizeof continuation + sizeof metadataLength + metadataLength), 0, bodyLength });
+    }
+    return -m_error;
+}
+
+const std::string *ArrowWriter::dictionaryValue(Column column, const Entry &entry)
+{
+    switch(column) {
+    // Already looked up by writeBatch()
+    case UsernameColumn:
+        return entry.uidNumber == InvalidId ? nullptr : &getUsername(entry.uidNumber, entry.uid);
+    case GroupNameColumn:
+        return entry.gidNumber == InvalidId ? nullptr : &getGroupName(entry.gidNumber, entry.gid);
+    case HostnameColumn:
+        return entry.hostname.empty() ? nullptr : &entry.hostname;
+    case IdentifierColumn: {
+        const std::string &identifier = entry.identifier.empty() ? entry.comm : entry.identifier;
+        return identifier.empty() ? nullptr : &identifier;
+    }
+    case UnitColumn:
+        return entry.unit.empty() ? nullptr : &entry.unit;
+    default:
+        return nullptr;
+    }
+}
+
+void ArrowWriter::encodeDictionary(Column column)
+{
+    EncodedColumn &encoded = m_columns[column];
+    Dictionary &dictionary = m_dictionaries[column];
+    std::string &bitmap = encoded.buffers[0];
+    std::string &indexes = encoded.buffers[1];
+
+    for (size_t row = 0; row < m_rowCount; row++) {
+        const std::string *value = dictionaryValue(column, m_rows[row]);
+        if (!value) {
+            encoded.nullCount++;
+            appendValue<int32_t>(&indexes, 0);
+            continue;
+        }
+        setValid(&bitmap, row);
+        auto it = dictionary.indexes.find(*value);
+        if (it == dictionary.indexes.end()) {
+            it = dictionary.indexes.emplace(*value, dictionary.indexes.size()).first;
+            dictionary.pending.push_back(*value);
+        }
+        appendValue<int32_t>(&indexes, it->second);
+    }
+}
+
+void ArrowWriter::encodeColumn(Column column)
+{
+    EncodedColumn &encoded = m_columns[column];
+    const bool isString = columnInfo[column].type == Utf8Type && columnInfo[column].dictionary < 0;
+    encoded.nullCount = 0;
+    encoded.buffers.resize(isString ? 3 : 2);
+    for (std::string &buffer : encoded.buffers) {
+        buffer.clear();
+    }
+    std::string &bitmap = encoded.buffers[0];
+    bitmap.assign((m_rowCount + 7) / 8, '\0');
+    std::string &values = encoded.buffers[1];
+
+    // Missing numbers are null, with a zero in their place
+    auto encodeNumber = [&](auto value, bool valid, size_t row) {
+        if (valid) {
+            setValid(&bitmap, row);
+        } else {
+            encoded.nullCount++;
+            value = 0;
+        }
+        appendValue(&values, value);
+    };
+
+    switch(column) {
+    case TimestampColumn:
+        values.reserve(m_rowCount * sizeof(int64_t));
+        for (size_t row = 0; row < m_rowCount; row++) {
+            encodeNumber(int64_t(m_rows[row].realtime), true, row);
+        }
+        break;
+    case PriorityColumn:
+        for (size_t row = 0; row < m_rowCount; row++) {
+            encodeNumber(m_rows[row].priorityLevel, m_rows[row].priorityLevel >= 0, row);
+        }
+        break;
+    case UidColumn:
+        values.reserve(m_rowCount * sizeof(uint32_t));
+        for (size_t row = 0; row < m_rowCount; row++) {
+            encodeNumber(m_rows[row].uidNumber, m_rows[row].uidNumber != InvalidId, row);
+        }
+        break;
+    case GidColumn:
+        values.reserve(m_rowCount * sizeof(uint32_t));
+        for (size_t row = 0; row < m_rowCount; row++) {
+            encodeNumber(m_rows[row].gidNumber, m_rows[row].gidNumber != InvalidId, row);
+        }
+        break;
+    case PidColumn:
+        values.reserve(m_rowCount * sizeof(uint32_t));
+        for (size_t row = 0; row < m_rowCount; row++) {
+            encodeNumber(m_rows[row].pidNumber, m_rows[row].pidNumber != InvalidId, row);
+        }
+        break;
+    case MessageColumn: {
+        // An empty message is still a message
+        std::string &strings = encoded.buffers[2];
+        strings.reserve(m_batchBytes);
+        values.reserve((m_rowCount + 1) * sizeof(int32_t));
+        appendValue<int32_t>(&values, 0);
+        for (size_t row = 0; row < m_rowCount; row++) {
+            setValid(&bitmap, row);
+            appendString(&values, &strings, m_rows[row].message);
+        }
+        break;
+    }
+    default:
+        values.reserve(m_rowCount * sizeof(int32_t));
+        encodeDictionary(column);
+        break;
+    }
+    finishBitmap(&bitmap, encoded.nullCount);
+}
+
+int ArrowWriter::writeBatch()
+{
+    // The identity cache can only be filled from one thread, after this the
+    // workers just read it
+    for (size_t row = 0; row < m_rowCount; row++) {
+        getUsername(m_rows[row].uidNumber, m_rows[row].uid);
+        getGroupName(m_rows[row].gidNumber, m_rows[row].gid);
+    }
+
+    // Only a handful of columns, so the threads take one at a time
+    m_pool->parallelFor(ColumnCount, [this](size_t column, unsigned) {
+        encodeColumn(Column(column));
+    }, 1);
+
+    // New dictionary values first, a batch can only refer to what's already
+    // been written. The first one is always written, so the reader knows
+    // about the dictionary even if it's all nulls.
+    for (size_t column = 0; column < ColumnCount; column++) {
+        Dictionary &dictionary = m_dictionaries[column];
+        if (columnInfo[column].dictionary < 0 || (dictionary.written && dictionary.pending.empty())) {
+            continue;
+        }
+        std::string bitmap, offsets, values;
+        appendValue<int32_t>(&offsets, 0);
+        for (const std::string &value : dictionary.pending) {
+            appendString(&offsets, &values, value);
+        }
+        const std::vector<const std::string*> buffers = { &bitmap, &offsets, &values };
+        int64_t bodyLength;
+        const std::vector<BufferLocation> locations = layOut(buffers, &bodyLength);
+
+        FlatBuilder builder;
+        const FlatBuilder::Offset data = createRecordBatch(&builder, dictionary.pending.size(), { { int64_t(dictionary.pending.size()), 0 } }, locations);
+        builder.startTable();
+        builder.addScalar<int64_t>(0, columnInfo[column].dictionary);
+        builder.addOffset(1, data);
+        builder.addScalar<uint8_t>(2, dictionary.written);
+        const FlatBuilder::Offset header = builder.endTable();
+        writeMessage(createMessage(&builder, DictionaryBatchMessage, header, bodyLength), buffers, &m_dictionaryBlocks);
+
+        dictionary.pending.clear();
+        dictionary.written = true;
+    }
+
+    std::vector<FieldNode> nodes;
+    std::vector<const std::string*> buffers;
+    for (const EncodedColumn &column : m_columns) {
+        nodes.push_back({ int64_t(m_rowCount), column.nullCount });
+        for (const std::string &buffer : column.buffers) {
+            buffers.push_back(&buffer);
+        }
+    }
+    int64_t bodyLength;
+    const std::vector<BufferLocation> locations = layOut(buffers, &bodyLength);
+
+    FlatBuilder builder;
+    const FlatBuilder::Offset header = createRecordBatch(&builder, m_rowCount, nodes, locations);
+    writeMessage(createMessage(&builder, RecordBatchMessage, header, bodyLength), buffers, &m_batchBlocks);
+
+    m_rowCount = 0;
+    m_batchBytes = 0;
+    return -m_error;
+}
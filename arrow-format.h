@@ -0,0 +1,108 @@
+#pragma once
+
+#include "entry.h"
+#include "thread-pool.h"
+
+extern "C" {
+#include <stdio.h>
+} // extern "C"
+
+#include <cstdint>
+#include <string>
+#include <unordered_map>
+#include <vector>
+
+// Writing entries as an Arrow IPC file, which pyarrow, pandas.read_feather()
+// and DuckDB load without parsing anything.
+// https://arrow.apache.org/docs/format/Columnar.html
+
+// What the columns are made from
+constexpr FieldMask arrowFields = FieldPriority | FieldHostname | FieldUid | FieldGid | FieldIdentifier | FieldPid | FieldUnit | FieldMessage;
+
+// The columns are timestamp (usec, UTC), priority, uid, username, gid,
+// groupname, pid, hostname, identifier, unit and message, missing fields are
+// null. The strings that repeat a lot are dictionary encoded. Entries are
+// buffered and written a batch at a time, with the columns of a batch encoded
+// on the pool.
+class ArrowWriter
+{
+public:
+    // The columns are encoded on the pool
+    ArrowWriter(FILE *file, ThreadPool *pool);
+
+    // Writes the file header and the schema
+    int open();
+
+    // Fails with the error from writing the previous batch, if any
+    int add(const Entry &entry);
+
+    // Writes what's buffered and the footer, without which it's not a valid file
+    int finish();
+
+    uint64_t entryCount() const { return m_entryCount; }
+
+private:
+    enum Column {
+        TimestampColumn,
+        PriorityColumn,
+        UidColumn,
+        UsernameColumn,
+        GidColumn,
+        GroupNameColumn,
+        PidColumn,
+        HostnameColumn,
+        IdentifierColumn,
+        UnitColumn,
+        MessageColumn,
+        ColumnCount
+    };
+
+    struct EncodedColumn {
+        int64_t nullCount = 0;
+        // The validity bitmap (empty when there are no nulls) and then the
+        // offsets and/or values, depending on the type
+        std::vector<std::string> buffers;
+    };
+
+    // Only the values added since the last batch are written, as a delta
+    struct Dictionary {
+        std::unordered_map<std::string, int32_t> indexes;
+        std::vector<std::string> pending;
+        bool written = false;
+    };
+
+    struct Block {
+        int64_t offset;
+        int32_t metadataLength;
+        int32_t padding;
+        int64_t bodyLength;
+    };
+
+    void encodeColumn(Column column);
+    void encodeDictionary(Column column);
+    // Null if the entry doesn't have it
+    const std::string *dictionaryValue(Column column, const Entry &entry);
+
+    int writeBatch();
+    int writeMessage(const std::string &metadata, const std::vector<const std::string*> &buffers, std::vector<Block> *blocks);
+    void write(const void *data, size_t size);
+
+    FILE *m_file;
+    ThreadPool *m_pool;
+    int m_error = 0;
+    uint64_t m_offset = 0;
+
+    // The batch being filled, the entries are reused so they don't allocate
+    std::vector<Entry> m_rows;
+    size_t m_rowCount = 0;
+    size_t m_batchBytes = 0;
+    uint64_t m_entryCount = 0;
+
+    EncodedColumn m_columns[ColumnCount];
+    // Only used for the dictionary encoded columns, each is only touched by
+    // the worker encoding that column
+    Dictionary m_dictionaries[ColumnCount];
+
+    std::vector<Block> m_dictionaryBlocks;
+    std::vector<Block> m_batchBlocks;
+};
@@ -0,0 +1,285 @@
+extern "C" {
+#include <errno.h>
+#include <fcntl.h>
+#include <getopt.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/wait.h>
+#include <time.h>
+#include <unistd.h>
+#include <systemd/sd-journal.h>
+} // extern "C"
+
+#include "entry-format.h"
+#include "generated-source.h"
+#include "journal-source.h"
+#include "terminal-safe.h"
+
+#include <algorithm>
+#include <memory>
+#include <new>
+#include <string>
+#include <vector>
+
+// Microbenchmarks for the work done for every entry, in ns and allocations
+// per entry, on generated entries or a real journal.
+
+// Everything runs on one thread, so no need for atomics
+static uint64_t allocations = 0;
+
+void *operator new(size_t size)
+{
+    allocations++;
+    if (void *pointer = malloc(size ? size : 1)) {
+        return pointer;
+    }
+    throw std::bad_alloc();
+}
+
+void operator delete(void *pointer) noexcept
+{
+    free(pointer);
+}
+
+void operator delete(void *pointer, size_t) noexcept
+{
+    free(pointer);
+}
+
+// So the compiler can't throw away what we're measuring
+static volatile size_t sink;
+
+static uint64_t monotonicNsec()
+{
+    timespec now;
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    return now.tv_sec * 1000000000ULL + now.tv_nsec;
+}
+
+// Returns ns per op
+template<typename Function>
+static double benchmark(const char *name, size_t count, Function function)
+{
+    if (count == 0) {
+        return 0;
+    }
+    // Warms up the caches, and things like the NSS modules behind getpwuid()
+    for (size_t i = 0; i < std::min<size_t>(count, 1000); i++) {
+        function(i);
+    }
+
+    const uint64_t startAllocations = allocations;
+    const uint64_t start = monotonicNsec();
+    for (size_t i = 0; i < count; i++) {
+        function(i);
+    }
+    const double nsPerOp = double(monotonicNsec() - start) / count;
+    printf("%-28s %10.1f ns/op %8.2f allocs/op\n", name, nsPerOp, double(allocations - startAllocations) / count);
+    return nsPerOp;
+}
+
+// Runs journalctl on the same input with the output thrown away, returns
+// the wall time in ns
+static int64_t runJournalctl(const std::vector<std::string> &journalArguments)
+{
+    const uint64_t start = monotonicNsec();
+    const pid_t pid = fork();
+    if (pid < 0) {
+        return -errno;
+    }
+    if (pid == 0) {
+        const int null = open("/dev/null", O_WRONLY);
+        dup2(null, STDOUT_FILENO);
+        std::vector<std::string> arguments = { "journalctl", "--no-pager", "-o", "short" };
+        arguments.insert(arguments.end(), journalArguments.begin(), journalArguments.end());
+        std::vector<char*> argv;
+        for (std::string &argument : arguments) {
+            argv.push_back(argument.data());
+        }
+        argv.push_back(nullptr);
+        execvp(argv[0], argv.data());
+        _exit(127);
+    }
+    int status;
+    if (waitpid(pid, &status, 0) < 0) {
+        return -errno;
+    }
+    if (!WIFEXITED(status) || WEXITSTATUS(status) != 0) {
+        return -ECHILD;
+    }
+    return monotonicNsec() - start;
+}
+
+static void printUsage(const char *name)
+{
+    printf("Usage: %s [OPTIONS]\n"
+           "Measures the per-entry functions in ns and allocations per entry.\n"
+           "\n"
+           "  -e, --entries=N        Number of generated entries (default 100000)\n"
+           "      --users=N          Number of different uids in them (default 20)\n"
+           "  -D, --directory=DIR    Use the journal in DIR instead, and compare with journalctl\n"
+           "      --file=PATH        Use the journal file PATH instead, can be repeated\n"
+           "  -h, --help             Show this help\n",
+           name);
+}
+
+int main(int argc, char *argv[])
+{
+    enum {
+        OptionUsers = 0x100,
+        OptionFile
+    };
+    static const option longOptions[] = {
+        { "entries", required_argument, nullptr, 'e' },
+        { "users", required_argument, nullptr, OptionUsers },
+        { "directory", required_argument, nullptr, 'D' },
+        { "file", required_argument, nullptr, OptionFile },
+        { "help", no_argument, nullptr, 'h' },
+        { nullptr, 0, nullptr, 0 }
+    };
+
+    GeneratorOptions generator;
+    std::string directory;
+    std::vector<std::string> files;
+    int opt;
+    while ((opt = getopt_long(argc, argv, "e:D:h", longOptions, nullptr)) != -1) {
+        switch(opt) {
+        case 'e':
+            if (!parseNumber(optarg, &generator.entries)) {
+                printf("Invalid number of entries: %s\n", optarg);
+                return EINVAL;
+            }
+            break;
+        case OptionUsers:
+            if (!parseNumber(optarg, &generator.users) || generator.users == 0) {
+                printf("Invalid number of users: %s\n", optarg);
+                return EINVAL;
+            }
+            break;
+        case 'D':
+            directory = optarg;
+            break;
+        case OptionFile:
+            files.push_back(optarg);
+            break;
+        case 'h':
+            printUsage(argv[0]);
+            return 0;
+        default:
+            printUsage(argv[0]);
+            return EINVAL;
+        }
+    }
+
+    std::unique_ptr<JournalSource> source;
+    std::vector<std::string> journalArguments;
+    if (!directory.empty() || !files.empty()) {
+        sd_journal *journal;
+        int ret;
+        if (!directory.empty()) {
+            ret = sd_journal_open_directory(&journal, directory.c_str(), 0);
+            journalArguments = { "-D", directory };
+        } else {
+            std::vector<const char*> paths;
+            for (const std::string &path : files) {
+                paths.push_back(path.c_str());
+                journalArguments.push_back("--file=" + path);
+            }
+            paths.push_back(nullptr);
+            ret = sd_journal_open_files(&journal, paths.data(), 0);
+        }
+        if (ret < 0) {
+            printf("Failed to open journal: %s\n", strerror(-ret));
+            return -ret;
+        }
+        source = std::make_unique<SdJournalSource>(journal);
+    } else {
+        source = std::make_unique<GeneratedSource>(generator);
+    }
+
+    // Everything but the reading works on these, so it's the same distribution
+    std::vector<Entry> entries;
+    source->seekHead();
+    {
+        Entry entry;
+        while (source->next() > 0) {
+            if (source->readEntry(&entry, messageLineFields) >= 0) {
+                entries.push_back(entry);
+            }
+        }
+    }
+    printf("%zu entries from %s\n\n", entries.size(), journalArguments.empty() ? "the generator" : "the journal");
+
+    Entry entry;
+    source->seekHead();
+    benchmark("readEntry()", entries.size(), [&](size_t) {
+        if (source->next() <= 0) {
+            source->seekHead();
+            source->next();
+        }
+        source->readEntry(&entry, messageLineFields);
+        sink = entry.message.size();
+    });
+    source->seekHead();
+    benchmark("data(\"MESSAGE\")", entries.size(), [&](size_t) {
+        if (source->next() <= 0) {
+            source->seekHead();
+            source->next();
+        }
+        std::string_view message;
+        source->data("MESSAGE", &message);
+        sink = message.size();
+    });
+
+    benchmark("getUsername()", entries.size(), [&](size_t i) {
+        sink = getUsername(entries[i].uidNumber, entries[i].uid).size();
+    });
+    benchmark("priorityColor()", entries.size(), [&](size_t i) {
+        sink = size_t(priorityColor(entries[i].priorityLevel));
+    });
+
+    std::string line;
+    benchmark("appendTimestamp()", entries.size(), [&](size_t i) {
+        line.clear();
+        appendTimestamp(entries[i].realtime, &line);
+        sink = line.size();
+    });
+    benchmark("appendTerminalSafe()", entries.size(), [&](size_t i) {
+        line.clear();
+        appendTerminalSafe(entries[i].message, &line);
+        sink = line.size();
+    });
+    benchmark("formatEntry()", entries.size(), [&](size_t i) {
+        line.clear();
+        formatEntry(entries[i], &line);
+        sink = line.size();
+    });
+
+    // The whole thing, against what journalctl does with the same input
+    FILE *null = fopen("/dev/null", "w");
+    source->seekHead();
+    const double ours = benchmark("read, format and write", entries.size(), [&](size_t) {
+        if (source->next() <= 0) {
+            source->seekHead();
+            source->next();
+        }
+        source->readEntry(&entry, messageLineFields);
+        line.clear();
+        formatEntry(entry, &line);
+        fwrite(line.data(), 1, line.size(), null);
+    });
+    fclose(null);
+
+    if (journalArguments.empty() || entries.empty()) {
+        return 0;
+    }
+    const int64_t journalctl = runJournalctl(journalArguments);
+    if (journalctl < 0) {
+        printf("Failed to run journalctl: %s\n", strerror(-journalctl));
+        return -journalctl;
+    }
+    const double journalctlPerEntry = double(journalctl) / entries.size();
+    printf("%-28s %10.1f ns/op (%.2fx ours, including startup)\n", "journalctl -o short", journalctlPerEntry, journalctlPerEntry / ours);
+    return 0;
+}
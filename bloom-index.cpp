@@ -0,0 +1,350 @@
+#include "bloom-index.h"
+#include "header-cache.h"
+#include "text-index.h"
+
+extern "C" {
+#include <endian.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <string.h>
+#include <unistd.h>
+} // extern "C"
+
+#include <algorithm>
+#include <fstream>
+#include <sstream>
+
+// File: "JWBF", le32 version, file ID, then chunks:
+// le64 first position, le32 entry count, le32 filter size in bytes, filter
+//
+// The filter size is a power of two, picked per chunk from the number of
+// distinct keys in it.
+namespace {
+
+const char fileMagic[4] = { 'J', 'W', 'B', 'F' };
+constexpr uint32_t formatVersion = 1;
+constexpr size_t fileHeaderSize = 4 + 4 + 16;
+constexpr size_t chunkHeaderSize = 8 + 4 + 4;
+
+// With 10 bits per key and 6 hashes about 1% false positives per key, and
+// patterns usually have several keys.
+constexpr uint64_t bitsPerKey = 10;
+constexpr int hashCount = 6;
+constexpr uint32_t minimumFilterSize = 64;
+constexpr uint32_t maximumFilterSize = 1 << 20;
+
+// Don't keep too much in memory while indexing big files
+constexpr size_t flushSize = 1 << 20;
+
+constexpr uint64_t identifierTag = 0x6964656e74696669ULL;
+
+void write32(std::string *out, uint32_t value)
+{
+    value = htole32(value);
+    out->append(reinterpret_cast<const char*>(&value), sizeof value);
+}
+
+void write64(std::string *out, uint64_t value)
+{
+    value = htole64(value);
+    out->append(reinterpret_cast<const char*>(&value), sizeof value);
+}
+
+uint32_t read32(const char *data)
+{
+    uint32_t value;
+    memcpy(&value, data, sizeof value);
+    return le32toh(value);
+}
+
+uint64_t read64(const char *data)
+{
+    uint64_t value;
+    memcpy(&value, data, sizeof value);
+    return le64toh(value);
+}
+
+// splitmix64, has to stay the same or existing indexes break
+uint64_t mix(uint64_t value)
+{
+    value += 0x9e3779b97f4a7c15ULL;
+    value = (value ^ (value >> 30)) * 0xbf58476d1ce4e5b9ULL;
+    value = (value ^ (value >> 27)) * 0x94d049bb133111ebULL;
+    return value ^ (value >> 31);
+}
+
+// Every (lowercased) three letter sequence inside the words of text. A match
+// of the pattern has to contain all the sequences of the pattern, wherever in
+// a word it starts and ends, so this works for plain substring matches.
+void trigramKeys(std::string_view text, std::vector<uint64_t> *keys)
+{
+    auto lower = [](unsigned char c) -> uint64_t {
+        return (c >= 'A' && c <= 'Z') ? c + 'a' - 'A' : c;
+    };
+    size_t i = 0;
+    while (i < text.size()) {
+        if (!isTermCharacter(text[i])) {
+            i++;
+            continue;
+        }
+        const size_t start = i;
+        while (i < text.size() && isTermCharacter(text[i])) {
+            i++;
+        }
+        for (size_t j = start; j + 3 <= i; j++) {
+            keys->push_back(mix(lower(text[j]) | lower(text[j + 1]) << 8 | lower(text[j + 2]) << 16));
+        }
+    }
+}
+
+uint64_t identifierKey(std::string_view identifier)
+{
+    // FNV-1a
+    uint64_t hash = 0xcbf29ce484222325ULL;
+    for (const unsigned char c : identifier) {
+        hash = (hash ^ c) * 0x100000001b3ULL;
+    }
+    return mix(hash ^ identifierTag);
+}
+
+bool mightContain(std::string_view bits, uint64_t key)
+{
+    const uint64_t mask = bits.size() * 8 - 1;
+    const uint32_t low = key;
+    const uint32_t high = (key >> 32) | 1;
+    for (int i = 0; i < hashCount; i++) {
+        const uint64_t bit = (low + uint64_t(i) * high) & mask;
+        if (!(uint8_t(bits[bit / 8]) & (1 << (bit % 8)))) {
+            return false;
+        }
+    }
+    return true;
+}
+
+void appendChunk(std::string *out, uint64_t firstPosition, uint64_t entryCount, std::vector<uint64_t> *keys)
+{
+    std::sort(keys->begin(), keys->end());
+    keys->erase(std::unique(keys->begin(), keys->end()), keys->end());
+
+    uint32_t size = minimumFilterSize;
+    while (size < maximumFilterSize && uint64_t(size) * 8 < keys->size() * bitsPerKey) {
+        size *= 2;
+    }
+    std::string bits(size, '\0');
+    const uint64_t mask = uint64_t(size) * 8 - 1;
+    for (const uint64_t key : *keys) {
+        const uint32_t low = key;
+        const uint32_t high = (key >> 32) | 1;
+        for (int i = 0; i < hashCount; i++) {
+            const uint64_t bit = (low + uint64_t(i) * high) & mask;
+            bits[bit / 8] |= char(1 << (bit % 8));
+        }
+    }
+
+    write64(out, firstPosition);
+    write32(out, entryCount);
+    write32(out, size);
+    *out += bits;
+    keys->clear();
+}
+
+} // namespace
+
+BloomIndex::BloomIndex(const sd_id128_t &fileId) :
+    m_fileId(fileId)
+{
+    const std::string directory = cacheSubdirectory("bloom", false);
+    if (!directory.empty()) {
+        char id[SD_ID128_STRING_MAX];
+        m_path = directory + "/" + sd_id128_to_string(fileId, id);
+    }
+}
+
+int BloomIndex::load()
+{
+    m_contents.clear();
+    m_chunks.clear();
+    m_validSize = 0;
+    m_coveredEntries = 0;
+    if (m_path.empty()) {
+        return -ENOENT;
+    }
+
+    std::ifstream file(m_path, std::ios::binary);
+    if (!file) {
+        return 0;
+    }
+    std::ostringstream buffer;
+    buffer << file.rdbuf();
+    m_contents = buffer.str();
+
+    const std::string_view contents = m_contents;
+    if (contents.size() < fileHeaderSize ||
+            memcmp(contents.data(), fileMagic, sizeof fileMagic) != 0 ||
+            read32(contents.data() + 4) != formatVersion ||
+            memcmp(contents.data() + 8, &m_fileId, sizeof m_fileId) != 0) {
+        // Unusable, will be rewritten from scratch
+        m_contents.clear();
+        return 0;
+    }
+
+    size_t offset = fileHeaderSize;
+    m_validSize = offset;
+    while (contents.size() - offset >= chunkHeaderSize) {
+        const char *header = contents.data() + offset;
+        Chunk chunk;
+        chunk.firstPosition = read64(header);
+        chunk.entryCount = read32(header + 8);
+        const uint32_t size = read32(header + 12);
+
+        // Chunks are only valid if they continue where the last one stopped
+        const size_t available = contents.size() - offset - chunkHeaderSize;
+        if (chunk.firstPosition != m_coveredEntries || chunk.entryCount == 0 ||
+                size < minimumFilterSize || size > maximumFilterSize || (size & (size - 1)) || size > available) {
+            break;
+        }
+        chunk.bits = contents.substr(offset + chunkHeaderSize, size);
+
+        offset += chunkHeaderSize + size;
+        m_validSize = offset;
+        m_coveredEntries += chunk.entryCount;
+        m_chunks.push_back(chunk);
+    }
+
+    return 0;
+}
+
+void BloomIndex::chunksContaining(const std::vector<uint64_t> &keys, bool anyKey, std::vector<PositionRange> *ranges) const
+{
+    ranges->clear();
+    for (const Chunk &chunk : m_chunks) {
+        auto contains = [&](uint64_t key) { return mightContain(chunk.bits, key); };
+        const bool possible = anyKey ?
+            std::any_of(keys.begin(), keys.end(), contains) :
+            std::all_of(keys.begin(), keys.end(), contains);
+        if (!possible) {
+            continue;
+        }
+        const uint64_t end = chunk.firstPosition + chunk.entryCount;
+        if (!ranges->empty() && ranges->back().end == chunk.firstPosition) {
+            ranges->back().end = end;
+        } else {
+            ranges->push_back({ chunk.firstPosition, end });
+        }
+    }
+}
+
+bool BloomIndex::candidates(std::string_view pattern, std::vector<PositionRange> *ranges) const
+{
+    std::vector<uint64_t> keys;
+    trigramKeys(pattern, &keys);
+    if (keys.empty()) {
+        return false;
+    }
+    std::sort(keys.begin(), keys.end());
+    keys.erase(std::unique(keys.begin(), keys.end()), keys.end());
+    chunksContaining(keys, false, ranges);
+    return true;
+}
+
+void BloomIndex::identifierCandidates(const std::vector<std::string> &identifiers, std::vector<PositionRange> *ranges) const
+{
+    std::vector<uint64_t> keys;
+    for (const std::string &identifier : identifiers) {
+        keys.push_back(identifierKey(identifier));
+    }
+    chunksContaining(keys, true, ranges);
+}
+
+int BloomIndex::appendChunks(std::string data)
+{
+    if (m_validSize == 0) {
+        std::string header;
+        header.append(fileMagic, sizeof fileMagic);
+        write32(&header, formatVersion);
+        header.append(reinterpret_cast<const char*>(&m_fileId), sizeof m_fileId);
+        data.insert(0, header);
+    }
+
+    cacheSubdirectory("bloom", true);
+    const int fd = open(m_path.c_str(), O_WRONLY | O_CREAT | O_CLOEXEC, 0600);
+    if (fd < 0) {
+        return -errno;
+    }
+    // Throw away anything half written by an earlier run that got killed
+    if (ftruncate(fd, m_validSize) < 0 || lseek(fd, m_validSize, SEEK_SET) < 0) {
+        const int ret = -errno;
+        close(fd);
+        return ret;
+    }
+    size_t written = 0;
+    while (written < data.size()) {
+        const ssize_t ret = write(fd, data.data() + written, data.size() - written);
+        if (ret < 0) {
+            if (errno == EINTR) {
+                continue;
+            }
+            const int error = -errno;
+            close(fd);
+            return error;
+        }
+        written += ret;
+    }
+    close(fd);
+
+    m_validSize += data.size();
+    return 0;
+}
+
+int BloomIndex::update(JournalFile *journal, bool complete)
+{
+    const uint64_t end = journal->entryCount();
+    uint64_t position = m_coveredEntries;
+    if (position >= end) {
+        return 0;
+    }
+
+    journal->setFields(withFallbacks(FieldMessage | FieldIdentifier));
+    Entry entry;
+    std::vector<uint64_t> keys;
+    std::string data;
+    uint64_t chunkStart = position;
+    for (; position < end; position++) {
+        // Still being written or broken, the chunks have to be contiguous so
+        // stop here either way.
+        if (journal->readEntry(position, &entry) < 0) {
+            break;
+        }
+        trigramKeys(entry.message, &keys);
+        keys.push_back(identifierKey(entry.identifier.empty() ? entry.comm : entry.identifier));
+
+        if (position + 1 - chunkStart < BloomChunkEntries) {
+            continue;
+        }
+        appendChunk(&data, chunkStart, position + 1 - chunkStart, &keys);
+        chunkStart = position + 1;
+        if (data.size() >= flushSize) {
+            const int ret = appendChunks(data);
+            if (ret < 0) {
+                return ret;
+            }
+            data.clear();
+        }
+    }
+    if (complete && position > chunkStart) {
+        appendChunk(&data, chunkStart, position - chunkStart, &keys);
+    }
+    if (!data.empty()) {
+        const int ret = appendChunks(data);
+        if (ret < 0) {
+            return ret;
+        }
+    }
+
+    return load();
+}
+
+void BloomIndex::removeStale(const std::vector<sd_id128_t> &existing)
+{
+    removeStaleCaches("bloom", existing);
+}
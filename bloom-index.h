@@ -0,0 +1,68 @@
+#pragma once
+
+#include "journal-file.h"
+
+extern "C" {
+#include <systemd/sd-id128.h>
+} // extern "C"
+
+#include <cstdint>
+#include <string>
+#include <string_view>
+#include <vector>
+
+// Entries per Bloom filter
+constexpr uint64_t BloomChunkEntries = 4096;
+
+// A much smaller alternative to the TextIndex: one Bloom filter per chunk of
+// entries, over the three letter sequences in the MESSAGE words and over the
+// identifiers. It can't say which entries match, only which chunks can't, but
+// for rare words that's most of them.
+//
+// Stored as ~/.cache/journal-watch/bloom/<file id>, chunks are only appended.
+class BloomIndex
+{
+public:
+    explicit BloomIndex(const sd_id128_t &fileId);
+
+    // Returns 0 if there's no index yet as well
+    int load();
+
+    // Everything before this position is covered by the index
+    uint64_t coveredEntries() const { return m_coveredEntries; }
+
+    // The chunks that can contain pattern as a substring in the message.
+    // Returns false if the pattern is too short to look up.
+    bool candidates(std::string_view pattern, std::vector<PositionRange> *ranges) const;
+
+    // The chunks that can contain entries with any of these SYSLOG_IDENTIFIERs
+    // (or _COMM if there's none)
+    void identifierCandidates(const std::vector<std::string> &identifiers, std::vector<PositionRange> *ranges) const;
+
+    // Adds chunks for the entries after what's covered. Unless complete is set
+    // (i.e. the file is archived) a partial chunk at the end is left for later.
+    int update(JournalFile *journal, bool complete);
+
+    // Removes indexes of journal files that don't exist anymore
+    static void removeStale(const std::vector<sd_id128_t> &existing);
+
+private:
+    struct Chunk {
+        uint64_t firstPosition;
+        uint64_t entryCount;
+        std::string_view bits;
+    };
+
+    // With anyKey the chunks that can contain one of the keys, otherwise all
+    void chunksContaining(const std::vector<uint64_t> &keys, bool anyKey, std::vector<PositionRange> *ranges) const;
+    int appendChunks(std::string data);
+
+    std::string m_path;
+    sd_id128_t m_fileId;
+
+    // Backing storage for the chunks
+    std::string m_contents;
+    size_t m_validSize = 0;
+    std::vector<Chunk> m_chunks;
+    uint64_t m_coveredEntries = 0;
+};
@@ -0,0 +1,177 @@
+#include "catalog.h"
+
+extern "C" {
+#include <stdlib.h>
+#include <systemd/sd-id128.h>
+#include <systemd/sd-journal.h>
+} // extern "C"
+
+#include "terminal-safe.h"
+
+#include <algorithm>
+
+namespace {
+
+// Made up MESSAGE_IDs shouldn't be able to use up all the memory
+constexpr size_t maxTemplates = 1024;
+constexpr size_t maxRendered = 4096;
+// libsystemd puts in the name instead of values longer than this (with the
+// FIELD=), so we do the same
+constexpr size_t maxValue = 256;
+
+// What journalctl -x puts in front of each line of the explanation
+constexpr std::string_view linePrefix = "\033[02;37m░░ \033[0m";
+
+bool isVariable(std::string_view name)
+{
+    for (const char c : name) {
+        if (!((c >= 'A' && c <= 'Z') || (c >= '0' && c <= '9') || c == '_')) {
+            return false;
+        }
+    }
+    return !name.empty();
+}
+
+} // namespace
+
+const Catalog::Template *Catalog::lookup(const std::string &messageId)
+{
+    const auto it = m_templates.find(messageId);
+    if (it != m_templates.end()) {
+        return it->second.get();
+    }
+    if (m_templates.size() >= maxTemplates) {
+        m_templates.clear();
+    }
+
+    // The ones that aren't in the catalog are remembered as null
+    std::unique_ptr<Template> parsed;
+    sd_id128_t id;
+    char *catalogText = nullptr;
+    if (sd_id128_from_string(messageId.c_str(), &id) >= 0 && sd_journal_get_catalog_for_message_id(id, &catalogText) >= 0) {
+        parsed = std::make_unique<Template>();
+        parsed->text.emplace_back();
+
+        // Same as replace_var() in systemd, an @ that doesn't start a name
+        // made of uppercase letters, digits and underscores is left alone
+        const std::string_view text(catalogText);
+        size_t i = 0;
+        while (i < text.size()) {
+            const size_t end = text[i] == '@' ? text.find('@', i + 1) : std::string_view::npos;
+            if (end != std::string_view::npos && isVariable(text.substr(i + 1, end - i - 1))) {
+                parsed->fields.emplace_back(text.substr(i + 1, end - i - 1));
+                parsed->text.emplace_back();
+                i = end + 1;
+                continue;
+            }
+            parsed->text.back().push_back(text[i]);
+            i++;
+        }
+        free(catalogText);
+    }
+    return m_templates.emplace(messageId, std::move(parsed)).first->second.get();
+}
+
+void Catalog::explain(JournalSource *source, Entry *entry)
+{
+    entry->catalog.clear();
+    if (entry->messageId.empty()) {
+        return;
+    }
+    const Template *text = lookup(entry->messageId);
+    if (!text) {
+        return;
+    }
+
+    m_values.resize(text->fields.size());
+    for (size_t i = 0; i < text->fields.size(); i++) {
+        const std::string &field = text->fields[i];
+        std::string_view value;
+        if (source->data(field.c_str(), &value) < 0 || field.size() + 1 + value.size() > maxValue) {
+            m_values[i] = field;
+        } else {
+            m_values[i].assign(value);
+        }
+    }
+    render(*text, entry->messageId, entry);
+}
+
+void Catalog::explain(JournalFileSet *journals, Entry *entry)
+{
+    entry->catalog.clear();
+    if (entry->messageId.empty()) {
+        return;
+    }
+    const Template *text = lookup(entry->messageId);
+    if (!text) {
+        return;
+    }
+
+    // Only the first one counts if a field is there more than once
+    m_values.resize(text->fields.size());
+    std::vector<bool> found(text->fields.size());
+    const int ret = journals->enumerateData([&](std::string_view data) {
+        const size_t separator = data.find('=');
+        if (separator == std::string_view::npos) {
+            return;
+        }
+        for (size_t i = 0; i < text->fields.size(); i++) {
+            if (!found[i] && data.substr(0, separator) == text->fields[i]) {
+                found[i] = true;
+                m_values[i].assign(data.size() <= maxValue ? data.substr(separator + 1) : data.substr(0, separator));
+            }
+        }
+    });
+    if (ret < 0) {
+        return;
+    }
+    for (size_t i = 0; i < text->fields.size(); i++) {
+        if (!found[i]) {
+            m_values[i] = text->fields[i];
+        }
+    }
+    render(*text, entry->messageId, entry);
+}
+
+void Catalog::render(const Template &text, const std::string &messageId, Entry *entry)
+{
+    m_key = messageId;
+    for (const std::string &value : m_values) {
+        m_key.push_back('\0');
+        m_key.append(value);
+    }
+    auto it = m_rendered.find(m_key);
+    if (it != m_rendered.end()) {
+        entry->catalog = it->second;
+        return;
+    }
+
+    // The values are from the entry, so they're escaped like the message.
+    // The catalog itself is trusted.
+    std::string filledIn = text.text[0];
+    for (size_t i = 0; i < m_values.size(); i++) {
+        appendTerminalSafe(m_values[i], &filledIn);
+        filledIn.append(text.text[i + 1]);
+    }
+
+    // Without the whitespace around it, and with every line prefixed, like
+    // journalctl does
+    const size_t start = filledIn.find_first_not_of(" \t\n\r");
+    std::string rendered;
+    if (start != std::string::npos) {
+        const std::string_view stripped = std::string_view(filledIn).substr(start, filledIn.find_last_not_of(" \t\n\r") + 1 - start);
+        size_t lineStart = 0;
+        while (lineStart <= stripped.size()) {
+            const size_t lineEnd = std::min(stripped.find('\n', lineStart), stripped.size());
+            rendered.append(linePrefix);
+            rendered.append(stripped.substr(lineStart, lineEnd - lineStart));
+            rendered.push_back('\n');
+            lineStart = lineEnd + 1;
+        }
+    }
+
+    if (m_rendered.size() >= maxRendered) {
+        m_rendered.clear();
+    }
+    entry->catalog = m_rendered.emplace(m_key, std::move(rendered)).first->second;
+}
@@ -0,0 +1,45 @@
+#pragma once
+
+#include "entry.h"
+#include "journal-file.h"
+#include "journal-source.h"
+
+#include <memory>
+#include <string>
+#include <string_view>
+#include <unordered_map>
+#include <vector>
+
+// The explanations from the message catalog that journalctl -x shows for
+// entries with a MESSAGE_ID. libsystemd looks the text up in the catalog
+// database and fills in the @FIELD@s for every single entry, so instead the
+// catalog is only asked once per MESSAGE_ID, and the finished text is kept
+// per MESSAGE_ID and field values so repeated events just reuse it.
+class Catalog
+{
+public:
+    // Sets entry->catalog for the entry the source is on, leaves it empty if
+    // there's no MESSAGE_ID or the catalog doesn't have it
+    void explain(JournalSource *source, Entry *entry);
+    void explain(JournalFileSet *journals, Entry *entry);
+
+private:
+    struct Template {
+        // The text around the @FIELD@s, there's one more of them than fields
+        std::vector<std::string> text;
+        std::vector<std::string> fields;
+    };
+
+    // Null if the catalog doesn't have it
+    const Template *lookup(const std::string &messageId);
+    // From the values in m_values
+    void render(const Template &text, const std::string &messageId, Entry *entry);
+
+    std::unordered_map<std::string, std::unique_ptr<Template>> m_templates;
+    // The key is the MESSAGE_ID and values, separated by nuls
+    std::unordered_map<std::string, std::string> m_rendered;
+
+    // Reused so looking up what's already rendered doesn't allocate
+    std::vector<std::string> m_values;
+    std::string m_key;
+};
@@ -0,0 +1,156 @@
+#include "control-socket.h"
+
+extern "C" {
+#include <errno.h>
+#include <poll.h>
+#include <string.h>
+#include <sys/eventfd.h>
+#include <sys/socket.h>
+#include <sys/stat.h>
+#include <sys/un.h>
+#include <unistd.h>
+} // extern "C"
+
+#include <utility>
+
+namespace {
+
+// Clients sending longer lines are disconnected, so they can't use up all the
+// memory
+constexpr size_t maxCommand = 4096;
+
+} // namespace
+
+ControlSocket::ControlSocket(std::string path, Handler handler) :
+    m_path(std::move(path)),
+    m_handler(std::move(handler))
+{
+}
+
+ControlSocket::~ControlSocket()
+{
+    if (m_thread.joinable()) {
+        const uint64_t one = 1;
+        if (write(m_stop, &one, sizeof one) == sizeof one) {
+            m_thread.join();
+        } else {
+            m_thread.detach();
+        }
+    }
+    if (m_socket >= 0) {
+        close(m_socket);
+        unlink(m_path.c_str());
+    }
+    if (m_stop >= 0) {
+        close(m_stop);
+    }
+}
+
+int ControlSocket::open()
+{
+    sockaddr_un address = {};
+    address.sun_family = AF_UNIX;
+    if (m_path.size() >= sizeof address.sun_path) {
+        return -ENAMETOOLONG;
+    }
+    memcpy(address.sun_path, m_path.c_str(), m_path.size() + 1);
+
+    m_stop = eventfd(0, EFD_CLOEXEC);
+    if (m_stop < 0) {
+        return -errno;
+    }
+    m_socket = socket(AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC, 0);
+    if (m_socket < 0) {
+        return -errno;
+    }
+
+    // Left behind if we were killed, but don't remove anything else
+    struct stat existing;
+    if (lstat(m_path.c_str(), &existing) == 0 && S_ISSOCK(existing.st_mode)) {
+        unlink(m_path.c_str());
+    }
+    // Anyone who can connect can change what's shown
+    const mode_t oldMask = umask(0077);
+    const int ret = bind(m_socket, reinterpret_cast<const sockaddr*>(&address), sizeof address);
+    umask(oldMask);
+    if (ret < 0 || listen(m_socket, 4) < 0) {
+        const int error = errno;
+        close(m_socket);
+        m_socket = -1;
+        return -error;
+    }
+
+    m_thread = std::thread(&ControlSocket::serve, this);
+    return 0;
+}
+
+void ControlSocket::serve()
+{
+    pollfd fds[] = { { m_socket, POLLIN, 0 }, { m_stop, POLLIN, 0 } };
+    while (true) {
+        if (poll(fds, 2, -1) < 0 && errno != EINTR) {
+            return;
+        }
+        if (fds[1].revents) {
+            return;
+        }
+        if (!fds[0].revents) {
+            continue;
+        }
+        const int client = accept4(m_socket, nullptr, nullptr, SOCK_CLOEXEC);
+        if (client < 0) {
+            continue;
+        }
+        const bool keepGoing = handleClient(client);
+        close(client);
+        if (!keepGoing) {
+            return;
+        }
+    }
+}
+
+bool ControlSocket::handleClient(int client)
+{
+    pollfd fds[] = { { client, POLLIN, 0 }, { m_stop, POLLIN, 0 } };
+    std::string buffer;
+    char chunk[1024];
+    while (true) {
+        if (poll(fds, 2, -1) < 0 && errno != EINTR) {
+            return true;
+        }
+        if (fds[1].revents) {
+            return false;
+        }
+        if (!fds[0].revents) {
+            continue;
+        }
+        const ssize_t length = read(client, chunk, sizeof chunk);
+        if (length < 0 && errno == EINTR) {
+            continue;
+        }
+        if (length <= 0) {
+            return true;
+        }
+        buffer.append(chunk, length);
+
+        size_t newline;
+        while ((newline = buffer.find('\n')) != std::string::npos) {
+            std::string_view command(buffer.data(), newline);
+            if (!command.empty() && command.back() == '\r') {
+                command.remove_suffix(1);
+            }
+            std::string answer = m_handler(command);
+            answer.push_back('\n');
+            // Not killed by SIGPIPE if they went away without waiting for it
+            if (send(client, answer.data(), answer.size(), MSG_NOSIGNAL) < 0) {
+                return true;
+            }
+            buffer.erase(0, newline + 1);
+        }
+        if (buffer.size() > maxCommand) {
+            static const char tooLong[] = "Command too long\n";
+            send(client, tooLong, sizeof tooLong - 1, MSG_NOSIGNAL);
+            return true;
+        }
+    }
+}
@@ -0,0 +1,39 @@
+#pragma once
+
+#include <functional>
+#include <string>
+#include <string_view>
+#include <thread>
+
+// The unix socket for --control, which takes commands while following, one per
+// line, and answers each with one line. Everything is done on a thread of its
+// own, so parsing the commands never holds up the entries. One client at a
+// time, e.g. with socat - UNIX-CONNECT:PATH.
+class ControlSocket
+{
+public:
+    // Gets the command without the newline, and returns the answer. Called on
+    // the socket's thread.
+    using Handler = std::function<std::string(std::string_view command)>;
+
+    ControlSocket(std::string path, Handler handler);
+    ~ControlSocket();
+
+    ControlSocket(const ControlSocket &) = delete;
+    ControlSocket &operator=(const ControlSocket &) = delete;
+
+    // Creates the socket, only accessible to our user, and starts the thread
+    int open();
+
+private:
+    void serve();
+    // False when we're stopping
+    bool handleClient(int client);
+
+    std::string m_path;
+    Handler m_handler;
+    int m_socket = -1;
+    // An eventfd that wakes up the thread when it should stop
+    int m_stop = -1;
+    std::thread m_thread;
+};
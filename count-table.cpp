@@ -0,0 +1,105 @@
+#include "count-table.h"
+
+extern "C" {
+#include <string.h>
+} // extern "C"
+
+#include <algorithm>
+
+bool parseCountField(const char *name, CountField *field)
+{
+    static const std::pair<const char*, CountField> fields[] = {
+        { "identifier", CountByIdentifier },
+        { "unit", CountByUnit },
+        { "priority", CountByPriority },
+        { "user", CountByUser }
+    };
+    for (const auto &[fieldName, value] : fields) {
+        if (strcmp(name, fieldName) == 0) {
+            *field = value;
+            return true;
+        }
+    }
+    return false;
+}
+
+FieldMask countFields(CountField field)
+{
+    switch(field) {
+    case CountByIdentifier:
+        return FieldIdentifier | FieldMessage;
+    case CountByUnit:
+        return FieldUnit | FieldMessage;
+    case CountByPriority:
+        return FieldPriority | FieldMessage;
+    case CountByUser:
+        return FieldUid | FieldMessage;
+    case CountByNothing:
+        break;
+    }
+    return FieldMessage;
+}
+
+CountTable::CountTable(CountField field, uint64_t bucketSize) :
+    m_field(field),
+    m_bucketSize(bucketSize)
+{
+}
+
+void CountTable::add(const Entry &entry)
+{
+    const std::string *key = nullptr;
+    switch(m_field) {
+    case CountByIdentifier:
+        key = entry.identifier.empty() ? &entry.comm : &entry.identifier;
+        break;
+    case CountByUnit:
+        key = &entry.unit;
+        break;
+    case CountByPriority:
+        key = &entry.priority;
+        break;
+    case CountByUser:
+        key = entry.uid.empty() ? &entry.auditLoginUid : &entry.uid;
+        break;
+    case CountByNothing:
+        return;
+    }
+
+    m_lookup.first = m_bucketSize ? entry.realtime - entry.realtime % m_bucketSize : 0;
+    m_lookup.second.assign(*key);
+    auto it = m_counters.find(m_lookup);
+    if (it == m_counters.end()) {
+        it = m_counters.emplace(m_lookup, Counter()).first;
+    }
+    it->second.entries++;
+    it->second.bytes += entry.message.size();
+}
+
+void CountTable::merge(const CountTable &other)
+{
+    for (const auto &[key, counter] : other.m_counters) {
+        Counter &merged = m_counters[key];
+        merged.entries += counter.entries;
+        merged.bytes += counter.bytes;
+    }
+}
+
+std::vector<CountTable::Row> CountTable::rows() const
+{
+    std::vector<Row> rows;
+    rows.reserve(m_counters.size());
+    for (const auto &[key, counter] : m_counters) {
+        rows.push_back({ key.first, key.second, counter });
+    }
+    std::sort(rows.begin(), rows.end(), [](const Row &a, const Row &b) {
+        if (a.bucket != b.bucket) {
+            return a.bucket < b.bucket;
+        }
+        if (a.counter.entries != b.counter.entries) {
+            return a.counter.entries > b.counter.entries;
+        }
+        return a.key < b.key;
+    });
+    return rows;
+}
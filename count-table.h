@@ -0,0 +1,67 @@
+#pragma once
+
+#include "entry.h"
+
+#include <cstdint>
+#include <string>
+#include <unordered_map>
+#include <utility>
+#include <vector>
+
+// What --count-by groups the entries by
+enum CountField {
+    CountByNothing,
+    CountByIdentifier,
+    CountByUnit,
+    CountByPriority,
+    CountByUser
+};
+
+bool parseCountField(const char *name, CountField *field);
+
+// The fields that need to be read for counting by field, MESSAGE is always
+// needed for the byte counts.
+FieldMask countFields(CountField field);
+
+struct Counter {
+    uint64_t entries = 0;
+    uint64_t bytes = 0;
+};
+
+// Number of entries and message bytes per time bucket and key. Each thread
+// fills its own table without any locking, and they're merged at the end.
+class CountTable
+{
+public:
+    struct Row {
+        // Start of the bucket in realtime usec, 0 without buckets
+        uint64_t bucket;
+        std::string key;
+        Counter counter;
+    };
+
+    // A bucket size of 0 puts everything in the same bucket
+    CountTable(CountField field, uint64_t bucketSize);
+
+    void add(const Entry &entry);
+    void merge(const CountTable &other);
+
+    // Sorted by bucket, then by the number of entries
+    std::vector<Row> rows() const;
+
+private:
+    using Key = std::pair<uint64_t, std::string>;
+    struct KeyHash {
+        size_t operator()(const Key &key) const
+        {
+            return std::hash<std::string>()(key.second) ^ std::hash<uint64_t>()(key.first) * 31;
+        }
+    };
+
+    CountField m_field;
+    uint64_t m_bucketSize;
+    std::unordered_map<Key, Counter, KeyHash> m_counters;
+
+    // Reused for lookups, so counting an entry doesn't allocate
+    Key m_lookup;
+};
@@ -0,0 +1,146 @@
+#include "decompress.h"
+
+extern "C" {
+#include <endian.h>
+#include <errno.h>
+#include <limits.h>
+#include <string.h>
+#include <lz4.h>
+#include <lzma.h>
+#include <zstd.h>
+} // extern "C"
+
+#include <algorithm>
+
+static int decompressXZ(const uint8_t *src, size_t size, std::string *out)
+{
+    lzma_stream stream = LZMA_STREAM_INIT;
+    if (lzma_stream_decoder(&stream, UINT64_MAX, 0) != LZMA_OK) {
+        return -ENOMEM;
+    }
+
+    // Usually compresses pretty well, so start with a bit of headroom
+    out->resize(std::max<size_t>(size * 4, 4096));
+    stream.next_in = src;
+    stream.avail_in = size;
+    stream.next_out = reinterpret_cast<uint8_t*>(out->data());
+    stream.avail_out = out->size();
+
+    while (true) {
+        const lzma_ret ret = lzma_code(&stream, LZMA_FINISH);
+        if (ret == LZMA_STREAM_END) {
+            break;
+        }
+        if (ret != LZMA_OK && ret != LZMA_BUF_ERROR) {
+            lzma_end(&stream);
+            return -EBADMSG;
+        }
+        if (stream.avail_out > 0) {
+            // No progress possible and no more output space needed, truncated
+            lzma_end(&stream);
+            return -EBADMSG;
+        }
+        if (out->size() >= MaxDecompressedSize) {
+            lzma_end(&stream);
+            return -E2BIG;
+        }
+
+        const size_t used = out->size();
+        out->resize(std::min(used * 2, MaxDecompressedSize));
+        stream.next_out = reinterpret_cast<uint8_t*>(out->data()) + used;
+        stream.avail_out = out->size() - used;
+    }
+
+    out->resize(stream.total_out);
+    lzma_end(&stream);
+    return 0;
+}
+
+static int decompressLZ4(const uint8_t *src, size_t size, std::string *out)
+{
+    // journald prefixes the LZ4 block with the uncompressed size
+    if (size <= 8) {
+        return -EBADMSG;
+    }
+    uint64_t expected;
+    memcpy(&expected, src, sizeof expected);
+    expected = le64toh(expected);
+    if (expected > MaxDecompressedSize || size - 8 > INT_MAX) {
+        return -E2BIG;
+    }
+
+    out->resize(expected);
+    const int ret = LZ4_decompress_safe(reinterpret_cast<const char*>(src) + 8, out->data(), size - 8, expected);
+    if (ret < 0 || uint64_t(ret) != expected) {
+        return -EBADMSG;
+    }
+    return 0;
+}
+
+static int decompressZSTD(const uint8_t *src, size_t size, std::string *out)
+{
+    const unsigned long long expected = ZSTD_getFrameContentSize(src, size);
+    if (expected == ZSTD_CONTENTSIZE_ERROR) {
+        return -EBADMSG;
+    }
+    if (expected != ZSTD_CONTENTSIZE_UNKNOWN) {
+        if (expected > MaxDecompressedSize) {
+            return -E2BIG;
+        }
+        out->resize(expected);
+        const size_t ret = ZSTD_decompress(out->data(), expected, src, size);
+        if (ZSTD_isError(ret) || ret != expected) {
+            return -EBADMSG;
+        }
+        return 0;
+    }
+
+    // Size not stored in the frame, have to stream it
+    ZSTD_DStream *stream = ZSTD_createDCtx();
+    if (!stream) {
+        return -ENOMEM;
+    }
+    ZSTD_inBuffer input = { src, size, 0 };
+    out->resize(ZSTD_DStreamOutSize());
+    ZSTD_outBuffer output = { out->data(), out->size(), 0 };
+    while (true) {
+        const size_t ret = ZSTD_decompressStream(stream, &output, &input);
+        if (ZSTD_isError(ret)) {
+            ZSTD_freeDCtx(stream);
+            return -EBADMSG;
+        }
+        if (ret == 0) {
+            break;
+        }
+        if (input.pos == input.size && output.pos < output.size) {
+            ZSTD_freeDCtx(stream);
+            return -EBADMSG;
+        }
+        if (output.pos == output.size) {
+            if (out->size() >= MaxDecompressedSize) {
+                ZSTD_freeDCtx(stream);
+                return -E2BIG;
+            }
+            out->resize(std::min(out->size() * 2, MaxDecompressedSize));
+            output.dst = out->data();
+            output.size = out->size();
+        }
+    }
+    out->resize(output.pos);
+    ZSTD_freeDCtx(stream);
+    return 0;
+}
+
+int decompressBlob(uint8_t flags, const uint8_t *src, size_t size, std::string *out)
+{
+    switch(flags & CompressionMask) {
+    case CompressedXZ:
+        return decompressXZ(src, size, out);
+    case CompressedLZ4:
+        return decompressLZ4(src, size, out);
+    case CompressedZSTD:
+        return decompressZSTD(src, size, out);
+    default:
+        return -EPROTONOSUPPORT;
+    }
+}
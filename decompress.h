@@ -0,0 +1,22 @@
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <string>
+
+// Object flags used by journald for compressed data objects
+enum CompressionFlag : uint8_t {
+    CompressedXZ = 1 << 0,
+    CompressedLZ4 = 1 << 1,
+    CompressedZSTD = 1 << 2,
+
+    CompressionMask = CompressedXZ | CompressedLZ4 | CompressedZSTD
+};
+
+// Nothing in the journal should ever be bigger than this, so treat anything
+// larger as corruption instead of trying to allocate it.
+constexpr size_t MaxDecompressedSize = 768 * 1024 * 1024;
+
+// Decompresses a data object payload stored with the given object flags.
+// Returns 0 on success or a negative errno.
+int decompressBlob(uint8_t flags, const uint8_t *src, size_t size, std::string *out);
@@ -0,0 +1,180 @@
+#include "entry-format.h"
+#include "terminal-safe.h"
+
+extern "C" {
+#include <stdio.h>
+#include <time.h>
+} // extern "C"
+
+#include <ctime>
+
+namespace Color {
+    const char *brightGray = "\033[00;37m";
+
+    const char *white = "\033[00;39m";
+    const char *brightWhite = "\033[01;39m";
+
+    const char *blue = "\033[00;34m";
+    const char *brightBlue = "\033[01;34m";
+
+    const char *green = "\033[00;32m";
+    const char *brightGreen = "\033[01;32m";
+
+    const char *yellow = "\033[00;93m";
+    const char *brightYellow = "\033[01;33m";
+
+    const char *orange = "\033[00;33m";
+    const char *red = "\033[00;31m";
+    const char *brightRed = "\033[00;101m";
+
+    const char *reset = "\033[0m";
+
+    // Same as grep --color
+    const char *match = "\033[01;31m";
+};
+
+const char *priorityColor(int level)
+{
+    switch(level) {
+    case Emergency:
+        return Color::brightRed;
+    case Alert:
+        return Color::red;
+    case Critical:
+        return Color::orange;
+    case Error:
+        return Color::brightYellow;
+    case Warning:
+        return Color::yellow;
+    case Notice:
+        return Color::green;
+    case Informational:
+        return Color::white;
+    case Debug:
+    default:
+        return Color::brightGray;
+    }
+}
+
+void appendTimestamp(uint64_t realtime, std::string *out)
+{
+    const time_t sec = realtime / 1000000;
+    std::tm tm;
+    localtime_r(&sec, &tm);
+    char buffer[64];
+    out->append(buffer, strftime(buffer, sizeof buffer, "%H:%M:%S %b %d ", &tm));
+}
+
+// Looks for the matches in the raw message first, so a match can't be split
+// by the escaping, and then escapes the pieces between them
+static void appendHighlighted(std::string_view message, std::string_view highlight, const char *color, std::string *out)
+{
+    size_t start = 0;
+    size_t match;
+    while ((match = message.find(highlight, start)) != std::string_view::npos) {
+        appendTerminalSafe(message.substr(start, match - start), out);
+        out->append(Color::match);
+        appendTerminalSafe(message.substr(match, highlight.size()), out);
+        out->append(color);
+        start = match + highlight.size();
+    }
+    appendTerminalSafe(message.substr(start), out);
+}
+
+void formatEntry(const Entry &entry, std::string *out, const ProcessInfo *process, bool identity, std::string_view highlight)
+{
+    out->append("\033[02;37m");
+    appendTimestamp(entry.realtime, out);
+    // Everything but the timestamp can come from whatever logged it, or
+    // whoever picked their username or tty
+    appendTerminalSafe(entry.hostname, out);
+
+    if (!entry.uid.empty()) {
+        out->push_back(':');
+        appendTerminalSafe(getUsername(entry.uidNumber, entry.uid), out);
+    } else if (!entry.auditLoginUid.empty()) {
+        uint32_t uid;
+        if (!parseNumber(entry.auditLoginUid, &uid)) {
+            uid = InvalidId;
+        }
+        out->push_back(':');
+        appendTerminalSafe(getUsername(uid, entry.auditLoginUid), out);
+    }
+    if (identity && !entry.gid.empty()) {
+        out->push_back(':');
+        appendTerminalSafe(getGroupName(entry.gidNumber, entry.gid), out);
+    }
+
+    out->push_back(' ');
+    appendTerminalSafe(entry.identifier.empty() ? entry.comm : entry.identifier, out);
+
+    if (!entry.pid.empty()) {
+        out->push_back('[');
+        appendTerminalSafe(entry.pid, out);
+        out->push_back(']');
+    }
+
+    if (process) {
+        // e.g. " (nginx: worker process; parent nginx[1233]; container 0123456789ab)"
+        const size_t start = out->size() + 2;
+        out->append(" (");
+        appendTerminalSafe(process->commandLine, out);
+        if (process->parentPid != InvalidId) {
+            out->append(out->size() > start ? "; parent " : "parent ");
+            appendTerminalSafe(process->parentName, out);
+            out->push_back('[');
+            out->append(std::to_string(process->parentPid));
+            out->push_back(']');
+        }
+        if (!process->container.empty()) {
+            out->append(out->size() > start ? "; container " : "container ");
+            out->append(process->container);
+        }
+        out->push_back(')');
+    }
+
+    // Not set for processes that aren't part of a login session
+    uint32_t session;
+    if (identity && parseNumber(entry.auditSession, &session) && session != InvalidId) {
+        out->append(" (session ");
+        out->append(entry.auditSession);
+        if (const LoginSession *login = getLoginSession(entry.auditSession)) {
+            out->append(" of ");
+            appendTerminalSafe(login->user, out);
+            if (!login->tty.empty()) {
+                out->append(" on ");
+                appendTerminalSafe(login->tty, out);
+            }
+            if (!login->remoteHost.empty()) {
+                out->append(" from ");
+                appendTerminalSafe(login->remoteHost, out);
+            }
+        }
+        out->push_back(')');
+    }
+
+    out->append(": ");
+    const char *color = priorityColor(entry.priorityLevel >= 0 ? entry.priorityLevel : int(Debug));
+    out->append(color);
+    if (highlight.empty()) {
+        appendTerminalSafe(entry.message, out);
+    } else {
+        appendHighlighted(entry.message, highlight, color, out);
+    }
+    out->append(Color::reset);
+    out->push_back('\n');
+    out->append(entry.catalog);
+}
+
+int print_journal_message(const Entry &entry, const ProcessInfo *process, bool identity, std::string_view highlight)
+{
+    // Reused, so printing a line doesn't allocate
+    static std::string line;
+    line.clear();
+    formatEntry(entry, &line, process, identity, highlight);
+    fwrite(line.data(), 1, line.size(), stdout);
+    // Flushed for every line, like std::endl did
+    fflush(stdout);
+
+    return 0;
+}
@@ -0,0 +1,38 @@
+#pragma once
+
+#include "entry.h"
+#include "identity.h"
+#include "process-info.h"
+
+#include <cstdint>
+#include <string>
+#include <string_view>
+
+enum LogLevel {
+    Emergency = 0,
+    Alert = 1,
+    Critical = 2,
+    Error = 3,
+    Warning = 4,
+    Notice = 5,
+    Informational = 6,
+    Debug = 7
+};
+
+// What print_journal_message() shows
+constexpr FieldMask messageLineFields = FieldPriority | FieldHostname | FieldUid | FieldIdentifier | FieldPid | FieldMessage;
+
+// Escape sequence for the message, missing or invalid priorities are debug
+const char *priorityColor(int level);
+
+// "HH:MM:SS Mon DD " in local time
+void appendTimestamp(uint64_t realtime, std::string *out);
+
+// Appends the line print_journal_message() prints, newline included. The
+// process info, if any, goes after the pid. With identity the group and the
+// login session are shown as well, which needs FieldGid and FieldAuditSession.
+// Where highlight (the --grep pattern) is in the message it's shown in bold
+// red, like grep --color does.
+void formatEntry(const Entry &entry, std::string *out, const ProcessInfo *process = nullptr, bool identity = false, std::string_view highlight = {});
+
+int print_journal_message(const Entry &entry, const ProcessInfo *process = nullptr, bool identity = false, std::string_view highlight = {});
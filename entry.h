@@ -0,0 +1,194 @@
+#pragma once
+
+#include <charconv>
+#include <cstdint>
+#include <string>
+#include <string_view>
+
+// One bit per field in Entry, so only the fields that are actually needed
+// have to be read.
+enum EntryField : uint32_t {
+    FieldPriority = 1 << 0,
+    FieldHostname = 1 << 1,
+    FieldUid = 1 << 2,
+    FieldAuditLoginUid = 1 << 3,
+    FieldIdentifier = 1 << 4,
+    FieldComm = 1 << 5,
+    FieldPid = 1 << 6,
+    FieldUnit = 1 << 7,
+    FieldMessage = 1 << 8,
+    FieldGid = 1 << 9,
+    FieldAuditSession = 1 << 10,
+    FieldMessageId = 1 << 11,
+    // Not a field, __SEQNUM and __SEQNUM_ID, which libsystemd only has in
+    // the cursor
+    FieldSeqnum = 1 << 12,
+    AllFields = (1 << 13) - 1
+};
+using FieldMask = uint32_t;
+
+// The identifier shown is _COMM if there's no SYSLOG_IDENTIFIER, and the user
+// is _AUDIT_LOGINUID if there's no _UID, so asking for the first implies the
+// second when it's missing.
+inline FieldMask withFallbacks(FieldMask fields)
+{
+    if (fields & FieldIdentifier) {
+        fields |= FieldComm;
+    }
+    if (fields & FieldUid) {
+        fields |= FieldAuditLoginUid;
+    }
+    return fields;
+}
+
+// For uid and pid fields that are missing or not a number
+constexpr uint32_t InvalidId = UINT32_MAX;
+
+// Parses a whole field as a decimal number, without throwing or allocating
+template<typename T>
+bool parseNumber(std::string_view text, T *value)
+{
+    const auto [end, error] = std::from_chars(text.data(), text.data() + text.size(), *value);
+    return error == std::errc() && end == text.data() + text.size() && !text.empty();
+}
+
+// The fields we care about from a single journal entry, filled either through
+// libsystemd or by the native journal file reader.
+struct Entry {
+    uint64_t realtime = 0;
+
+    std::string priority;
+    std::string hostname;
+    std::string uid;
+    std::string auditLoginUid;
+    std::string gid;
+    std::string auditSession;
+    std::string identifier;
+    std::string comm;
+    std::string pid;
+    std::string unit;
+    std::string message;
+    std::string messageId;
+
+    // Not a field, the explanation from the message catalog with --catalog,
+    // ready to be printed after the line
+    std::string catalog;
+
+    // 0 if the source doesn't have them. Only the first half of the seqnum
+    // id, as it is in the hex form, which is enough to tell them apart.
+    uint64_t seqnum = 0;
+    uint64_t seqnumId = 0;
+
+    // The numeric fields, parsed once by decodeNumbers() after reading
+    int8_t priorityLevel = -1;
+    uint32_t uidNumber = InvalidId;
+    uint32_t gidNumber = InvalidId;
+    uint32_t pidNumber = InvalidId;
+
+    void clear()
+    {
+        realtime = 0;
+        priority.clear();
+        hostname.clear();
+        uid.clear();
+        auditLoginUid.clear();
+        gid.clear();
+        auditSession.clear();
+        identifier.clear();
+        comm.clear();
+        pid.clear();
+        unit.clear();
+        message.clear();
+        messageId.clear();
+        catalog.clear();
+        seqnum = 0;
+        seqnumId = 0;
+        priorityLevel = -1;
+        uidNumber = InvalidId;
+        gidNumber = InvalidId;
+        pidNumber = InvalidId;
+    }
+
+    void decodeNumbers()
+    {
+        if (!parseNumber(priority, &priorityLevel) || priorityLevel < 0) {
+            priorityLevel = -1;
+        }
+        if (!parseNumber(uid, &uidNumber)) {
+            uidNumber = InvalidId;
+        }
+        if (!parseNumber(gid, &gidNumber)) {
+            gidNumber = InvalidId;
+        }
+        if (!parseNumber(pid, &pidNumber)) {
+            pidNumber = InvalidId;
+        }
+    }
+
+    // Takes a raw FIELD=value pair, returns false if we don't care about it
+    bool setField(std::string_view name, std::string_view value, FieldMask fields = AllFields);
+
+    std::string *field(std::string_view name)
+    {
+        std::string Entry::*fieldMember = member(name);
+        return fieldMember ? &(this->*fieldMember) : nullptr;
+    }
+
+    // For looking up the same field in lots of entries
+    static std::string Entry::*member(std::string_view name);
+    static FieldMask fieldBit(std::string_view name);
+};
+
+struct EntryFieldInfo {
+    const char *name;
+    std::string Entry::*member;
+    EntryField bit;
+};
+
+// In the order libsystemd is asked for them
+inline constexpr EntryFieldInfo entryFields[] = {
+    { "PRIORITY", &Entry::priority, FieldPriority },
+    { "_HOSTNAME", &Entry::hostname, FieldHostname },
+    { "_UID", &Entry::uid, FieldUid },
+    { "_AUDIT_LOGINUID", &Entry::auditLoginUid, FieldAuditLoginUid },
+    { "_GID", &Entry::gid, FieldGid },
+    { "_AUDIT_SESSION", &Entry::auditSession, FieldAuditSession },
+    { "SYSLOG_IDENTIFIER", &Entry::identifier, FieldIdentifier },
+    { "_COMM", &Entry::comm, FieldComm },
+    { "_PID", &Entry::pid, FieldPid },
+    { "_SYSTEMD_UNIT", &Entry::unit, FieldUnit },
+    { "MESSAGE", &Entry::message, FieldMessage },
+    { "MESSAGE_ID", &Entry::messageId, FieldMessageId },
+};
+
+inline const EntryFieldInfo *findEntryField(std::string_view name)
+{
+    for (const EntryFieldInfo &info : entryFields) {
+        if (name == info.name) {
+            return &info;
+        }
+    }
+    return nullptr;
+}
+
+inline bool Entry::setField(std::string_view name, std::string_view value, FieldMask fields)
+{
+    const EntryFieldInfo *info = findEntryField(name);
+    if (!info || !(fields & info->bit)) {
+        return false;
+    }
+    (this->*info->member).assign(value);
+    return true;
+}
+
+inline std::string Entry::*Entry::member(std::string_view name)
+{
+    const EntryFieldInfo *info = findEntryField(name);
+    return info ? info->member : nullptr;
+}
+
+inline FieldMask Entry::fieldBit(std::string_view name)
+{
+    const EntryFieldInfo *info = findEntryField(name);
+    return info ? FieldMask(info->bit) : 0;
+}
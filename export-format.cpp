@@ -0,0 +1,125 @@
+#include "export-format.h"
+#include "terminal-safe.h"
+
+extern "C" {
+#include <endian.h>
+} // extern "C"
+
+namespace {
+
+// U+FDD0 to U+FDEF, and the last two in every plane
+bool isNoncharacter(std::string_view text, size_t i)
+{
+    const unsigned char c = text[i];
+    if (c == 0xef && i + 2 < text.size()) {
+        const unsigned char second = text[i + 1];
+        const unsigned char third = text[i + 2];
+        return (second == 0xb7 && third >= 0x90 && third <= 0xaf) || (second == 0xbf && third >= 0xbe);
+    }
+    if (c >= 0xf0 && i + 3 < text.size()) {
+        return (text[i + 1] & 0x0f) == 0x0f && (unsigned char)text[i + 2] == 0xbf && (unsigned char)text[i + 3] >= 0xbe;
+    }
+    return false;
+}
+
+// Same as journalctl, which writes everything that isn't printable UTF-8
+// (utf8_is_printable_newline() without newlines) in the binary form:
+// invalid UTF-8, control characters but tabs, and noncharacters
+bool needsBinary(std::string_view value)
+{
+    if (value.find('\n') != std::string_view::npos || firstUnsafe(value) != value.size()) {
+        return true;
+    }
+    // It's valid UTF-8 by now, so anything from 0xef up starts a sequence
+    for (size_t i = 0; i < value.size(); i++) {
+        if ((unsigned char)value[i] >= 0xef && isNoncharacter(value, i)) {
+            return true;
+        }
+    }
+    return false;
+}
+
+void appendNumber(std::string *out, std::string_view name, uint64_t value)
+{
+    out->append(name);
+    out->push_back('=');
+    out->append(std::to_string(value));
+    out->push_back('\n');
+}
+
+} // namespace
+
+void appendExportField(std::string *out, std::string_view name, std::string_view value)
+{
+    out->append(name);
+    if (!needsBinary(value)) {
+        out->push_back('=');
+        out->append(value);
+        out->push_back('\n');
+        return;
+    }
+
+    out->push_back('\n');
+    const uint64_t size = htole64(value.size());
+    out->append(reinterpret_cast<const char*>(&size), sizeof size);
+    out->append(value);
+    out->push_back('\n');
+}
+
+int appendExportEntry(JournalSource *source, std::string *out)
+{
+    std::string cursor;
+    if (source->cursor(&cursor) >= 0) {
+        appendExportField(out, "__CURSOR", cursor);
+    }
+    uint64_t usec;
+    int ret = source->realtime(&usec);
+    if (ret < 0) {
+        return ret;
+    }
+    appendNumber(out, "__REALTIME_TIMESTAMP", usec);
+    if (source->monotonic(&usec) >= 0) {
+        appendNumber(out, "__MONOTONIC_TIMESTAMP", usec);
+    }
+    // journalctl puts it with the timestamps, and so do we
+    std::string_view value;
+    if (source->data("_BOOT_ID", &value) >= 0) {
+        appendExportField(out, "_BOOT_ID", value);
+    }
+
+    std::string_view name;
+    source->restartData();
+    while ((ret = source->enumerateData(&name, &value)) > 0) {
+        if (name != "_BOOT_ID") {
+            appendExportField(out, name, value);
+        }
+    }
+    out->push_back('\n');
+    return ret;
+}
+
+int appendExportEntry(JournalFileSet *journals, std::string *out)
+{
+    EntryHeader header;
+    int ret = journals->entryHeader(&header);
+    if (ret < 0) {
+        return ret;
+    }
+    std::string cursor;
+    if (journals->cursor(&cursor) >= 0) {
+        appendExportField(out, "__CURSOR", cursor);
+    }
+    appendNumber(out, "__REALTIME_TIMESTAMP", header.realtime);
+    appendNumber(out, "__MONOTONIC_TIMESTAMP", header.monotonic);
+    char bootId[SD_ID128_STRING_MAX];
+    appendExportField(out, "_BOOT_ID", sd_id128_to_string(header.bootId, bootId));
+
+    ret = journals->enumerateData([&](std::string_view data) {
+        const size_t separator = data.find('=');
+        if (separator != std::string_view::npos && data.substr(0, separator) != "_BOOT_ID") {
+            appendExportField(out, data.substr(0, separator), data.substr(separator + 1));
+        }
+    });
+    out->push_back('\n');
+    return ret;
+}
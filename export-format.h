@@ -0,0 +1,18 @@
+#pragma once
+
+#include "journal-file.h"
+#include "journal-source.h"
+
+#include <string>
+#include <string_view>
+
+// Writing the journal export format, ExportSource reads it.
+// https://systemd.io/JOURNAL_EXPORT_FORMATS/
+
+// Uses the binary form if the value has newlines or other control characters
+void appendExportField(std::string *out, std::string_view name, std::string_view value);
+
+// Appends the current entry with the __CURSOR and timestamps first, and the
+// empty line that ends it.
+int appendExportEntry(JournalSource *source, std::string *out);
+int appendExportEntry(JournalFileSet *journals, std::string *out);
@@ -0,0 +1,611 @@
+#include "filter.h"
+
+extern "C" {
+#include <ctype.h>
+#include <fnmatch.h>
+#include <grp.h>
+#include <pwd.h>
+#include <regex.h>
+#include <string.h>
+} // extern "C"
+
+#include <algorithm>
+
+struct Filter::Node {
+    enum Type {
+        And,
+        Or,
+        Not,
+        Compare
+    };
+    enum Operator {
+        Equal,
+        NotEqual,
+        Less,
+        LessOrEqual,
+        Greater,
+        GreaterOrEqual,
+        Match
+    };
+
+    Type type = Compare;
+    std::shared_ptr<Node> left;
+    std::shared_ptr<Node> right;
+
+    // For comparisons
+    std::string field;
+    std::string Entry::*member = nullptr;
+    // "identifier" is whatever the output shows, i.e. _COMM without SYSLOG_IDENTIFIER
+    bool fallbackToComm = false;
+    Operator op = Equal;
+    std::string value;
+    long long number = 0;
+    bool isRegex = false;
+};
+
+namespace {
+
+using Node = Filter::Node;
+
+struct Token {
+    enum Kind {
+        End,
+        Name,
+        String,
+        Regex,
+        Number,
+        Operator,
+        And,
+        Or,
+        Not,
+        OpenParenthesis,
+        CloseParenthesis
+    };
+    Kind kind = End;
+    std::string text;
+    size_t position = 0;
+};
+
+// The short names, anything that's a journal field we read works too
+const std::pair<const char*, const char*> fieldAliases[] = {
+    { "priority", "PRIORITY" },
+    { "hostname", "_HOSTNAME" },
+    { "uid", "_UID" },
+    { "user", "_UID" },
+    { "gid", "_GID" },
+    { "group", "_GID" },
+    { "identifier", "SYSLOG_IDENTIFIER" },
+    { "comm", "_COMM" },
+    { "pid", "_PID" },
+    { "unit", "_SYSTEMD_UNIT" },
+    { "message", "MESSAGE" }
+};
+
+bool compareNumbers(Node::Operator op, long long a, long long b)
+{
+    switch(op) {
+    case Node::Less:
+        return a < b;
+    case Node::LessOrEqual:
+        return a <= b;
+    case Node::Greater:
+        return a > b;
+    case Node::GreaterOrEqual:
+        return a >= b;
+    case Node::Equal:
+        return a == b;
+    case Node::NotEqual:
+        return a != b;
+    case Node::Match:
+        break;
+    }
+    return false;
+}
+
+class Parser
+{
+public:
+    explicit Parser(std::string_view expression) :
+        m_expression(expression)
+    {
+    }
+
+    std::shared_ptr<Node> parse(std::string *error)
+    {
+        next();
+        std::shared_ptr<Node> root = parseOr();
+        if (root && m_token.kind != Token::End) {
+            fail("Unexpected \"" + m_token.text + "\"");
+        }
+        if (!m_error.empty()) {
+            root.reset();
+        }
+        if (!root) {
+            *error = m_error;
+        }
+        return root;
+    }
+
+private:
+    void fail(const std::string &message)
+    {
+        if (m_error.empty()) {
+            m_error = message + " at position " + std::to_string(m_token.position + 1);
+        }
+    }
+
+    void next()
+    {
+        while (m_position < m_expression.size() && isspace(uint8_t(m_expression[m_position]))) {
+            m_position++;
+        }
+        m_token = Token();
+        m_token.position = m_position;
+        if (m_position >= m_expression.size()) {
+            return;
+        }
+
+        const char c = m_expression[m_position];
+        auto twoCharacters = [&](const char *op) {
+            return m_expression.substr(m_position, 2) == op;
+        };
+        if (isalpha(uint8_t(c)) || c == '_') {
+            const size_t start = m_position;
+            while (m_position < m_expression.size() && (isalnum(uint8_t(m_expression[m_position])) || m_expression[m_position] == '_')) {
+                m_position++;
+            }
+            m_token.kind = Token::Name;
+            m_token.text = m_expression.substr(start, m_position - start);
+        } else if (isdigit(uint8_t(c)) || (c == '-' && m_position + 1 < m_expression.size() && isdigit(uint8_t(m_expression[m_position + 1])))) {
+            const size_t start = m_position++;
+            while (m_position < m_expression.size() && isdigit(uint8_t(m_expression[m_position]))) {
+                m_position++;
+            }
+            m_token.kind = Token::Number;
+            m_token.text = m_expression.substr(start, m_position - start);
+        } else if (c == '"' || c == '/') {
+            // Backslash escapes the delimiter, other escapes are left alone
+            // so they reach the regex compiler as they are.
+            m_token.kind = c == '"' ? Token::String : Token::Regex;
+            m_position++;
+            bool closed = false;
+            while (m_position < m_expression.size()) {
+                const char current = m_expression[m_position++];
+                if (current == c) {
+                    closed = true;
+                    break;
+                }
+                if (current == '\\' && m_position < m_expression.size()) {
+                    const char escaped = m_expression[m_position++];
+                    if (escaped != c && (c == '/' || escaped != '\\')) {
+                        m_token.text += current;
+                    }
+                    m_token.text += escaped;
+                    continue;
+                }
+                m_token.text += current;
+            }
+            if (!closed) {
+                fail(std::string("Missing closing ") + c);
+                m_token.kind = Token::End;
+            }
+        } else if (twoCharacters("&&")) {
+            m_token.kind = Token::And;
+            m_token.text = "&&";
+            m_position += 2;
+        } else if (twoCharacters("||")) {
+            m_token.kind = Token::Or;
+            m_token.text = "||";
+            m_position += 2;
+        } else if (twoCharacters("==") || twoCharacters("!=") || twoCharacters("<=") || twoCharacters(">=")) {
+            m_token.kind = Token::Operator;
+            m_token.text = m_expression.substr(m_position, 2);
+            m_position += 2;
+        } else if (c == '<' || c == '>' || c == '~') {
+            m_token.kind = Token::Operator;
+            m_token.text = c;
+            m_position++;
+        } else if (c == '!') {
+            m_token.kind = Token::Not;
+            m_token.text = c;
+            m_position++;
+        } else if (c == '(' || c == ')') {
+            m_token.kind = c == '(' ? Token::OpenParenthesis : Token::CloseParenthesis;
+            m_token.text = c;
+            m_position++;
+        } else {
+            fail(std::string("Unexpected character '") + c + "'");
+            m_token.kind = Token::End;
+        }
+    }
+
+    std::shared_ptr<Node> binary(Node::Type type, std::shared_ptr<Node> left, std::shared_ptr<Node> right)
+    {
+        auto node = std::make_shared<Node>();
+        node->type = type;
+        node->left = std::move(left);
+        node->right = std::move(right);
+        return node;
+    }
+
+    std::shared_ptr<Node> parseOr()
+    {
+        std::shared_ptr<Node> left = parseAnd();
+        while (left && m_token.kind == Token::Or) {
+            next();
+            std::shared_ptr<Node> right = parseAnd();
+            if (!right) {
+                return nullptr;
+            }
+            left = binary(Node::Or, std::move(left), std::move(right));
+        }
+        return left;
+    }
+
+    std::shared_ptr<Node> parseAnd()
+    {
+        std::shared_ptr<Node> left = parseUnary();
+        while (left && m_token.kind == Token::And) {
+            next();
+            std::shared_ptr<Node> right = parseUnary();
+            if (!right) {
+                return nullptr;
+            }
+            left = binary(Node::And, std::move(left), std::move(right));
+        }
+        return left;
+    }
+
+    std::shared_ptr<Node> parseUnary()
+    {
+        if (m_token.kind == Token::Not) {
+            next();
+            std::shared_ptr<Node> operand = parseUnary();
+            if (!operand) {
+                return nullptr;
+            }
+            return binary(Node::Not, std::move(operand), nullptr);
+        }
+        if (m_token.kind == Token::OpenParenthesis) {
+            next();
+            std::shared_ptr<Node> inner = parseOr();
+            if (!inner) {
+                return nullptr;
+            }
+            if (m_token.kind != Token::CloseParenthesis) {
+                fail("Missing )");
+                return nullptr;
+            }
+            next();
+            return inner;
+        }
+        return parseComparison();
+    }
+
+    std::shared_ptr<Node> parseComparison()
+    {
+        if (m_token.kind != Token::Name) {
+            fail(m_token.kind == Token::End ? "Expected a field name" : "Expected a field name instead of \"" + m_token.text + "\"");
+            return nullptr;
+        }
+        auto node = std::make_shared<Node>();
+        const std::string name = m_token.text;
+        node->field = name;
+        for (const auto &[alias, field] : fieldAliases) {
+            if (name == alias) {
+                node->field = field;
+                node->fallbackToComm = name == "identifier";
+                break;
+            }
+        }
+        node->member = Entry::member(node->field);
+        if (!node->member) {
+            fail("Unknown field " + name);
+            return nullptr;
+        }
+        next();
+
+        static const std::pair<const char*, Node::Operator> operators[] = {
+            { "==", Node::Equal }, { "!=", Node::NotEqual },
+            { "<", Node::Less }, { "<=", Node::LessOrEqual },
+            { ">", Node::Greater }, { ">=", Node::GreaterOrEqual },
+            { "~", Node::Match }
+        };
+        const auto op = std::find_if(std::begin(operators), std::end(operators), [&](const auto &candidate) {
+            return m_token.kind == Token::Operator && m_token.text == candidate.first;
+        });
+        if (op == std::end(operators)) {
+            fail("Expected a comparison after " + name);
+            return nullptr;
+        }
+        node->op = op->second;
+        next();
+
+        const Token value = m_token;
+        switch(node->op) {
+        case Node::Equal:
+        case Node::NotEqual:
+            if (value.kind != Token::String && value.kind != Token::Number) {
+                fail("Expected a string or number");
+                return nullptr;
+            }
+            break;
+        case Node::Match:
+            if (value.kind != Token::String && value.kind != Token::Regex) {
+                fail("Expected a \"glob\" or /regex/");
+                return nullptr;
+            }
+            break;
+        default:
+            if (value.kind != Token::Number) {
+                fail("Expected a number");
+                return nullptr;
+            }
+            break;
+        }
+        node->value = value.text;
+        node->isRegex = value.kind == Token::Regex;
+        if (value.kind == Token::Number) {
+            parseNumber(value.text, &node->number);
+        }
+
+        // Users and groups are compared by id, so it can be passed on to libsystemd
+        if (name == "user" && value.kind == Token::String && !parseNumber(value.text, &node->number)) {
+            if (node->op != Node::Equal && node->op != Node::NotEqual) {
+                fail("Users can only be compared with == and !=");
+                return nullptr;
+            }
+            const passwd *pw = getpwnam(value.text.c_str());
+            if (!pw) {
+                fail("Unknown user " + value.text);
+                return nullptr;
+            }
+            node->value = std::to_string(pw->pw_uid);
+        }
+        if (name == "group" && value.kind == Token::String && !parseNumber(value.text, &node->number)) {
+            if (node->op != Node::Equal && node->op != Node::NotEqual) {
+                fail("Groups can only be compared with == and !=");
+                return nullptr;
+            }
+            const group *gr = getgrnam(value.text.c_str());
+            if (!gr) {
+                fail("Unknown group " + value.text);
+                return nullptr;
+            }
+            node->value = std::to_string(gr->gr_gid);
+        }
+        next();
+        return node;
+    }
+
+    std::string_view m_expression;
+    size_t m_position = 0;
+    Token m_token;
+    std::string m_error;
+};
+
+std::function<bool(const Entry &)> compile(const Node &node, std::string *error)
+{
+    switch(node.type) {
+    case Node::And: {
+        auto left = compile(*node.left, error);
+        auto right = compile(*node.right, error);
+        if (!left || !right) {
+            return nullptr;
+        }
+        return [left, right](const Entry &entry) { return left(entry) && right(entry); };
+    }
+    case Node::Or: {
+        auto left = compile(*node.left, error);
+        auto right = compile(*node.right, error);
+        if (!left || !right) {
+            return nullptr;
+        }
+        return [left, right](const Entry &entry) { return left(entry) || right(entry); };
+    }
+    case Node::Not: {
+        auto operand = compile(*node.left, error);
+        if (!operand) {
+            return nullptr;
+        }
+        return [operand](const Entry &entry) { return !operand(entry); };
+    }
+    case Node::Compare:
+        break;
+    }
+
+    std::string Entry::*member = node.member;
+    const bool fallbackToComm = node.fallbackToComm;
+    auto field = [member, fallbackToComm](const Entry &entry) -> const std::string & {
+        const std::string &value = entry.*member;
+        return fallbackToComm && value.empty() ? entry.comm : value;
+    };
+
+    const std::string value = node.value;
+    switch(node.op) {
+    case Node::Equal:
+        return [field, value](const Entry &entry) { return field(entry) == value; };
+    case Node::NotEqual:
+        return [field, value](const Entry &entry) { return field(entry) != value; };
+    case Node::Match:
+        if (node.isRegex) {
+            auto compiled = std::make_unique<regex_t>();
+            const int ret = regcomp(compiled.get(), value.c_str(), REG_EXTENDED | REG_NOSUB);
+            if (ret != 0) {
+                char message[256];
+                regerror(ret, compiled.get(), message, sizeof message);
+                *error = "Invalid regex /" + value + "/: " + message;
+                return nullptr;
+            }
+            std::shared_ptr<regex_t> regex(compiled.release(), [](regex_t *regex) {
+                regfree(regex);
+                delete regex;
+            });
+            return [field, regex](const Entry &entry) {
+                return regexec(regex.get(), field(entry).c_str(), 0, nullptr, 0) == 0;
+            };
+        }
+        return [field, value](const Entry &entry) {
+            return fnmatch(value.c_str(), field(entry).c_str(), 0) == 0;
+        };
+    default:
+        break;
+    }
+
+    // The common numeric fields are already parsed
+    const Node::Operator op = node.op;
+    const long long number = node.number;
+    if (node.field == "PRIORITY") {
+        return [op, number](const Entry &entry) {
+            return entry.priorityLevel >= 0 && compareNumbers(op, entry.priorityLevel, number);
+        };
+    }
+    if (node.field == "_UID" || node.field == "_GID" || node.field == "_PID") {
+        uint32_t Entry::*numberMember =
+            node.field == "_UID" ? &Entry::uidNumber :
+            node.field == "_GID" ? &Entry::gidNumber : &Entry::pidNumber;
+        return [numberMember, op, number](const Entry &entry) {
+            return entry.*numberMember != InvalidId && compareNumbers(op, entry.*numberMember, number);
+        };
+    }
+    return [field, op, number](const Entry &entry) {
+        long long fieldNumber;
+        return parseNumber(field(entry), &fieldNumber) && compareNumbers(op, fieldNumber, number);
+    };
+}
+
+// Collects FIELD=value matches that together select everything the node
+// accepts, as long as they're all for the same field. libsystemd ORs
+// matches on the same field, so that's what can be expressed with plain
+// sd_journal_add_match() calls.
+bool sameFieldMatches(const Node &node, std::string *field, std::vector<std::string> *matches)
+{
+    if (node.type == Node::Or) {
+        return sameFieldMatches(*node.left, field, matches) && sameFieldMatches(*node.right, field, matches);
+    }
+    if (node.type != Node::Compare || node.fallbackToComm || (!field->empty() && *field != node.field)) {
+        return false;
+    }
+    *field = node.field;
+
+    if (node.op == Node::Equal) {
+        matches->push_back(node.field + "=" + node.value);
+        return true;
+    }
+    // Only a handful of valid priorities, so any comparison can be listed out
+    if (node.field == "PRIORITY" && node.op != Node::Match) {
+        for (long long priority = 0; priority <= 7; priority++) {
+            if (compareNumbers(node.op, priority, node.number)) {
+                matches->push_back("PRIORITY=" + std::to_string(priority));
+            }
+        }
+        return true;
+    }
+    return false;
+}
+
+// The identifier=="..." comparisons the node is an OR of, which is what the
+// Bloom index can look up. The index has the identifier with the same fallback
+// to _COMM.
+bool identifierMatches(const Node &node, std::vector<std::string> *identifiers)
+{
+    if (node.type == Node::Or) {
+        return identifierMatches(*node.left, identifiers) && identifierMatches(*node.right, identifiers);
+    }
+    if (node.type != Node::Compare || !node.fallbackToComm || node.op != Node::Equal) {
+        return false;
+    }
+    identifiers->push_back(node.value);
+    return true;
+}
+
+// Everything at the top level that has to match
+std::vector<const Node *> conjuncts(const Node *root)
+{
+    std::vector<const Node *> result;
+    std::vector<const Node *> pending = { root };
+    while (!pending.empty()) {
+        const Node *node = pending.back();
+        pending.pop_back();
+        if (node->type == Node::And) {
+            pending.push_back(node->right.get());
+            pending.push_back(node->left.get());
+        } else {
+            result.push_back(node);
+        }
+    }
+    return result;
+}
+
+FieldMask collectFields(const Node &node)
+{
+    if (node.type != Node::Compare) {
+        return collectFields(*node.left) | (node.right ? collectFields(*node.right) : 0);
+    }
+    return Entry::fieldBit(node.field);
+}
+
+} // namespace
+
+Filter::Filter() = default;
+Filter::~Filter() = default;
+
+bool Filter::parse(std::string_view expression, std::string *error)
+{
+    Parser parser(expression);
+    std::shared_ptr<Node> root = parser.parse(error);
+    if (!root) {
+        return false;
+    }
+    std::function<bool(const Entry &)> predicate = compile(*root, error);
+    if (!predicate) {
+        return false;
+    }
+    m_root = std::move(root);
+    m_predicate = std::move(predicate);
+    m_fields = collectFields(*m_root);
+    return true;
+}
+
+int Filter::addJournalMatches(sd_journal *journal) const
+{
+    if (!m_root) {
+        return 0;
+    }
+
+    // libsystemd ANDs matches on different fields, so each of the top level
+    // conjuncts can be passed on by itself
+    for (const Node *node : conjuncts(m_root.get())) {
+        std::string field;
+        std::vector<std::string> matches;
+        if (!sameFieldMatches(*node, &field, &matches)) {
+            continue;
+        }
+        if (matches.empty()) {
+            // Can never match, but there's no match for nothing
+            continue;
+        }
+        for (const std::string &match : matches) {
+            const int ret = sd_journal_add_match(journal, match.data(), match.size());
+            if (ret < 0) {
+                return ret;
+            }
+        }
+    }
+    return 0;
+}
+
+bool Filter::requiredIdentifiers(std::vector<std::string> *identifiers) const
+{
+    if (!m_root) {
+        return false;
+    }
+    for (const Node *node : conjuncts(m_root.get())) {
+        identifiers->clear();
+        if (identifierMatches(*node, identifiers)) {
+            return true;
+        }
+    }
+    identifiers->clear();
+    return false;
+}
@@ -0,0 +1,56 @@
+#pragma once
+
+#include "entry.h"
+
+extern "C" {
+#include <systemd/sd-journal.h>
+} // extern "C"
+
+#include <functional>
+#include <memory>
+#include <string>
+#include <string_view>
+#include <vector>
+
+// Filter expressions like
+//   priority<=4 && (unit~"nginx*" || user=="deploy") && !message~/healthcheck/
+//
+// Comparisons are field OP value, where OP is one of == != < <= > >= ~.
+// < and friends compare numbers, ~ takes a glob in quotes or an extended
+// regex between slashes. They can be combined with &&, || and !, and grouped
+// with parentheses.
+//
+// The expression is parsed once into a tree of closures that's evaluated on
+// each entry, the parts libsystemd can do itself are passed on as matches.
+class Filter
+{
+public:
+    Filter();
+    ~Filter();
+
+    // Returns false and sets error if the expression is invalid
+    bool parse(std::string_view expression, std::string *error);
+
+    bool isEmpty() const { return !m_root; }
+    bool matches(const Entry &entry) const { return !m_predicate || m_predicate(entry); }
+
+    // Adds sd_journal matches for the parts of the expression that libsystemd
+    // can filter on. They select a superset of what matches() accepts, so
+    // matches() still needs to be checked on every entry.
+    int addJournalMatches(sd_journal *journal) const;
+
+    // If only entries with one of these identifiers can match, i.e. there's
+    // an identifier=="..." (or several ORed together) at the top level, returns
+    // true and sets identifiers
+    bool requiredIdentifiers(std::vector<std::string> *identifiers) const;
+
+    // The fields the expression looks at
+    FieldMask fields() const { return m_fields; }
+
+    struct Node;
+
+private:
+    std::shared_ptr<Node> m_root;
+    std::function<bool(const Entry &)> m_predicate;
+    FieldMask m_fields = 0;
+};
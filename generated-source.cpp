@@ -0,0 +1,227 @@
+#include "generated-source.h"
+
+extern "C" {
+#include <errno.h>
+#include <poll.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+} // extern "C"
+
+#include <algorithm>
+#include <string_view>
+
+namespace {
+
+// splitmix64, so every entry can be made without the ones before it
+uint64_t mix(uint64_t value)
+{
+    value += 0x9e3779b97f4a7c15ULL;
+    value = (value ^ (value >> 30)) * 0xbf58476d1ce4e5b9ULL;
+    value = (value ^ (value >> 27)) * 0x94d049bb133111ebULL;
+    return value ^ (value >> 31);
+}
+
+uint64_t monotonicUsec()
+{
+    timespec now;
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    return now.tv_sec * 1000000ULL + now.tv_nsec / 1000;
+}
+
+// -1 sleeps until we're killed
+void sleepUsec(uint64_t usec)
+{
+    if (usec == uint64_t(-1)) {
+        pause();
+        return;
+    }
+    const timespec duration = { time_t(usec / 1000000), long(usec % 1000000) * 1000 };
+    nanosleep(&duration, nullptr);
+}
+
+// A number, optionally followed by us, ms or s
+bool parseMicroseconds(std::string_view text, uint64_t *usec)
+{
+    static const std::pair<std::string_view, uint64_t> units[] = {
+        { "us", 1 }, { "ms", 1000 }, { "s", 1000000 }
+    };
+    uint64_t multiplier = 1;
+    for (const auto &[unit, unitUsec] : units) {
+        if (text.size() > unit.size() && text.substr(text.size() - unit.size()) == unit) {
+            text.remove_suffix(unit.size());
+            multiplier = unitUsec;
+            break;
+        }
+    }
+    if (!parseNumber(text, usec)) {
+        return false;
+    }
+    *usec *= multiplier;
+    return true;
+}
+
+const char *const identifierNames[] = {
+    "sshd", "nginx", "postgres", "cron", "dockerd", "java", "python3", "sudo", "containerd", "kubelet"
+};
+
+const char *const words[] = {
+    "connection", "accepted", "closed", "from", "user", "session", "started", "stopped",
+    "request", "timeout", "error", "failed", "process", "ready", "healthcheck", "retrying",
+    "disk", "memory", "queue", "worker", "listening", "port", "handshake", "completed"
+};
+
+} // namespace
+
+bool parseGeneratorOptions(const char *spec, GeneratorOptions *options, std::string *error)
+{
+    std::string_view rest(spec);
+    while (!rest.empty()) {
+        const size_t comma = rest.find(',');
+        const std::string_view item = rest.substr(0, comma);
+        rest = comma == std::string_view::npos ? std::string_view() : rest.substr(comma + 1);
+
+        const size_t equals = item.find('=');
+        if (equals == std::string_view::npos) {
+            *error = "expected key=value, got " + std::string(item);
+            return false;
+        }
+        const std::string_view key = item.substr(0, equals);
+        const std::string_view value = item.substr(equals + 1);
+
+        bool valid = false;
+        if (key == "entries") {
+            valid = parseNumber(value, &options->entries);
+        } else if (key == "initial") {
+            valid = parseNumber(value, &options->initial);
+        } else if (key == "seed") {
+            valid = parseNumber(value, &options->seed);
+        } else if (key == "users") {
+            valid = parseNumber(value, &options->users) && options->users > 0;
+        } else if (key == "identifiers") {
+            valid = parseNumber(value, &options->identifiers) && options->identifiers > 0;
+        } else if (key == "interval") {
+            valid = parseMicroseconds(value, &options->interval);
+        } else if (key == "batch") {
+            valid = parseNumber(value, &options->appendBatch) && options->appendBatch > 0;
+        } else if (key == "delay") {
+            valid = parseMicroseconds(value, &options->appendDelay);
+        } else if (key == "eagain") {
+            valid = parseNumber(value, &options->eagainEvery);
+        } else if (key == "invalidate") {
+            valid = parseNumber(value, &options->invalidateEvery);
+        } else {
+            *error = "unknown key " + std::string(key);
+            return false;
+        }
+        if (!valid) {
+            *error = "invalid value for " + std::string(key) + ": " + std::string(value);
+            return false;
+        }
+    }
+    return true;
+}
+
+void generateRecord(const GeneratorOptions &options, uint64_t index, Record *record)
+{
+    record->clear();
+    // Mid November 2023, so it doesn't depend on when it runs
+    record->realtime = 1700000000000000ULL + index * options.interval;
+
+    uint64_t random = mix(options.seed ^ mix(index));
+    auto nextRandom = [&](uint64_t range) {
+        const uint64_t value = random % range;
+        random = mix(random);
+        return value;
+    };
+
+    // Mostly informational, like a real system
+    const uint64_t severity = nextRandom(1000);
+    const char *priority =
+        severity < 2 ? "2" :
+        severity < 20 ? "3" :
+        severity < 70 ? "4" :
+        severity < 170 ? "5" :
+        severity < 870 ? "6" : "7";
+
+    // A few identifiers and users do most of the logging
+    const uint64_t identifier = std::min(nextRandom(options.identifiers), nextRandom(options.identifiers));
+    std::string name = identifierNames[identifier % std::size(identifierNames)];
+    if (identifier >= std::size(identifierNames)) {
+        name += std::to_string(identifier / std::size(identifierNames));
+    }
+    const uint64_t user = std::min(nextRandom(options.users), nextRandom(options.users));
+    const uint64_t uid = user == 0 ? 0 : 1000 + user - 1;
+    const uint64_t pid = 100 + (identifier * 7919 + nextRandom(4)) % 32000;
+
+    std::string message;
+    const uint64_t wordCount = 3 + nextRandom(22);
+    for (uint64_t i = 0; i < wordCount; i++) {
+        message += words[nextRandom(std::size(words))];
+        message += ' ';
+    }
+    message += '#';
+    message += std::to_string(index);
+
+    record->fields = {
+        { "PRIORITY", priority },
+        { "_HOSTNAME", "generated" },
+        { "_UID", std::to_string(uid) },
+        { "SYSLOG_IDENTIFIER", name },
+        { "_COMM", name },
+        { "_PID", std::to_string(pid) },
+        { "_SYSTEMD_UNIT", name + ".service" },
+        { "MESSAGE", std::move(message) },
+    };
+}
+
+GeneratedSource::GeneratedSource(const GeneratorOptions &options) :
+    m_options(options),
+    m_available(std::min(options.initial, options.entries)),
+    m_nextAppend(monotonicUsec() + options.appendDelay)
+{
+}
+
+const Record &GeneratedSource::record(uint64_t index)
+{
+    if (index != m_cachedIndex) {
+        generateRecord(m_options, index, &m_cached);
+        m_cachedIndex = index;
+    }
+    return m_cached;
+}
+
+int GeneratedSource::fetchEntry(Entry *entry, FieldMask fields)
+{
+    m_reads++;
+    if (m_options.eagainEvery && m_reads % m_options.eagainEvery == 0) {
+        return -EAGAIN;
+    }
+    return RecordSource::fetchEntry(entry, fields);
+}
+
+int GeneratedSource::wait(uint64_t timeout)
+{
+    if (m_available >= m_options.entries) {
+        sleepUsec(timeout);
+        return SD_JOURNAL_NOP;
+    }
+
+    const uint64_t now = monotonicUsec();
+    if (now < m_nextAppend) {
+        if (timeout < m_nextAppend - now) {
+            sleepUsec(timeout);
+            return SD_JOURNAL_NOP;
+        }
+        sleepUsec(m_nextAppend - now);
+    }
+
+    // Keeps the rate even if someone is slow to call us
+    m_nextAppend += m_options.appendDelay;
+    m_available = std::min(m_available + m_options.appendBatch, m_options.entries);
+    m_wakeups++;
+    if (m_options.invalidateEvery && m_wakeups % m_options.invalidateEvery == 0) {
+        return SD_JOURNAL_INVALIDATE;
+    }
+    return SD_JOURNAL_APPEND;
+}
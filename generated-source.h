@@ -0,0 +1,65 @@
+#pragma once
+
+#include "journal-source.h"
+
+#include <cstdint>
+#include <string>
+
+// What GeneratedSource makes, and which faults it injects
+struct GeneratorOptions {
+    uint64_t entries = 100000;
+    // How many there are from the start, the rest are appended by wait()
+    uint64_t initial = UINT64_MAX;
+    uint64_t seed = 1;
+
+    // Number of distinct _UIDs and SYSLOG_IDENTIFIERs
+    unsigned users = 20;
+    unsigned identifiers = 30;
+    // Realtime between entries, in usec
+    uint64_t interval = 1000;
+
+    // Entries appended per wakeup, and how long (in usec) each batch takes
+    uint64_t appendBatch = 100;
+    uint64_t appendDelay = 0;
+
+    // Every Nth read fails with EAGAIN once, and every Nth wakeup is an
+    // SD_JOURNAL_INVALIDATE instead of an SD_JOURNAL_APPEND. 0 for never.
+    unsigned eagainEvery = 0;
+    unsigned invalidateEvery = 0;
+};
+
+// Comma separated key=value, e.g. "entries=1000000,users=5000,eagain=100".
+// Returns false and sets error if it's invalid.
+bool parseGeneratorOptions(const char *spec, GeneratorOptions *options, std::string *error);
+
+// The same options and index always give the same entry
+void generateRecord(const GeneratorOptions &options, uint64_t index, Record *record);
+
+// Deterministic entries made up on the fly, for benchmarking and for testing
+// how we deal with a misbehaving journal without needing one.
+class GeneratedSource : public RecordSource
+{
+public:
+    explicit GeneratedSource(const GeneratorOptions &options);
+
+    int wait(uint64_t timeout) override;
+    bool isFinished() const override { return m_available >= m_options.entries; }
+
+protected:
+    int fetchEntry(Entry *entry, FieldMask fields) override;
+
+    uint64_t recordCount() const override { return m_available; }
+    const Record &record(uint64_t index) override;
+
+private:
+    GeneratorOptions m_options;
+    uint64_t m_available;
+
+    uint64_t m_reads = 0;
+    uint64_t m_wakeups = 0;
+    // Monotonic usec
+    uint64_t m_nextAppend;
+
+    uint64_t m_cachedIndex = UINT64_MAX;
+    Record m_cached;
+};
@@ -0,0 +1,242 @@
+#include "header-cache.h"
+#include "journal-file.h"
+
+extern "C" {
+#include <dirent.h>
+#include <errno.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <sys/stat.h>
+#include <unistd.h>
+} // extern "C"
+
+#include <algorithm>
+#include <fstream>
+#include <map>
+#include <sstream>
+#include <utility>
+
+namespace {
+
+struct CachedHeader {
+    uint64_t size = 0;
+    uint64_t mtime = 0;
+    JournalSummary summary;
+    std::string path;
+    bool used = false;
+};
+
+// dev and inode
+using FileKey = std::pair<uint64_t, uint64_t>;
+
+class HeaderCache
+{
+public:
+    HeaderCache();
+
+    bool lookup(const std::string &path, JournalSummary *summary);
+    void save();
+
+private:
+    std::string m_path;
+    std::map<FileKey, CachedHeader> m_headers;
+    bool m_dirty = false;
+};
+
+std::string idToString(const sd_id128_t &id)
+{
+    char buffer[SD_ID128_STRING_MAX];
+    return sd_id128_to_string(id, buffer);
+}
+
+HeaderCache::HeaderCache()
+{
+    const std::string directory = cacheDirectory(false);
+    if (directory.empty()) {
+        return;
+    }
+    m_path = directory + "/journal-headers";
+
+    // dev inode size mtime state entries head-realtime tail-realtime head-seqnum tail-seqnum boot-id seqnum-id path
+    std::ifstream file(m_path);
+    std::string line;
+    while (std::getline(file, line)) {
+        std::istringstream stream(line);
+        FileKey key;
+        CachedHeader cached;
+        unsigned state;
+        std::string bootId, seqnumId;
+        stream >> key.first >> key.second >> cached.size >> cached.mtime >> state
+            >> cached.summary.entryCount
+            >> cached.summary.headRealtime >> cached.summary.tailRealtime
+            >> cached.summary.headSeqnum >> cached.summary.tailSeqnum
+            >> bootId >> seqnumId;
+        stream.get(); // the space before the path, which might contain spaces itself
+        std::getline(stream, cached.path);
+        if (stream.fail() || cached.path.empty() ||
+                sd_id128_from_string(bootId.c_str(), &cached.summary.bootId) < 0 ||
+                sd_id128_from_string(seqnumId.c_str(), &cached.summary.seqnumId) < 0) {
+            continue;
+        }
+        cached.summary.state = state;
+        m_headers[key] = std::move(cached);
+    }
+}
+
+bool HeaderCache::lookup(const std::string &path, JournalSummary *summary)
+{
+    struct stat st;
+    if (stat(path.c_str(), &st) < 0 || access(path.c_str(), R_OK) < 0) {
+        return false;
+    }
+    const FileKey key(st.st_dev, st.st_ino);
+    const uint64_t mtime = uint64_t(st.st_mtim.tv_sec) * 1000000000ULL + st.st_mtim.tv_nsec;
+
+    auto it = m_headers.find(key);
+    if (it != m_headers.end() && it->second.size == uint64_t(st.st_size) && it->second.mtime == mtime && it->second.path == path) {
+        it->second.used = true;
+        *summary = it->second.summary;
+        return true;
+    }
+
+    if (readJournalSummary(path, summary) < 0) {
+        return false;
+    }
+
+    // Online files change all the time, no point in caching them
+    if (summary->state == JournalSummary::Online) {
+        return true;
+    }
+
+    CachedHeader &cached = m_headers[key];
+    cached.size = st.st_size;
+    cached.mtime = mtime;
+    cached.summary = *summary;
+    cached.path = path;
+    cached.used = true;
+    m_dirty = true;
+    return true;
+}
+
+void HeaderCache::save()
+{
+    if (m_path.empty() || !m_dirty) {
+        return;
+    }
+    cacheDirectory(true);
+
+    // Write to a temporary file and rename, so concurrent runs don't see half a file
+    const std::string temporaryPath = m_path + "." + std::to_string(getpid());
+    {
+        std::ofstream file(temporaryPath, std::ios::trunc);
+        for (const auto &[key, cached] : m_headers) {
+            // Drop files that are gone, otherwise this just grows forever
+            if (!cached.used && access(cached.path.c_str(), F_OK) < 0) {
+                continue;
+            }
+            file << key.first << ' ' << key.second << ' ' << cached.size << ' ' << cached.mtime << ' '
+                << unsigned(cached.summary.state) << ' ' << cached.summary.entryCount << ' '
+                << cached.summary.headRealtime << ' ' << cached.summary.tailRealtime << ' '
+                << cached.summary.headSeqnum << ' ' << cached.summary.tailSeqnum << ' '
+                << idToString(cached.summary.bootId) << ' ' << idToString(cached.summary.seqnumId) << ' '
+                << cached.path << '\n';
+        }
+        if (!file) {
+            unlink(temporaryPath.c_str());
+            return;
+        }
+    }
+    if (rename(temporaryPath.c_str(), m_path.c_str()) < 0) {
+        unlink(temporaryPath.c_str());
+    }
+}
+
+} // namespace
+
+std::string cacheDirectory(bool create)
+{
+    std::string directory;
+    const char *cacheHome = getenv("XDG_CACHE_HOME");
+    const char *home = getenv("HOME");
+    if (cacheHome && cacheHome[0] == '/') {
+        directory = cacheHome;
+    } else if (home && home[0] == '/') {
+        directory = std::string(home) + "/.cache";
+    } else {
+        return "";
+    }
+    if (create) {
+        mkdir(directory.c_str(), 0700);
+    }
+    directory += "/journal-watch";
+    if (create) {
+        mkdir(directory.c_str(), 0700);
+    }
+    return directory;
+}
+
+std::string cacheSubdirectory(const char *name, bool create)
+{
+    std::string directory = cacheDirectory(create);
+    if (directory.empty()) {
+        return directory;
+    }
+    directory += "/";
+    directory += name;
+    if (create) {
+        mkdir(directory.c_str(), 0700);
+    }
+    return directory;
+}
+
+void removeStaleCaches(const char *name, const std::vector<sd_id128_t> &existing)
+{
+    const std::string directory = cacheSubdirectory(name, false);
+    if (directory.empty()) {
+        return;
+    }
+    DIR *dir = opendir(directory.c_str());
+    if (!dir) {
+        return;
+    }
+    while (dirent *dirEntry = readdir(dir)) {
+        sd_id128_t id;
+        if (sd_id128_from_string(dirEntry->d_name, &id) < 0) {
+            continue;
+        }
+        const bool found = std::any_of(existing.begin(), existing.end(), [&](const sd_id128_t &other) {
+            return sd_id128_equal(id, other);
+        });
+        if (!found) {
+            unlinkat(dirfd(dir), dirEntry->d_name, 0);
+        }
+    }
+    closedir(dir);
+}
+
+std::vector<std::string> selectJournalFiles(const std::vector<std::string> &paths, uint64_t since, uint64_t until)
+{
+    HeaderCache cache;
+    std::vector<std::string> selected;
+    for (const std::string &path : paths) {
+        JournalSummary summary;
+        if (!cache.lookup(path, &summary)) {
+            continue;
+        }
+        if (summary.state == JournalSummary::Online) {
+            // Still growing, so the tail in the header says nothing
+            if (summary.entryCount == 0 || summary.headRealtime <= until) {
+                selected.push_back(path);
+            }
+            continue;
+        }
+        if (summary.entryCount == 0) {
+            continue;
+        }
+        if (summary.headRealtime <= until && summary.tailRealtime >= since) {
+            selected.push_back(path);
+        }
+    }
+    cache.save();
+    return selected;
+}
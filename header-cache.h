@@ -0,0 +1,27 @@
+#pragma once
+
+extern "C" {
+#include <systemd/sd-id128.h>
+} // extern "C"
+
+#include <cstdint>
+#include <string>
+#include <vector>
+
+// Where we keep our caches, ~/.cache/journal-watch or under XDG_CACHE_HOME.
+// Empty if there's no usable home directory.
+std::string cacheDirectory(bool create);
+
+// A directory under the cache directory, for the per journal file caches
+std::string cacheSubdirectory(const char *name, bool create);
+
+// Removes the per journal file caches in a cache subdirectory whose journal
+// files don't exist anymore
+void removeStaleCaches(const char *name, const std::vector<sd_id128_t> &existing);
+
+// Picks the journal files that can contain entries between since and until
+// (inclusive), going by the time range in their headers. Files that are still
+// being written are always included.
+// The headers are cached in ~/.cache/journal-watch/journal-headers, keyed by
+// inode and mtime, so usually none of the files have to be opened at all.
+std::vector<std::string> selectJournalFiles(const std::vector<std::string> &paths, uint64_t since, uint64_t until);
@@ -0,0 +1,100 @@
+#include "identity.h"
+#include "entry.h"
+
+extern "C" {
+#include <grp.h>
+#include <pwd.h>
+#include <stdlib.h>
+#include <systemd/sd-login.h>
+} // extern "C"
+
+#include <memory>
+#include <unordered_map>
+
+namespace {
+
+std::unordered_map<uint32_t, std::string> users;
+std::unordered_map<uint32_t, std::string> groups;
+std::unordered_map<std::string, std::unique_ptr<LoginSession>> sessions;
+
+// The non-reentrant versions are fine since only one thread looks things up
+// at a time, and the result is copied right away
+const std::string &lookUpUser(uint32_t uid)
+{
+    auto it = users.find(uid);
+    if (it != users.end()) {
+        return it->second;
+    }
+    const passwd *pw = getpwuid(uid);
+    std::string name = pw && pw->pw_name[0] ? pw->pw_name : std::to_string(uid);
+    return users.emplace(uid, std::move(name)).first->second;
+}
+
+const std::string &lookUpGroup(uint32_t gid)
+{
+    auto it = groups.find(gid);
+    if (it != groups.end()) {
+        return it->second;
+    }
+    const group *gr = getgrgid(gid);
+    std::string name = gr && gr->gr_name[0] ? gr->gr_name : std::to_string(gid);
+    return groups.emplace(gid, std::move(name)).first->second;
+}
+
+// libsystemd hands out strings that we have to free
+std::string takeString(char *string)
+{
+    std::string result = string ? string : "";
+    free(string);
+    return result;
+}
+
+} // namespace
+
+const std::string &getUsername(uint32_t uid, const std::string &uidString)
+{
+    return uid == InvalidId ? uidString : lookUpUser(uid);
+}
+
+const std::string &getGroupName(uint32_t gid, const std::string &gidString)
+{
+    return gid == InvalidId ? gidString : lookUpGroup(gid);
+}
+
+const LoginSession *getLoginSession(const std::string &session)
+{
+    auto it = sessions.find(session);
+    if (it != sessions.end()) {
+        return it->second.get();
+    }
+
+    std::unique_ptr<LoginSession> info;
+    uid_t uid;
+    if (!session.empty() && sd_session_get_uid(session.c_str(), &uid) >= 0) {
+        info = std::make_unique<LoginSession>();
+        info->user = lookUpUser(uid);
+        char *string = nullptr;
+        if (sd_session_get_tty(session.c_str(), &string) >= 0) {
+            info->tty = takeString(string);
+        }
+        string = nullptr;
+        if (sd_session_get_remote_host(session.c_str(), &string) >= 0) {
+            info->remoteHost = takeString(string);
+        }
+    }
+    return sessions.emplace(session, std::move(info)).first->second.get();
+}
+
+void prefetchUsers(const std::vector<uint32_t> &uids)
+{
+    for (const uint32_t uid : uids) {
+        lookUpUser(uid);
+    }
+}
+
+void prefetchGroups(const std::vector<uint32_t> &gids)
+{
+    for (const uint32_t gid : gids) {
+        lookUpGroup(gid);
+    }
+}
@@ -0,0 +1,28 @@
+#pragma once
+
+#include <cstdint>
+#include <string>
+#include <vector>
+
+// Users, groups and logind sessions, each looked up only once since NSS and
+// logind can be slow. The ones that don't exist are remembered as well. Not
+// thread safe, but it's fine to use from one thread at a time.
+
+// The logind session behind an _AUDIT_SESSION, which has the same id
+struct LoginSession {
+    std::string user;
+    std::string tty;
+    std::string remoteHost;
+};
+
+// Falls back to the id as it is in the journal if there's no such user or group
+const std::string &getUsername(uint32_t uid, const std::string &uidString);
+const std::string &getGroupName(uint32_t gid, const std::string &gidString);
+
+// Null if there's no such session (anymore)
+const LoginSession *getLoginSession(const std::string &session);
+
+// For looking up everything in the journal up front, instead of while
+// showing the entries
+void prefetchUsers(const std::vector<uint32_t> &uids);
+void prefetchGroups(const std::vector<uint32_t> &gids);
@@ -0,0 +1,741 @@
+#include "journal-file.h"
+#include "decompress.h"
+
+extern "C" {
+#include <dirent.h>
+#include <endian.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <stdio.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+} // extern "C"
+
+#include <algorithm>
+#include <fstream>
+
+// From systemd's journal-def.h, everything little endian
+namespace Format {
+    enum ObjectType : uint8_t {
+        Data = 1,
+        Field = 2,
+        EntryObject = 3,
+        DataHashTable = 4,
+        FieldHashTable = 5,
+        EntryArray = 6,
+        Tag = 7
+    };
+
+    enum IncompatibleFlag : uint32_t {
+        IncompatibleXZ = 1 << 0,
+        IncompatibleLZ4 = 1 << 1,
+        IncompatibleKeyedHash = 1 << 2,
+        IncompatibleZSTD = 1 << 3,
+        IncompatibleCompact = 1 << 4,
+
+        IncompatibleSupported = IncompatibleXZ | IncompatibleLZ4 | IncompatibleKeyedHash | IncompatibleZSTD | IncompatibleCompact
+    };
+
+    const char signature[8] = { 'L', 'P', 'K', 'S', 'H', 'H', 'R', 'H' };
+
+    // Header
+    constexpr uint64_t IncompatibleFlags = 12;
+    constexpr uint64_t State = 16;
+    constexpr uint64_t FileId = 24;
+    constexpr uint64_t BootId = 56;
+    constexpr uint64_t SeqnumId = 72;
+    constexpr uint64_t HeaderSize = 88;
+    constexpr uint64_t NEntries = 152;
+    constexpr uint64_t TailEntrySeqnum = 160;
+    constexpr uint64_t HeadEntrySeqnum = 168;
+    constexpr uint64_t EntryArrayOffset = 176;
+    constexpr uint64_t HeadEntryRealtime = 184;
+    constexpr uint64_t TailEntryRealtime = 192;
+    constexpr uint64_t HeaderSizeMinimum = 208;
+
+    // ObjectHeader
+    constexpr uint64_t ObjectType = 0;
+    constexpr uint64_t ObjectFlags = 1;
+    constexpr uint64_t ObjectSize = 8;
+    constexpr uint64_t ObjectHeaderSize = 16;
+
+    // DataObject
+    constexpr uint64_t DataPayload = 64;
+    constexpr uint64_t DataPayloadCompact = 72;
+
+    // EntryObject
+    constexpr uint64_t EntrySeqnum = 16;
+    constexpr uint64_t EntryRealtime = 24;
+    constexpr uint64_t EntryMonotonic = 32;
+    constexpr uint64_t EntryBootId = 40;
+    constexpr uint64_t EntryXorHash = 56;
+    constexpr uint64_t EntryItems = 64;
+    constexpr uint64_t EntryItemSize = 16;
+    constexpr uint64_t EntryItemSizeCompact = 4;
+
+    // EntryArrayObject
+    constexpr uint64_t EntryArrayNext = 16;
+    constexpr uint64_t EntryArrayItems = 24;
+    constexpr uint64_t EntryArrayItemSize = 8;
+    constexpr uint64_t EntryArrayItemSizeCompact = 4;
+} // namespace Format
+
+int readJournalSummary(const std::string &path, JournalSummary *summary)
+{
+    const int fd = ::open(path.c_str(), O_RDONLY | O_CLOEXEC);
+    if (fd < 0) {
+        return -errno;
+    }
+    uint8_t header[Format::HeaderSizeMinimum];
+    const ssize_t bytesRead = pread(fd, header, sizeof header, 0);
+    const int readError = errno;
+    close(fd);
+    if (bytesRead < 0) {
+        return -readError;
+    }
+    if (size_t(bytesRead) < sizeof header || memcmp(header, Format::signature, sizeof Format::signature) != 0) {
+        return -EBADMSG;
+    }
+
+    auto read64 = [&](uint64_t offset) {
+        uint64_t value;
+        memcpy(&value, header + offset, sizeof value);
+        return le64toh(value);
+    };
+    summary->state = header[Format::State];
+    summary->entryCount = read64(Format::NEntries);
+    summary->headRealtime = read64(Format::HeadEntryRealtime);
+    summary->tailRealtime = read64(Format::TailEntryRealtime);
+    summary->headSeqnum = read64(Format::HeadEntrySeqnum);
+    summary->tailSeqnum = read64(Format::TailEntrySeqnum);
+    memcpy(&summary->fileId, header + Format::FileId, sizeof summary->fileId);
+    memcpy(&summary->bootId, header + Format::BootId, sizeof summary->bootId);
+    memcpy(&summary->seqnumId, header + Format::SeqnumId, sizeof summary->seqnumId);
+    return 0;
+}
+
+JournalFile::JournalFile(const std::string &path) :
+    m_path(path)
+{
+}
+
+JournalFile::~JournalFile()
+{
+    if (m_data) {
+        munmap(const_cast<uint8_t*>(m_data), m_size);
+    }
+}
+
+uint32_t JournalFile::read32(uint64_t offset) const
+{
+    uint32_t value;
+    memcpy(&value, m_data + offset, sizeof value);
+    return le32toh(value);
+}
+
+uint64_t JournalFile::read64(uint64_t offset) const
+{
+    uint64_t value;
+    memcpy(&value, m_data + offset, sizeof value);
+    return le64toh(value);
+}
+
+int JournalFile::open()
+{
+    const int fd = ::open(m_path.c_str(), O_RDONLY | O_CLOEXEC);
+    if (fd < 0) {
+        return -errno;
+    }
+    struct stat st;
+    if (fstat(fd, &st) < 0) {
+        const int ret = -errno;
+        close(fd);
+        return ret;
+    }
+    if (uint64_t(st.st_size) < Format::HeaderSizeMinimum) {
+        close(fd);
+        return -EBADMSG;
+    }
+
+    void *data = mmap(nullptr, st.st_size, PROT_READ, MAP_SHARED, fd, 0);
+    close(fd);
+    if (data == MAP_FAILED) {
+        return -errno;
+    }
+    m_data = static_cast<const uint8_t*>(data);
+    m_size = st.st_size;
+
+    // We walk it front to back, so let the kernel read ahead aggressively
+    madvise(data, m_size, MADV_SEQUENTIAL);
+
+    if (memcmp(m_data, Format::signature, sizeof Format::signature) != 0) {
+        return -EBADMSG;
+    }
+    const uint32_t incompatible = read32(Format::IncompatibleFlags);
+    if (incompatible & ~Format::IncompatibleSupported) {
+        return -EPROTONOSUPPORT;
+    }
+    m_compact = incompatible & Format::IncompatibleCompact;
+
+    const uint64_t headerSize = read64(Format::HeaderSize);
+    if (headerSize < Format::HeaderSizeMinimum || headerSize > m_size) {
+        return -EBADMSG;
+    }
+    memcpy(&m_fileId, m_data + Format::FileId, sizeof m_fileId);
+    memcpy(&m_seqnumId, m_data + Format::SeqnumId, sizeof m_seqnumId);
+    for (int i = 0; i < 8; i++) {
+        m_seqnumIdPrefix = m_seqnumIdPrefix << 8 | m_seqnumId.bytes[i];
+    }
+
+    return loadEntryArrays();
+}
+
+int JournalFile::objectAt(uint64_t offset, uint8_t type, uint64_t minimumSize, uint64_t *size)
+{
+    if (offset % 8 != 0 || offset < Format::HeaderSizeMinimum || offset > m_size - Format::ObjectHeaderSize) {
+        return -EBADMSG;
+    }
+    if (m_data[offset + Format::ObjectType] != type) {
+        return -EBADMSG;
+    }
+    const uint64_t objectSize = read64(offset + Format::ObjectSize);
+    if (objectSize < minimumSize || objectSize > m_size - offset) {
+        return -EBADMSG;
+    }
+    *size = objectSize;
+    return 0;
+}
+
+int JournalFile::loadEntryArrays()
+{
+    const uint64_t itemSize = m_compact ? Format::EntryArrayItemSizeCompact : Format::EntryArrayItemSize;
+    const uint64_t total = read64(Format::NEntries);
+
+    uint64_t offset = read64(Format::EntryArrayOffset);
+    uint64_t index = 0;
+    while (offset != 0 && index < total) {
+        uint64_t size;
+        int ret = objectAt(offset, Format::EntryArray, Format::EntryArrayItems, &size);
+        if (ret < 0 && offset >= m_size && index > 0) {
+            // The file grew after we mapped it, ignore the rest
+            break;
+        }
+        if (ret < 0) {
+            return ret;
+        }
+        const uint64_t capacity = (size - Format::EntryArrayItems) / itemSize;
+        const uint64_t count = std::min(capacity, total - index);
+        if (count > 0) {
+            m_entryArrays.push_back({ offset, index, count });
+        }
+        index += count;
+
+        const uint64_t next = read64(offset + Format::EntryArrayNext);
+        if (next != 0 && next <= offset) { // Arrays are only ever appended, avoid loops
+            return -EBADMSG;
+        }
+        offset = next;
+    }
+    m_entryCount = index;
+
+    return 0;
+}
+
+int JournalFile::entryOffset(uint64_t index, uint64_t *offset)
+{
+    if (index >= m_entryCount) {
+        return -ERANGE;
+    }
+
+    // Almost always sequential, so check where we were last time first
+    if (m_lastEntryArray >= m_entryArrays.size() ||
+            index < m_entryArrays[m_lastEntryArray].firstIndex ||
+            index >= m_entryArrays[m_lastEntryArray].firstIndex + m_entryArrays[m_lastEntryArray].count) {
+        auto it = std::upper_bound(m_entryArrays.begin(), m_entryArrays.end(), index, [](uint64_t i, const EntryArray &array) {
+            return i < array.firstIndex;
+        });
+        m_lastEntryArray = std::distance(m_entryArrays.begin(), it) - 1;
+    }
+
+    const EntryArray &array = m_entryArrays[m_lastEntryArray];
+    const uint64_t position = index - array.firstIndex;
+    if (m_compact) {
+        *offset = read32(array.offset + Format::EntryArrayItems + position * Format::EntryArrayItemSizeCompact);
+    } else {
+        *offset = read64(array.offset + Format::EntryArrayItems + position * Format::EntryArrayItemSize);
+    }
+
+    // Unused slot at the end of a file that's still being written
+    if (*offset == 0) {
+        return -ENODATA;
+    }
+    return 0;
+}
+
+int JournalFile::entryHeader(uint64_t index, EntryHeader *header)
+{
+    uint64_t offset;
+    int ret = entryOffset(index, &offset);
+    if (ret < 0) {
+        return ret;
+    }
+    uint64_t size;
+    ret = objectAt(offset, Format::EntryObject, Format::EntryItems, &size);
+    if (ret < 0) {
+        return ret;
+    }
+    header->seqnum = read64(offset + Format::EntrySeqnum);
+    header->realtime = read64(offset + Format::EntryRealtime);
+    header->monotonic = read64(offset + Format::EntryMonotonic);
+    memcpy(&header->bootId, m_data + offset + Format::EntryBootId, sizeof header->bootId);
+    header->xorHash = read64(offset + Format::EntryXorHash);
+    return 0;
+}
+
+int JournalFile::dataPayload(uint64_t offset, std::string_view *payload, uint8_t *compression)
+{
+    const uint64_t payloadOffset = m_compact ? Format::DataPayloadCompact : Format::DataPayload;
+    uint64_t size;
+    int ret = objectAt(offset, Format::Data, payloadOffset, &size);
+    if (ret < 0) {
+        return ret;
+    }
+
+    *payload = std::string_view(reinterpret_cast<const char*>(m_data + offset + payloadOffset), size - payloadOffset);
+    *compression = m_data[offset + Format::ObjectFlags] & CompressionMask;
+    return 0;
+}
+
+static void assignPayload(Entry *entry, std::string_view payload, FieldMask fields)
+{
+    const size_t separator = payload.find('=');
+    if (separator == std::string_view::npos) {
+        return;
+    }
+    entry->setField(payload.substr(0, separator), payload.substr(separator + 1), fields);
+}
+
+int JournalFile::readEntry(uint64_t index, Entry *entry, std::vector<CompressedPayload> *deferred)
+{
+    uint64_t offset;
+    int ret = entryOffset(index, &offset);
+    if (ret < 0) {
+        return ret;
+    }
+    uint64_t size;
+    ret = objectAt(offset, Format::EntryObject, Format::EntryItems, &size);
+    if (ret < 0) {
+        return ret;
+    }
+
+    entry->clear();
+    entry->realtime = read64(offset + Format::EntryRealtime);
+    entry->seqnum = read64(offset + Format::EntrySeqnum);
+    entry->seqnumId = m_seqnumIdPrefix;
+    if (deferred) {
+        deferred->clear();
+    }
+
+    const uint64_t itemSize = m_compact ? Format::EntryItemSizeCompact : Format::EntryItemSize;
+    const uint64_t itemCount = (size - Format::EntryItems) / itemSize;
+    for (uint64_t i = 0; i < itemCount; i++) {
+        const uint64_t itemOffset = offset + Format::EntryItems + i * itemSize;
+        const uint64_t dataOffset = m_compact ? read32(itemOffset) : read64(itemOffset);
+
+        std::string_view payload;
+        uint8_t compression;
+        ret = dataPayload(dataOffset, &payload, &compression);
+        if (ret < 0) {
+            return ret;
+        }
+
+        if (compression) {
+            const uint8_t *data = reinterpret_cast<const uint8_t*>(payload.data());
+            if (deferred) {
+                deferred->push_back({ compression, data, payload.size() });
+                continue;
+            }
+            ret = decompressBlob(compression, data, payload.size(), &m_decompressed);
+            if (ret < 0) {
+                return ret;
+            }
+            payload = m_decompressed;
+        }
+
+        assignPayload(entry, payload, m_fields);
+    }
+    entry->decodeNumbers();
+
+    return 0;
+}
+
+int JournalFile::enumerateData(uint64_t index, const std::function<void(std::string_view data)> &function)
+{
+    uint64_t offset;
+    int ret = entryOffset(index, &offset);
+    if (ret < 0) {
+        return ret;
+    }
+    uint64_t size;
+    ret = objectAt(offset, Format::EntryObject, Format::EntryItems, &size);
+    if (ret < 0) {
+        return ret;
+    }
+
+    const uint64_t itemSize = m_compact ? Format::EntryItemSizeCompact : Format::EntryItemSize;
+    const uint64_t itemCount = (size - Format::EntryItems) / itemSize;
+    for (uint64_t i = 0; i < itemCount; i++) {
+        const uint64_t itemOffset = offset + Format::EntryItems + i * itemSize;
+        const uint64_t dataOffset = m_compact ? read32(itemOffset) : read64(itemOffset);
+
+        std::string_view payload;
+        uint8_t compression;
+        ret = dataPayload(dataOffset, &payload, &compression);
+        if (ret < 0) {
+            return ret;
+        }
+        if (compression) {
+            ret = decompressBlob(compression, reinterpret_cast<const uint8_t*>(payload.data()), payload.size(), &m_decompressed);
+            if (ret < 0) {
+                return ret;
+            }
+            payload = m_decompressed;
+        }
+        function(payload);
+    }
+    return 0;
+}
+
+int decompressDeferred(Entry *entry, const std::vector<CompressedPayload> &deferred, std::string *scratch, FieldMask fields)
+{
+    for (const CompressedPayload &compressed : deferred) {
+        const int ret = decompressBlob(compressed.flags, compressed.data, compressed.size, scratch);
+        if (ret < 0) {
+            return ret;
+        }
+        assignPayload(entry, *scratch, fields);
+    }
+    if (!deferred.empty()) {
+        entry->decodeNumbers();
+    }
+    return 0;
+}
+
+// Same ordering as libsystemd's compare_entry_order(): seqnums are only
+// comparable within the same seqnum ID, monotonic within the same boot.
+static int compareEntries(const EntryHeader &a, const sd_id128_t &aSeqnumId, const EntryHeader &b, const sd_id128_t &bSeqnumId)
+{
+    if (sd_id128_equal(aSeqnumId, bSeqnumId) && a.seqnum != b.seqnum) {
+        return a.seqnum < b.seqnum ? -1 : 1;
+    }
+    if (sd_id128_equal(a.bootId, b.bootId) && a.monotonic != b.monotonic) {
+        return a.monotonic < b.monotonic ? -1 : 1;
+    }
+    if (a.realtime != b.realtime) {
+        return a.realtime < b.realtime ? -1 : 1;
+    }
+    if (a.xorHash != b.xorHash) {
+        return a.xorHash < b.xorHash ? -1 : 1;
+    }
+    return 0;
+}
+
+int JournalFileSet::open(const std::vector<std::string> &paths, int *failed)
+{
+    *failed = 0;
+    for (const std::string &path : paths) {
+        std::unique_ptr<JournalFile> journal = std::make_unique<JournalFile>(path);
+        const int ret = journal->open();
+        if (ret < 0) {
+            // libsystemd also just silently skips files it can't open
+            (*failed)++;
+            continue;
+        }
+        File file;
+        file.journal = std::move(journal);
+        m_files.push_back(std::move(file));
+    }
+    if (m_files.empty()) {
+        return -ENOENT;
+    }
+    return 0;
+}
+
+void JournalFileSet::seekHead()
+{
+    for (File &file : m_files) {
+        file.boundary = 0;
+    }
+    m_current = nullptr;
+    m_direction = None;
+}
+
+void JournalFileSet::seekTail()
+{
+    for (File &file : m_files) {
+        file.boundary = file.journal->entryCount();
+    }
+    m_current = nullptr;
+    m_direction = None;
+}
+
+void JournalFileSet::seekRealtime(uint64_t usec)
+{
+    for (File &file : m_files) {
+        // Realtime isn't strictly monotonic, but close enough; libsystemd does the same
+        uint64_t low = 0;
+        uint64_t high = file.journal->entryCount();
+        while (low < high) {
+            const uint64_t middle = low + (high - low) / 2;
+            EntryHeader header;
+            if (file.journal->entryHeader(middle, &header) < 0 || header.realtime >= usec) {
+                high = middle;
+            } else {
+                low = middle + 1;
+            }
+        }
+        file.boundary = low;
+    }
+    m_current = nullptr;
+    m_direction = None;
+}
+
+int JournalFileSet::header(File *file, uint64_t index, const EntryHeader **header)
+{
+    if (file->cachedIndex != index) {
+        const int ret = file->journal->entryHeader(index, &file->cachedHeader);
+        if (ret < 0) {
+            file->cachedIndex = UINT64_MAX;
+            return ret;
+        }
+        file->cachedIndex = index;
+    }
+    *header = &file->cachedHeader;
+    return 0;
+}
+
+void JournalFileSet::setCandidates(size_t file, std::vector<PositionRange> ranges, uint64_t covered)
+{
+    m_files[file].candidates = std::move(ranges);
+    m_files[file].candidatesCovered = covered;
+}
+
+// Where the next entry forward is, skipping what isn't a candidate
+uint64_t JournalFileSet::forwardPosition(const File &file) const
+{
+    if (file.boundary >= file.candidatesCovered) {
+        return file.boundary;
+    }
+    auto it = std::partition_point(file.candidates.begin(), file.candidates.end(), [&](const PositionRange &range) {
+        return range.end <= file.boundary;
+    });
+    return it == file.candidates.end() ? file.candidatesCovered : std::max(it->begin, file.boundary);
+}
+
+// Same backwards, the entries before the returned position are the ones left
+uint64_t JournalFileSet::backwardPosition(const File &file) const
+{
+    if (file.boundary == 0 || file.boundary - 1 >= file.candidatesCovered) {
+        return file.boundary;
+    }
+    auto it = std::partition_point(file.candidates.begin(), file.candidates.end(), [&](const PositionRange &range) {
+        return range.begin < file.boundary;
+    });
+    return it == file.candidates.begin() ? 0 : std::min((it - 1)->end, file.boundary);
+}
+
+int JournalFileSet::next()
+{
+    // Step over the entry we're sitting on if we came from the other direction
+    if (m_direction == Backward && m_current) {
+        m_current->boundary++;
+    }
+
+    File *best = nullptr;
+    uint64_t bestPosition = 0;
+    const EntryHeader *bestHeader = nullptr;
+    for (File &file : m_files) {
+        const uint64_t position = forwardPosition(file);
+        if (position >= file.journal->entryCount()) {
+            continue;
+        }
+        const EntryHeader *candidate;
+        const int ret = header(&file, position, &candidate);
+        if (ret == -ENODATA) { // Partially written, treat as the end
+            continue;
+        }
+        if (ret < 0) {
+            return ret;
+        }
+        if (!best || compareEntries(*candidate, file.journal->seqnumId(), *bestHeader, best->journal->seqnumId()) < 0) {
+            best = &file;
+            bestPosition = position;
+            bestHeader = candidate;
+        }
+    }
+    if (!best) {
+        return 0;
+    }
+
+    m_current = best;
+    m_currentIndex = bestPosition;
+    best->boundary = bestPosition + 1;
+    m_direction = Forward;
+    return 1;
+}
+
+int JournalFileSet::previous()
+{
+    if (m_direction == Forward && m_current) {
+        m_current->boundary--;
+    }
+
+    File *best = nullptr;
+    uint64_t bestPosition = 0;
+    const EntryHeader *bestHeader = nullptr;
+    for (File &file : m_files) {
+        const uint64_t position = backwardPosition(file);
+        if (position == 0) {
+            continue;
+        }
+        const EntryHeader *candidate;
+        const int ret = header(&file, position - 1, &candidate);
+        if (ret == -ENODATA) {
+            continue;
+        }
+        if (ret < 0) {
+            return ret;
+        }
+        if (!best || compareEntries(*candidate, file.journal->seqnumId(), *bestHeader, best->journal->seqnumId()) > 0) {
+            best = &file;
+            bestPosition = position - 1;
+            bestHeader = candidate;
+        }
+    }
+    if (!best) {
+        return 0;
+    }
+
+    best->boundary = bestPosition;
+    m_current = best;
+    m_currentIndex = best->boundary;
+    m_direction = Backward;
+    return 1;
+}
+
+void JournalFileSet::setFields(FieldMask fields)
+{
+    for (File &file : m_files) {
+        file.journal->setFields(fields);
+    }
+}
+
+int JournalFileSet::readEntry(Entry *entry, std::vector<CompressedPayload> *deferred)
+{
+    if (!m_current) {
+        return -EADDRNOTAVAIL;
+    }
+    return m_current->journal->readEntry(m_currentIndex, entry, deferred);
+}
+
+int JournalFileSet::enumerateData(const std::function<void(std::string_view data)> &function)
+{
+    if (!m_current) {
+        return -EADDRNOTAVAIL;
+    }
+    return m_current->journal->enumerateData(m_currentIndex, function);
+}
+
+int JournalFileSet::entryHeader(EntryHeader *header)
+{
+    if (!m_current) {
+        return -EADDRNOTAVAIL;
+    }
+    const EntryHeader *entry;
+    const int ret = this->header(m_current, m_currentIndex, &entry);
+    if (ret < 0) {
+        return ret;
+    }
+    *header = *entry;
+    return 0;
+}
+
+int JournalFileSet::cursor(std::string *cursor)
+{
+    if (!m_current) {
+        return -EADDRNOTAVAIL;
+    }
+    const EntryHeader *entry;
+    const int ret = header(m_current, m_currentIndex, &entry);
+    if (ret < 0) {
+        return ret;
+    }
+
+    // Same format as sd_journal_get_cursor(), so we can hand over to libsystemd
+    char seqnumId[SD_ID128_STRING_MAX];
+    char bootId[SD_ID128_STRING_MAX];
+    char buffer[256];
+    snprintf(buffer, sizeof buffer, "s=%s;i=%llx;b=%s;m=%llx;t=%llx;x=%llx",
+            sd_id128_to_string(m_current->journal->seqnumId(), seqnumId),
+            (unsigned long long)entry->seqnum,
+            sd_id128_to_string(entry->bootId, bootId),
+            (unsigned long long)entry->monotonic,
+            (unsigned long long)entry->realtime,
+            (unsigned long long)entry->xorHash);
+    *cursor = buffer;
+    return 0;
+}
+
+static bool isJournalFile(const std::string &name)
+{
+    auto endsWith = [&](const std::string &suffix) {
+        return name.size() > suffix.size() && name.compare(name.size() - suffix.size(), suffix.size(), suffix) == 0;
+    };
+    return endsWith(".journal") || endsWith(".journal~");
+}
+
+std::vector<std::string> journalFilesInDirectory(const std::string &directory)
+{
+    std::vector<std::string> files;
+    DIR *dir = opendir(directory.c_str());
+    if (!dir) {
+        return files;
+    }
+    while (dirent *dirEntry = readdir(dir)) {
+        const std::string name = dirEntry->d_name;
+        if (name == "." || name == "..") {
+            continue;
+        }
+        const std::string path = directory + "/" + name;
+        if (isJournalFile(name)) {
+            files.push_back(path);
+        } else if (dirEntry->d_type == DT_DIR) {
+            // Both the top level journal dir and the machine ID subdirs work
+            const std::vector<std::string> subFiles = journalFilesInDirectory(path);
+            files.insert(files.end(), subFiles.begin(), subFiles.end());
+        }
+    }
+    closedir(dir);
+    std::sort(files.begin(), files.end());
+    return files;
+}
+
+std::vector<std::string> localJournalFiles(const std::string &journalNamespace)
+{
+    std::string machineId;
+    std::ifstream("/etc/machine-id") >> machineId;
+    if (machineId.empty()) {
+        return {};
+    }
+    // A namespace has directories of its own, next to the default ones
+    if (!journalNamespace.empty()) {
+        machineId += "." + journalNamespace;
+    }
+
+    std::vector<std::string> files = journalFilesInDirectory("/var/log/journal/" + machineId);
+    const std::vector<std::string> runtime = journalFilesInDirectory("/run/log/journal/" + machineId);
+    files.insert(files.end(), runtime.begin(), runtime.end());
+    return files;
+}
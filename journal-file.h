@@ -0,0 +1,199 @@
+#pragma once
+
+#include "entry.h"
+
+extern "C" {
+#include <systemd/sd-id128.h>
+} // extern "C"
+
+#include <cstdint>
+#include <functional>
+#include <memory>
+#include <string>
+#include <string_view>
+#include <vector>
+
+// The per-entry bits needed to order entries between files, without touching
+// any of the data objects.
+struct EntryHeader {
+    uint64_t seqnum = 0;
+    uint64_t realtime = 0;
+    uint64_t monotonic = 0;
+    sd_id128_t bootId {};
+    uint64_t xorHash = 0;
+};
+
+// What's in the header of a journal file, enough to know whether it's worth
+// opening without mapping the whole thing.
+struct JournalSummary {
+    enum State : uint8_t {
+        Offline = 0,
+        Online = 1,
+        Archived = 2
+    };
+    uint8_t state = Offline;
+    uint64_t entryCount = 0;
+    uint64_t headRealtime = 0;
+    uint64_t tailRealtime = 0;
+    uint64_t headSeqnum = 0;
+    uint64_t tailSeqnum = 0;
+    sd_id128_t fileId {};
+    sd_id128_t bootId {};
+    sd_id128_t seqnumId {};
+};
+
+int readJournalSummary(const std::string &path, JournalSummary *summary);
+
+// A compressed data object that hasn't been decompressed yet, pointing into
+// the mmap of the file, so it stays valid as long as the JournalFile does.
+struct CompressedPayload {
+    uint8_t flags;
+    const uint8_t *data;
+    size_t size;
+};
+
+// Decompresses and assigns payloads that readEntry() deferred, safe to call
+// from any thread as long as each thread has its own scratch buffer.
+int decompressDeferred(Entry *entry, const std::vector<CompressedPayload> &deferred, std::string *scratch, FieldMask fields = AllFields);
+
+// Entry positions [begin, end) in one file
+struct PositionRange {
+    uint64_t begin;
+    uint64_t end;
+};
+
+// Reads a single .journal file directly from an mmap, without going through
+// libsystemd. Everything read from the file is bounds checked, so a corrupt or
+// truncated file just gives errors instead of crashing.
+// Like the sd_journal API everything returns 0 or a negative errno.
+class JournalFile
+{
+public:
+    explicit JournalFile(const std::string &path);
+    ~JournalFile();
+
+    JournalFile(const JournalFile &) = delete;
+    JournalFile &operator=(const JournalFile &) = delete;
+
+    int open();
+
+    const std::string &path() const { return m_path; }
+    uint64_t entryCount() const { return m_entryCount; }
+    const sd_id128_t &fileId() const { return m_fileId; }
+    const sd_id128_t &seqnumId() const { return m_seqnumId; }
+
+    int entryHeader(uint64_t index, EntryHeader *header);
+
+    // Only these fields are filled in by readEntry(), the fallbacks for
+    // them aren't added automatically.
+    void setFields(FieldMask fields) { m_fields = fields; }
+    FieldMask fields() const { return m_fields; }
+
+    // If deferred is set compressed payloads are appended to it instead of
+    // being decompressed inline, so it can be done on other threads.
+    int readEntry(uint64_t index, Entry *entry, std::vector<CompressedPayload> *deferred = nullptr);
+
+    // Calls function with every FIELD=value in the entry, straight from the
+    // mmap unless it has to be decompressed. Ignores setFields().
+    int enumerateData(uint64_t index, const std::function<void(std::string_view data)> &function);
+
+private:
+    struct EntryArray {
+        uint64_t offset;
+        uint64_t firstIndex;
+        uint64_t count;
+    };
+
+    int loadEntryArrays();
+    int entryOffset(uint64_t index, uint64_t *offset);
+    int objectAt(uint64_t offset, uint8_t type, uint64_t minimumSize, uint64_t *size);
+    int dataPayload(uint64_t offset, std::string_view *payload, uint8_t *compression);
+
+    uint32_t read32(uint64_t offset) const;
+    uint64_t read64(uint64_t offset) const;
+
+    std::string m_path;
+    const uint8_t *m_data = nullptr;
+    uint64_t m_size = 0;
+
+    bool m_compact = false;
+    sd_id128_t m_fileId {};
+    sd_id128_t m_seqnumId {};
+    // What goes in Entry::seqnumId
+    uint64_t m_seqnumIdPrefix = 0;
+    uint64_t m_entryCount = 0;
+    FieldMask m_fields = AllFields;
+
+    std::vector<EntryArray> m_entryArrays;
+    size_t m_lastEntryArray = 0;
+
+    // Decompressed payloads are only needed until they're copied into the entry
+    std::string m_decompressed;
+};
+
+// Merges several journal files into one stream, ordered the same way
+// libsystemd does it. Modelled on the sd_journal iteration API so the history
+// code looks the same for both.
+class JournalFileSet
+{
+public:
+    // Opens all files, skipping (and returning the count of) the ones we can't read
+    int open(const std::vector<std::string> &paths, int *failed);
+
+    void seekHead();
+    void seekTail();
+    // Positions before the first entry at or after usec in each file
+    void seekRealtime(uint64_t usec);
+
+    // Returns 1 if moved, 0 at the end and negative errno on errors
+    int next();
+    int previous();
+
+    int readEntry(Entry *entry, std::vector<CompressedPayload> *deferred = nullptr);
+    int enumerateData(const std::function<void(std::string_view data)> &function);
+    int entryHeader(EntryHeader *header);
+    int cursor(std::string *cursor);
+
+    // See JournalFile::setFields()
+    void setFields(FieldMask fields);
+
+    size_t fileCount() const { return m_files.size(); }
+    JournalFile *file(size_t index) { return m_files[index].journal.get(); }
+
+    // Limits the entries before covered in a file to the given (sorted, not
+    // overlapping) ranges, e.g. the ones an index says can match.
+    void setCandidates(size_t file, std::vector<PositionRange> ranges, uint64_t covered);
+
+private:
+    struct File {
+        std::unique_ptr<JournalFile> journal;
+
+        // Entries before this index are "before" the current location
+        uint64_t boundary = 0;
+
+        uint64_t cachedIndex = UINT64_MAX;
+        EntryHeader cachedHeader;
+
+        std::vector<PositionRange> candidates;
+        uint64_t candidatesCovered = 0;
+    };
+    enum Direction {
+        None,
+        Forward,
+        Backward
+    };
+
+    int header(File *file, uint64_t index, const EntryHeader **header);
+    uint64_t forwardPosition(const File &file) const;
+    uint64_t backwardPosition(const File &file) const;
+
+    std::vector<File> m_files;
+    File *m_current = nullptr;
+    uint64_t m_currentIndex = 0;
+    Direction m_direction = None;
+};
+
+// The journal files for the local machine, like SD_JOURNAL_LOCAL_ONLY, or
+// only those of the namespace if one is given
+std::vector<std::string> localJournalFiles(const std::string &journalNamespace = std::string());
+std::vector<std::string> journalFilesInDirectory(const std::string &directory);
@@ -0,0 +1,646 @@
+#include "journal-source.h"
+
+extern "C" {
+#include <endian.h>
+#include <errno.h>
+#include <limits.h>
+#include <poll.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+} // extern "C"
+
+#include <algorithm>
+#include <charconv>
+#include <cinttypes>
+
+// Cursors are s=<seqnum id>;i=<seqnum>;b=<boot id>;... with everything in hex
+static void parseCursorSeqnum(std::string_view cursor, Entry *entry)
+{
+    uint64_t seqnum = 0;
+    uint64_t seqnumId = 0;
+    while (!cursor.empty()) {
+        const size_t end = std::min(cursor.find(';'), cursor.size());
+        const std::string_view item = cursor.substr(0, end);
+        if (item.size() >= 18 && item.compare(0, 2, "s=") == 0) {
+            std::from_chars(item.data() + 2, item.data() + 18, seqnumId, 16);
+        } else if (item.compare(0, 2, "i=") == 0) {
+            std::from_chars(item.data() + 2, item.data() + item.size(), seqnum, 16);
+        }
+        cursor.remove_prefix(std::min(end + 1, cursor.size()));
+    }
+    // Cursors that didn't come from journald only have an i=
+    if (seqnumId != 0) {
+        entry->seqnum = seqnum;
+        entry->seqnumId = seqnumId;
+    }
+}
+
+int JournalSource::previousSkip(uint64_t count)
+{
+    uint64_t moved = 0;
+    while (moved < count) {
+        const int ret = previous();
+        if (ret < 0) {
+            return ret;
+        }
+        if (ret == 0) {
+            break;
+        }
+        moved++;
+    }
+    return moved;
+}
+
+int JournalSource::readEntry(Entry *entry, FieldMask fields)
+{
+    int ret = -EAGAIN;
+    for (int retries = 0; retries < 10 && ret == -EAGAIN; retries++) {
+        entry->clear();
+        ret = fetchEntry(entry, fields);
+    }
+    if (ret < 0) {
+        return ret;
+    }
+    entry->decodeNumbers();
+    return 0;
+}
+
+static uint64_t monotonicUsec()
+{
+    timespec now;
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    return now.tv_sec * 1000000ULL + now.tv_nsec / 1000;
+}
+
+int pollTimeout(uint64_t usec)
+{
+    if (usec == uint64_t(-1)) {
+        return -1;
+    }
+    return std::min<uint64_t>((usec + 999) / 1000, INT_MAX);
+}
+
+SdJournalSource::SdJournalSource(sd_journal *journal) :
+    m_journal(journal)
+{
+}
+
+SdJournalSource::~SdJournalSource()
+{
+    sd_journal_close(m_journal);
+}
+
+int SdJournalSource::seekHead()
+{
+    return sd_journal_seek_head(m_journal);
+}
+
+int SdJournalSource::seekTail()
+{
+    return sd_journal_seek_tail(m_journal);
+}
+
+int SdJournalSource::seekRealtime(uint64_t usec)
+{
+    return sd_journal_seek_realtime_usec(m_journal, usec);
+}
+
+int SdJournalSource::seekCursor(const std::string &cursor)
+{
+    return sd_journal_seek_cursor(m_journal, cursor.c_str());
+}
+
+int SdJournalSource::testCursor(const std::string &cursor)
+{
+    return sd_journal_test_cursor(m_journal, cursor.c_str());
+}
+
+int SdJournalSource::cursor(std::string *cursor)
+{
+    char *text = nullptr;
+    const int ret = sd_journal_get_cursor(m_journal, &text);
+    if (ret < 0) {
+        return ret;
+    }
+    *cursor = text;
+    free(text);
+    return 0;
+}
+
+int SdJournalSource::next()
+{
+    return sd_journal_next(m_journal);
+}
+
+int SdJournalSource::previous()
+{
+    return sd_journal_previous(m_journal);
+}
+
+int SdJournalSource::previousSkip(uint64_t count)
+{
+    return sd_journal_previous_skip(m_journal, count);
+}
+
+int SdJournalSource::realtime(uint64_t *usec)
+{
+    return sd_journal_get_realtime_usec(m_journal, usec);
+}
+
+int SdJournalSource::monotonic(uint64_t *usec)
+{
+    // Without the boot id it fails for anything not from the current boot
+    sd_id128_t bootId;
+    return sd_journal_get_monotonic_usec(m_journal, usec, &bootId);
+}
+
+int SdJournalSource::data(const char *field, std::string_view *value)
+{
+    const void *data = nullptr;
+    size_t length = 0;
+    int ret = -EAGAIN;
+    for (int retries = 0; retries < 10 && ret == -EAGAIN; retries++) {
+        ret = sd_journal_get_data(m_journal, field, &data, &length);
+    }
+    if (ret < 0) {
+        return ret;
+    }
+
+    // + 1 since the data is returned as FIELD=whatwewant
+    const size_t fieldLength = strlen(field) + 1;
+    if (length < fieldLength) {
+        return -EBADMSG;
+    }
+    *value = std::string_view(static_cast<const char*>(data) + fieldLength, length - fieldLength);
+    return 0;
+}
+
+void SdJournalSource::restartData()
+{
+    sd_journal_restart_data(m_journal);
+}
+
+int SdJournalSource::enumerateData(std::string_view *name, std::string_view *value)
+{
+    const void *data = nullptr;
+    size_t length = 0;
+    const int ret = sd_journal_enumerate_data(m_journal, &data, &length);
+    if (ret <= 0) {
+        return ret;
+    }
+    const std::string_view field(static_cast<const char*>(data), length);
+    const size_t separator = field.find('=');
+    if (separator == std::string_view::npos) {
+        return -EBADMSG;
+    }
+    *name = field.substr(0, separator);
+    *value = field.substr(separator + 1);
+    return 1;
+}
+
+int SdJournalSource::wait(uint64_t timeout)
+{
+    return sd_journal_wait(m_journal, timeout);
+}
+
+int SdJournalSource::setDataThreshold(size_t size)
+{
+    return sd_journal_set_data_threshold(m_journal, size);
+}
+
+int SdJournalSource::uniqueValues(const char *field, std::vector<std::string> *values)
+{
+    int ret = sd_journal_query_unique(m_journal, field);
+    if (ret < 0) {
+        return ret;
+    }
+    const size_t prefix = strlen(field) + 1;
+    const void *data;
+    size_t length;
+    while ((ret = sd_journal_enumerate_unique(m_journal, &data, &length)) > 0) {
+        if (length > prefix) {
+            values->emplace_back(static_cast<const char*>(data) + prefix, length - prefix);
+        }
+    }
+    return ret;
+}
+
+int SdJournalSource::fetchEntry(Entry *entry, FieldMask fields)
+{
+    int ret = sd_journal_get_realtime_usec(m_journal, &entry->realtime);
+    if (ret < 0) {
+        return ret;
+    }
+
+    // sd_journal_get_seqnum() is too new to rely on
+    if (fields & FieldSeqnum) {
+        char *cursor = nullptr;
+        if (sd_journal_get_cursor(m_journal, &cursor) >= 0) {
+            parseCursorSeqnum(cursor, entry);
+            free(cursor);
+        }
+    }
+
+    for (const EntryFieldInfo &info : entryFields) {
+        const bool fallback =
+            (info.bit == FieldAuditLoginUid && (fields & FieldUid) && entry->uid.empty()) ||
+            (info.bit == FieldComm && (fields & FieldIdentifier) && entry->identifier.empty());
+        if (!(fields & info.bit) && !fallback) {
+            continue;
+        }
+
+        std::string_view value;
+        ret = data(info.name, &value);
+        if (ret == -ENOENT) { // Field does not exist
+            continue;
+        }
+        if (ret == -EAGAIN) {
+            printf("Timeout fetching field %s\n", info.name);
+            continue;
+        }
+        if (ret < 0) {
+            printf("Failed to fetch field %s (%s)\n", info.name, strerror(-ret));
+            continue;
+        }
+        (entry->*info.member).assign(value);
+    }
+
+    return 0;
+}
+
+int RecordSource::seekHead()
+{
+    m_haveCurrent = false;
+    m_boundary = firstRecord();
+    return 0;
+}
+
+int RecordSource::seekTail()
+{
+    m_haveCurrent = false;
+    m_boundary = recordCount();
+    return 0;
+}
+
+int RecordSource::seekRealtime(uint64_t usec)
+{
+    // First entry at or after usec
+    uint64_t begin = firstRecord();
+    uint64_t end = recordCount();
+    while (begin < end) {
+        const uint64_t middle = begin + (end - begin) / 2;
+        if (record(middle).realtime < usec) {
+            begin = middle + 1;
+        } else {
+            end = middle;
+        }
+    }
+    m_haveCurrent = false;
+    m_boundary = begin;
+    return 0;
+}
+
+std::string RecordSource::recordCursor(uint64_t index)
+{
+    const Record &entry = record(index);
+    if (!entry.cursor.empty()) {
+        return entry.cursor;
+    }
+    char cursor[32];
+    snprintf(cursor, sizeof cursor, "i=%" PRIx64, index);
+    return cursor;
+}
+
+int RecordSource::seekCursor(const std::string &cursor)
+{
+    const uint64_t count = recordCount();
+
+    // Our own cursors say where they are, otherwise it has to be searched for
+    uint64_t index = count;
+    if (cursor.compare(0, 2, "i=") == 0) {
+        char *end = nullptr;
+        index = strtoull(cursor.c_str() + 2, &end, 16);
+        if (!end || *end != '\0' || index < firstRecord() || index >= count || recordCursor(index) != cursor) {
+            index = count;
+        }
+    }
+    for (uint64_t i = count; index == count && i > firstRecord(); i--) {
+        if (recordCursor(i - 1) == cursor) {
+            index = i - 1;
+        }
+    }
+    if (index == count) {
+        return -ENOENT;
+    }
+
+    m_haveCurrent = false;
+    m_boundary = index;
+    return 0;
+}
+
+int RecordSource::testCursor(const std::string &cursor)
+{
+    if (!m_haveCurrent) {
+        return -EADDRNOTAVAIL;
+    }
+    return recordCursor(m_current) == cursor;
+}
+
+int RecordSource::cursor(std::string *cursor)
+{
+    if (!m_haveCurrent) {
+        return -EADDRNOTAVAIL;
+    }
+    *cursor = recordCursor(m_current);
+    return 0;
+}
+
+int RecordSource::next()
+{
+    const uint64_t index = m_haveCurrent ? m_current + 1 : m_boundary;
+    if (index >= recordCount()) {
+        return 0;
+    }
+    m_current = index;
+    m_haveCurrent = true;
+    m_nextField = 0;
+    return 1;
+}
+
+int RecordSource::previous()
+{
+    const uint64_t index = m_haveCurrent ? m_current : m_boundary;
+    if (index <= firstRecord()) {
+        return 0;
+    }
+    m_current = index - 1;
+    m_haveCurrent = true;
+    m_nextField = 0;
+    return 1;
+}
+
+int RecordSource::realtime(uint64_t *usec)
+{
+    if (!m_haveCurrent) {
+        return -EADDRNOTAVAIL;
+    }
+    *usec = record(m_current).realtime;
+    return 0;
+}
+
+int RecordSource::monotonic(uint64_t *usec)
+{
+    std::string_view value;
+    const int ret = data("__MONOTONIC_TIMESTAMP", &value);
+    if (ret < 0) {
+        return ret == -ENOENT ? -ENODATA : ret;
+    }
+    return parseNumber(value, usec) ? 0 : -EBADMSG;
+}
+
+int RecordSource::data(const char *field, std::string_view *value)
+{
+    if (!m_haveCurrent) {
+        return -EADDRNOTAVAIL;
+    }
+    for (const auto &[name, fieldValue] : record(m_current).fields) {
+        if (name == field) {
+            *value = fieldValue;
+            return 0;
+        }
+    }
+    return -ENOENT;
+}
+
+void RecordSource::restartData()
+{
+    m_nextField = 0;
+}
+
+int RecordSource::enumerateData(std::string_view *name, std::string_view *value)
+{
+    if (!m_haveCurrent) {
+        return -EADDRNOTAVAIL;
+    }
+    const Record &current = record(m_current);
+    while (m_nextField < current.fields.size()) {
+        const auto &[fieldName, fieldValue] = current.fields[m_nextField++];
+        if (fieldName.compare(0, 2, "__") == 0) {
+            continue;
+        }
+        *name = fieldName;
+        *value = fieldValue;
+        return 1;
+    }
+    return 0;
+}
+
+int RecordSource::fetchEntry(Entry *entry, FieldMask fields)
+{
+    if (!m_haveCurrent) {
+        return -EADDRNOTAVAIL;
+    }
+    const Record &current = record(m_current);
+    entry->realtime = current.realtime;
+    if (fields & FieldSeqnum) {
+        parseCursorSeqnum(current.cursor, entry);
+    }
+
+    // Looking for the fallbacks first would be slower than just filling them
+    fields = withFallbacks(fields);
+    for (const auto &[name, value] : current.fields) {
+        entry->setField(name, value, fields);
+    }
+    return 0;
+}
+
+ExportSource::ExportSource(int fd) :
+    m_fd(fd)
+{
+}
+
+int ExportSource::open()
+{
+    // The history is whatever comes before the stream goes quiet, like the
+    // backlog before journalctl -f starts waiting
+    constexpr uint64_t idleTimeout = 100 * 1000;
+    // A busy stream never goes quiet, so when following the rest is read
+    // as new entries after a while
+    constexpr uint64_t followHistoryTime = 1000 * 1000;
+    const uint64_t deadline = m_historyLimit > 0 ? monotonicUsec() + followHistoryTime : uint64_t(-1);
+    while (!m_eof && monotonicUsec() < deadline) {
+        pollfd pfd = { m_fd, POLLIN, 0 };
+        const int ready = poll(&pfd, 1, pollTimeout(idleTimeout));
+        if (ready < 0 && errno != EINTR) {
+            return -errno;
+        }
+        if (ready == 0) {
+            break;
+        }
+        const int ret = readAvailable();
+        if (ret < 0) {
+            return ret;
+        }
+    }
+    m_opened = true;
+    return 0;
+}
+
+int ExportSource::wait(uint64_t timeout)
+{
+    // Like a journal nobody writes to anymore
+    if (m_eof) {
+        poll(nullptr, 0, pollTimeout(timeout));
+        return SD_JOURNAL_NOP;
+    }
+
+    // Only waiting when following, so everything before the current entry
+    // has been shown and isn't needed anymore
+    while (!m_records.empty() && m_firstIndex < position()) {
+        m_records.pop_front();
+        m_firstIndex++;
+    }
+
+    pollfd pfd = { m_fd, POLLIN, 0 };
+    int ret = poll(&pfd, 1, pollTimeout(timeout));
+    if (ret < 0) {
+        return errno == EINTR ? SD_JOURNAL_NOP : -errno;
+    }
+    if (ret == 0) {
+        return SD_JOURNAL_NOP;
+    }
+    ret = readAvailable();
+    if (ret < 0) {
+        return ret;
+    }
+    return ret > 0 ? SD_JOURNAL_APPEND : SD_JOURNAL_NOP;
+}
+
+int ExportSource::readAvailable()
+{
+    // Only reads when poll() says it won't block, so we don't have to mess
+    // with O_NONBLOCK on someone else's stdin
+    char buffer[64 * 1024];
+    // So the entries from a stream that keeps coming get shown on the way
+    constexpr size_t maxRead = 4 * 1024 * 1024;
+    size_t readSize = 0;
+    int added = 0;
+    while (!m_eof && readSize < maxRead) {
+        pollfd pfd = { m_fd, POLLIN, 0 };
+        const int ready = poll(&pfd, 1, 0);
+        if (ready < 0 && errno != EINTR) {
+            return -errno;
+        }
+        if (ready <= 0) {
+            break;
+        }
+
+        const ssize_t size = read(m_fd, buffer, sizeof buffer);
+        if (size < 0) {
+            if (errno == EINTR || errno == EAGAIN) {
+                continue;
+            }
+            return -errno;
+        }
+        if (size == 0) {
+            m_eof = true;
+            break;
+        }
+        readSize += size;
+        m_buffer.append(buffer, size);
+        // As it comes, so only the entries are kept and not the whole stream
+        added += parseBuffer();
+    }
+
+    if (m_eof) {
+        // The last entry doesn't need the empty line after it
+        if (m_buffer.empty() && !m_pending.fields.empty()) {
+            addRecord();
+            added++;
+        } else if (!m_buffer.empty()) {
+            printf("Ignoring %zu bytes of incomplete entry at the end of the export stream\n", m_buffer.size());
+            m_buffer.clear();
+        }
+    }
+    return added;
+}
+
+void ExportSource::addRecord()
+{
+    m_records.push_back(std::move(m_pending));
+    m_pending.clear();
+    // Nothing has looked at the history yet
+    if (!m_opened && m_historyLimit > 0 && m_records.size() > m_historyLimit) {
+        m_records.pop_front();
+        m_firstIndex++;
+    }
+}
+
+int ExportSource::parseBuffer()
+{
+    int added = 0;
+    size_t position = 0;
+    while (position < m_buffer.size()) {
+        const size_t lineEnd = m_buffer.find('\n', position);
+        if (lineEnd == std::string::npos) {
+            break;
+        }
+        const std::string_view line(m_buffer.data() + position, lineEnd - position);
+
+        // An empty line ends the entry
+        if (line.empty()) {
+            if (!m_pending.fields.empty()) {
+                addRecord();
+                added++;
+            }
+            position = lineEnd + 1;
+            continue;
+        }
+
+        std::string_view name;
+        std::string_view value;
+        const size_t equals = line.find('=');
+        if (equals != std::string_view::npos) {
+            name = line.substr(0, equals);
+            value = line.substr(equals + 1);
+            position = lineEnd + 1;
+        } else {
+            // Binary fields are the name, a newline, the size as le64, the
+            // data and a newline
+            const size_t dataStart = lineEnd + 1 + sizeof(uint64_t);
+            if (dataStart > m_buffer.size()) {
+                break;
+            }
+            uint64_t size;
+            memcpy(&size, m_buffer.data() + lineEnd + 1, sizeof size);
+            size = le64toh(size);
+            if (size > m_buffer.size() - dataStart) {
+                break;
+            }
+            if (size == m_buffer.size() - dataStart) {
+                break; // Need the newline after it as well
+            }
+            if (m_buffer[dataStart + size] != '\n') {
+                printf("Invalid binary field %.*s in export stream\n", int(line.size()), line.data());
+                m_buffer.clear();
+                m_pending.clear();
+                return added;
+            }
+            name = line;
+            value = std::string_view(m_buffer.data() + dataStart, size);
+            position = dataStart + size + 1;
+        }
+
+        if (name == "__CURSOR") {
+            m_pending.cursor.assign(value);
+        } else if (name == "__REALTIME_TIMESTAMP") {
+            parseNumber(value, &m_pending.realtime);
+        }
+        m_pending.fields.emplace_back(name, value);
+    }
+    m_buffer.erase(0, position);
+    return added;
+}
@@ -0,0 +1,220 @@
+#pragma once
+
+#include "entry.h"
+
+extern "C" {
+#include <systemd/sd-journal.h>
+} // extern "C"
+
+#include <cstdint>
+#include <deque>
+#include <string>
+#include <string_view>
+#include <utility>
+#include <vector>
+
+// Where run() gets its entries from, so it works the same on a real journal,
+// an export stream or generated entries. Modelled on the sd_journal API:
+// moving returns 1 if it moved, 0 at the end and a negative errno on errors,
+// the rest returns 0 or a negative errno, and wait() returns SD_JOURNAL_NOP,
+// SD_JOURNAL_APPEND or SD_JOURNAL_INVALIDATE.
+class JournalSource
+{
+public:
+    virtual ~JournalSource() = default;
+
+    virtual int seekHead() = 0;
+    virtual int seekTail() = 0;
+    virtual int seekRealtime(uint64_t usec) = 0;
+    // next() lands on the entry with the cursor, if it's still there
+    virtual int seekCursor(const std::string &cursor) = 0;
+    // Positive if the current entry is the one with the cursor
+    virtual int testCursor(const std::string &cursor) = 0;
+    virtual int cursor(std::string *cursor) = 0;
+
+    virtual int next() = 0;
+    virtual int previous() = 0;
+    // Returns how many entries it moved back
+    virtual int previousSkip(uint64_t count);
+
+    virtual int realtime(uint64_t *usec) = 0;
+    virtual int monotonic(uint64_t *usec) = 0;
+
+    // The value of a single field in the current entry, without the FIELD=,
+    // or -ENOENT if it doesn't have it. Only valid until the next call.
+    virtual int data(const char *field, std::string_view *value) = 0;
+
+    // Goes through all the fields in the current entry, like
+    // sd_journal_enumerate_data() but with the name split off. Returns 1 if
+    // there was one, 0 at the end.
+    virtual void restartData() = 0;
+    virtual int enumerateData(std::string_view *name, std::string_view *value) = 0;
+
+    // Fills in the fields asked for, plus _AUDIT_LOGINUID and _COMM when
+    // they're needed in place of _UID and SYSLOG_IDENTIFIER.
+    int readEntry(Entry *entry, FieldMask fields);
+
+    // timeout is in usec, -1 waits forever
+    virtual int wait(uint64_t timeout) = 0;
+    // True if no more entries can show up, so there's no point in following
+    virtual bool isFinished() const { return false; }
+
+protected:
+    // Can fail with -EAGAIN, readEntry() retries a few times
+    virtual int fetchEntry(Entry *entry, FieldMask fields) = 0;
+};
+
+// For passing wait() timeouts on to poll()
+int pollTimeout(uint64_t usec);
+
+// Goes through libsystemd
+class SdJournalSource : public JournalSource
+{
+public:
+    // Takes ownership of the journal
+    explicit SdJournalSource(sd_journal *journal);
+    ~SdJournalSource() override;
+
+    SdJournalSource(const SdJournalSource &) = delete;
+    SdJournalSource &operator=(const SdJournalSource &) = delete;
+
+    int seekHead() override;
+    int seekTail() override;
+    int seekRealtime(uint64_t usec) override;
+    int seekCursor(const std::string &cursor) override;
+    int testCursor(const std::string &cursor) override;
+    int cursor(std::string *cursor) override;
+
+    int next() override;
+    int previous() override;
+    int previousSkip(uint64_t count) override;
+
+    int realtime(uint64_t *usec) override;
+    int monotonic(uint64_t *usec) override;
+    int data(const char *field, std::string_view *value) override;
+    void restartData() override;
+    int enumerateData(std::string_view *name, std::string_view *value) override;
+    int wait(uint64_t timeout) override;
+
+    // Fields are truncated to 64k by default
+    int setDataThreshold(size_t size);
+
+    // Every value of the field in the journal, without the "FIELD="
+    int uniqueValues(const char *field, std::vector<std::string> *values);
+
+protected:
+    int fetchEntry(Entry *entry, FieldMask fields) override;
+
+private:
+    sd_journal *m_journal;
+};
+
+// A journal entry as a list of raw fields, for the sources that don't have a
+// journal file underneath.
+struct Record {
+    uint64_t realtime = 0;
+    // Empty if the source didn't have one, then it's made from the position
+    std::string cursor;
+    std::vector<std::pair<std::string, std::string>> fields;
+
+    void clear()
+    {
+        realtime = 0;
+        cursor.clear();
+        fields.clear();
+    }
+};
+
+// Common base for sources that can get an entry by its position, which
+// handles all the seeking and moving around.
+class RecordSource : public JournalSource
+{
+public:
+    int seekHead() override;
+    int seekTail() override;
+    int seekRealtime(uint64_t usec) override;
+    int seekCursor(const std::string &cursor) override;
+    int testCursor(const std::string &cursor) override;
+    int cursor(std::string *cursor) override;
+
+    int next() override;
+    int previous() override;
+
+    int realtime(uint64_t *usec) override;
+    int monotonic(uint64_t *usec) override;
+    int data(const char *field, std::string_view *value) override;
+    // Skips the __CURSOR, __REALTIME_TIMESTAMP etc. from export streams
+    void restartData() override;
+    int enumerateData(std::string_view *name, std::string_view *value) override;
+
+protected:
+    int fetchEntry(Entry *entry, FieldMask fields) override;
+
+    // Number of entries available right now, can grow in wait()
+    virtual uint64_t recordCount() const = 0;
+    // Only valid until the next call
+    virtual const Record &record(uint64_t index) = 0;
+    // The ones before it have been dropped
+    virtual uint64_t firstRecord() const { return 0; }
+
+    // The first entry that can still be needed, the ones before it have
+    // either been shown, or are only there for moving back
+    uint64_t position() const { return m_haveCurrent ? m_current : m_boundary; }
+
+private:
+    // The cursor from the record, or one made from the position
+    std::string recordCursor(uint64_t index);
+
+    // Like JournalFileSet: entries before boundary are "before" the current
+    // location, and current is only valid after moving.
+    bool m_haveCurrent = false;
+    uint64_t m_current = 0;
+    uint64_t m_boundary = 0;
+
+    size_t m_nextField = 0;
+};
+
+// Reads the journal export format, e.g. from journalctl -o export. It keeps
+// what it has read, so it can move backwards like the others, but when
+// following only the end of the history and what hasn't been shown yet.
+// https://systemd.io/JOURNAL_EXPORT_FORMATS/
+class ExportSource : public RecordSource
+{
+public:
+    // Doesn't take ownership of the fd
+    explicit ExportSource(int fd);
+
+    // Only keeps the last entries of the history read by open(), for
+    // following a stream that doesn't end. 0 keeps everything.
+    void setHistoryLimit(uint64_t entries) { m_historyLimit = entries; }
+
+    // Reads until the end, or until nothing has come for a while. With a
+    // history limit at most for a second, the rest is left for wait().
+    int open();
+
+    int wait(uint64_t timeout) override;
+    bool isFinished() const override { return m_eof; }
+
+protected:
+    uint64_t recordCount() const override { return m_firstIndex + m_records.size(); }
+    const Record &record(uint64_t index) override { return m_records[index - m_firstIndex]; }
+    uint64_t firstRecord() const override { return m_firstIndex; }
+
+private:
+    void addRecord();
+
+    // Returns the number of entries added, or a negative errno
+    int readAvailable();
+    // Parses the complete entries in m_buffer, returns how many there were
+    int parseBuffer();
+
+    int m_fd;
+    bool m_eof = false;
+    std::string m_buffer;
+    Record m_pending;
+    std::deque<Record> m_records;
+    // The index of the first one in m_records
+    uint64_t m_firstIndex = 0;
+    uint64_t m_historyLimit = 0;
+    bool m_opened = false;
+};
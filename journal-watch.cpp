@@ -1,202 +1,1014 @@
 extern "C" {
 #include <errno.h>
+#include <fcntl.h>
+#include <getopt.h>
+#include <grp.h>
 #include <limits.h>
 #include <stdbool.h>
 #include <stdio.h>
 #include <stdlib.h>
+#include <string.h>
 #include <sys/epoll.h>
 #include <sys/types.h>
-#include <pwd.h>
 #include <unistd.h>
 #include <systemd/sd-journal.h>
 } // extern "C"
 
+#include "arrow-format.h"
+#include "bloom-index.h"
+#include "catalog.h"
+#include "control-socket.h"
+#include "count-table.h"
+#include "entry.h"
+#include "entry-format.h"
+#include "export-format.h"
+#include "filter.h"
+#include "generated-source.h"
+#include "header-cache.h"
+#include "journal-file.h"
+#include "journal-source.h"
+#include "loss-detector.h"
+#include "process-info.h"
+#include "reassembly.h"
+#include "replay.h"
+#include "text-index.h"
+#include "thread-pool.h"
+#include "wait-condition.h"
+
+#include <algorithm>
+#include <atomic>
+#include <cinttypes>
+#include <cmath>
 #include <ctime>
+#include <memory>
 #include <string>
-#include <iostream>
-#include <iomanip>
-
-enum LogLevel {
-    Emergency = 0,
-    Alert = 1,
-    Critical = 2,
-    Error = 3,
-    Warning = 4,
-    Notice = 5,
-    Informational = 6,
-    Debug = 7
-};
-namespace Color {
-    const char *brightGray = "\033[00;37m";
+#include <string_view>
+#include <type_traits>
+#include <vector>
+
+struct Options {
+    // Negative means everything
+    long lines = 20;
+    bool follow = true;
+    bool native = false;
+    // 0 means one per core
+    unsigned threads = 0;
+
+    // Realtime in usec
+    uint64_t since = 0;
+    uint64_t until = UINT64_MAX;
+
+    std::string grep;
+    Filter filter;
+    // Newest first, stopping after maxResults (if not negative) matches
+    bool reverse = false;
+    long maxResults = -1;
+
+    // Show the entries with the same time between them as when they were
+    // logged, this many times faster. 0 for not replaying, infinite for as
+    // fast as possible.
+    double replaySpeed = 0;
+
+    // Join up the lines of stack traces that are logged at most this far
+    // apart (in usec), 0 for not
+    uint64_t reassembleWindow = 0;
+
+    // Show the command line, parent and container of processes that are
+    // still running
+    bool processInfo = false;
+    // Show the group and the login session as well as the user
+    bool identity = false;
+    // Show the explanations from the message catalog, like journalctl -x
+    bool catalog = false;
+    // Show where journald dropped entries or didn't write them because of
+    // rate limiting, which needs to see every entry
+    bool showLoss = false;
 
-    const char *white = "\033[00;39m";
-    const char *brightWhite = "\033[01;39m";
+    // Exit as soon as an entry with waitFor or failOn in the message is shown,
+    // or after timeout (in usec, 0 for never), see WaitCondition
+    std::string waitFor;
+    std::string failOn;
+    uint64_t timeout = 0;
 
-    const char *blue = "\033[00;34m";
-    const char *brightBlue = "\033[01;34m";
+    // Unix socket for changing the filters and the output while following
+    std::string controlPath;
 
-    const char *green = "\033[00;32m";
-    const char *brightGreen = "\033[01;32m";
+    // Print counts instead of the entries, bucket is in usec (0 for no buckets)
+    CountField countBy = CountByNothing;
+    uint64_t bucket = 0;
 
-    const char *yellow = "\033[00;93m";
-    const char *brightYellow = "\033[01;33m";
+    // What needs to be read from each entry for the output and filters
+    FieldMask fields = 0;
 
-    const char *orange = "\033[00;33m";
-    const char *red = "\033[00;31m";
-    const char *brightRed = "\033[00;101m";
+    enum IndexType {
+        NoIndex,
+        WordIndex,
+        BloomFilters
+    };
+    IndexType buildIndex = NoIndex;
 
-    const char *reset = "\033[0m";
+    std::string directory;
+    std::vector<std::string> files;
+    std::string journalNamespace;
+
+    enum Format {
+        ShortFormat,
+        JournalFormat,
+        ExportFormat,
+        ArrowFormat
+    };
+    // Short is what print_journal_message() prints, Arrow is only for output
+    Format output = ShortFormat;
+    // Export reads from stdin, or the one --file
+    Format input = JournalFormat;
+
+    // Read made up entries instead of a journal
+    bool generate = false;
+    GeneratorOptions generator;
 };
 
-static std::string getUsername(const std::string &uidString)
+static bool matches(const Options &options, const Entry &entry)
+{
+    return (options.grep.empty() || entry.message.find(options.grep) != std::string::npos) && options.filter.matches(entry);
+}
+
+// Set up by main() for the Arrow output, which has to be finished after the
+// last entry
+static ArrowWriter *arrowOutput = nullptr;
+// Same for --reassemble
+static Reassembler *reassembler = nullptr;
+static ProcessCache *processes = nullptr;
+static Catalog *messageCatalog = nullptr;
+static LossDetector *lossDetector = nullptr;
+static WaitCondition *waitCondition = nullptr;
+// Shared by the --native decoding and the Arrow encoding, so they don't both
+// start a thread per core
+static ThreadPool *threadPool = nullptr;
+
+// The short and Arrow output, after the stack traces have been put together
+static void showAssembled(const Entry &entry, const Options &options)
+{
+    if (reassembler && !options.grep.empty() && entry.message.find(options.grep) == std::string::npos) {
+        return;
+    }
+    if (options.output == Options::ArrowFormat) {
+        // Errors are reported by finish()
+        arrowOutput->add(entry);
+        return;
+    }
+    print_journal_message(entry, options.processInfo ? processes->lookup(entry) : nullptr, options.identity, options.grep);
+}
+
+// Which entries go on to be shown. With --reassemble the lines after the first
+// one of a trace don't have the --grep pattern, so it's checked on the whole
+// trace in showAssembled() instead.
+static bool passesOn(const Options &options, const Entry &entry)
+{
+    return reassembler ? options.filter.matches(entry) : matches(options, entry);
+}
+
+// Once --wait-for, --fail-on or --timeout have decided, nothing more is shown
+// and everything returns up to main()
+static bool waitDecided()
+{
+    return waitCondition && waitCondition->isDecided();
+}
+
+template<typename Source>
+static void showExported(Source *source)
+{
+    // Written in one go, and reused so it doesn't allocate for every entry
+    static std::string buffer;
+    buffer.clear();
+    const int ret = appendExportEntry(source, &buffer);
+    if (ret < 0) {
+        printf("Failed to export entry: %s\n", strerror(-ret));
+        return;
+    }
+    fwrite(buffer.data(), 1, buffer.size(), stdout);
+}
+
+// Works on both a JournalSource and the JournalFileSet from --native, which
+// have to be on the entry for the export output and --catalog.
+template<typename Source>
+static void showEntry(Source *source, Entry &entry, const Options &options)
 {
-    long uid = -1;
-    try {
-        uid = stol(uidString);
-    } catch (const std::exception &) {
-        // conversion failed
-        return uidString;
+    if (options.output == Options::ExportFormat) {
+        showExported(source);
+    } else {
+        if (messageCatalog) {
+            messageCatalog->explain(source, &entry);
+        }
+        if (lossDetector && lossDetector->hasPending()) {
+            // Before anything that's held back, which came before it
+            if (reassembler) {
+                reassembler->flushAll();
+            }
+            lossDetector->showPending(entry);
+        }
+        if (reassembler) {
+            reassembler->add(entry);
+        } else {
+            showAssembled(entry, options);
+        }
+    }
+
+    // After it's shown, so the script's log has the line it stopped at
+    if (waitCondition) {
+        waitCondition->check(entry);
     }
-    if (uid < 0) {
-        return uidString;
+}
+
+static bool hasFilter(const Options &options)
+{
+    return !options.grep.empty() || !options.filter.isEmpty();
+}
+
+static void printNewEntries(JournalSource *source, Entry *entry, const Options &options, ReplayClock *replay = nullptr)
+{
+    int ret;
+    while ((ret = source->next()) > 0) {
+        if (source->readEntry(entry, options.fields) < 0) {
+            continue;
+        }
+        if (entry->realtime > options.until) {
+            return;
+        }
+        if (lossDetector) {
+            lossDetector->check(*entry);
+        }
+        if (!passesOn(options, *entry)) {
+            continue;
+        }
+        if (replay && !replay->isDue(entry->realtime)) {
+            // Get what's already shown out before sleeping
+            fflush(stdout);
+            ret = replay->waitUntilDue(entry->realtime);
+            if (ret < 0) {
+                printf("Failed to wait for the next entry: %s\n", strerror(-ret));
+                return;
+            }
+        }
+        showEntry(source, *entry, options);
+        if (waitDecided()) {
+            return;
+        }
+    }
+    if (ret < 0) {
+        printf("Failed to move forward in journal: %s\n", strerror(-ret));
+    }
+}
+
+static bool hasTimeRange(const Options &options)
+{
+    return options.since > 0 || options.until != UINT64_MAX;
+}
+
+static std::vector<std::string> journalPaths(const Options &options)
+{
+    std::vector<std::string> paths = options.files;
+    if (!options.directory.empty()) {
+        paths = journalFilesInDirectory(options.directory);
+    } else if (paths.empty()) {
+        paths = localJournalFiles(options.journalNamespace);
+    }
+    if (hasTimeRange(options)) {
+        paths = selectJournalFiles(paths, options.since, options.until);
+    }
+    return paths;
+}
+
+// Keeps only the candidates that are in both. Past what an index covers every
+// entry is a candidate.
+static void intersectCandidates(std::vector<PositionRange> *ranges, uint64_t *covered,
+        std::vector<PositionRange> other, uint64_t otherCovered)
+{
+    std::vector<PositionRange> mine = std::move(*ranges);
+    mine.push_back({ *covered, UINT64_MAX });
+    other.push_back({ otherCovered, UINT64_MAX });
+    *covered = std::max(*covered, otherCovered);
+
+    ranges->clear();
+    size_t i = 0, j = 0;
+    while (i < mine.size() && j < other.size()) {
+        const uint64_t begin = std::max(mine[i].begin, other[j].begin);
+        const uint64_t end = std::min({ mine[i].end, other[j].end, *covered });
+        if (begin < end) {
+            ranges->push_back({ begin, end });
+        }
+        if (mine[i].end < other[j].end) {
+            i++;
+        } else {
+            j++;
+        }
+    }
+}
+
+// Narrows down which entries to look at with the indexes from --build-index,
+// for the --grep pattern and for a --filter on the identifier
+static void useIndexes(JournalFileSet *journals, const Options &options)
+{
+    std::vector<std::string> identifiers;
+    const bool byIdentifier = options.filter.requiredIdentifiers(&identifiers);
+    // The rest of a trace doesn't have the pattern, but has to be read
+    const bool byPattern = !options.grep.empty() && !reassembler;
+    if (!byPattern && !byIdentifier) {
+        return;
+    }
+
+    for (size_t i = 0; i < journals->fileCount(); i++) {
+        // Only loaded if it's needed
+        BloomIndex filters(journals->file(i)->fileId());
+        int haveFilters = -1;
+        auto loadFilters = [&]() {
+            if (haveFilters < 0) {
+                haveFilters = filters.load() >= 0 && filters.coveredEntries() > 0;
+            }
+            return haveFilters == 1;
+        };
+        std::vector<PositionRange> ranges;
+        uint64_t covered = 0;
+
+        if (byPattern) {
+            TextIndex index(journals->file(i)->fileId());
+            std::vector<uint64_t> positions;
+            if (index.load() >= 0 && index.coveredEntries() > 0 && index.candidates(options.grep, &positions)) {
+                for (const uint64_t position : positions) {
+                    if (!ranges.empty() && ranges.back().end == position) {
+                        ranges.back().end++;
+                    } else {
+                        ranges.push_back({ position, position + 1 });
+                    }
+                }
+                covered = index.coveredEntries();
+            } else if (loadFilters() && filters.candidates(options.grep, &ranges)) {
+                // Not as exact, but skips whole chunks without decoding anything in them
+                covered = filters.coveredEntries();
+            }
+        }
+
+        // Only the Bloom filters have the identifiers
+        if (byIdentifier && loadFilters()) {
+            std::vector<PositionRange> identifierRanges;
+            filters.identifierCandidates(identifiers, &identifierRanges);
+            if (covered == 0) {
+                ranges = std::move(identifierRanges);
+                covered = filters.coveredEntries();
+            } else {
+                intersectCandidates(&ranges, &covered, std::move(identifierRanges), filters.coveredEntries());
+            }
+        }
+
+        if (covered > 0) {
+            journals->setCandidates(i, std::move(ranges), covered);
+        }
+    }
+}
+
+static void printCounts(const CountTable &counts, const Options &options)
+{
+    std::vector<CountTable::Row> rows = counts.rows();
+    int width = 3;
+    for (CountTable::Row &row : rows) {
+        if (options.countBy == CountByUser && !row.key.empty()) {
+            uint32_t uid;
+            if (!parseNumber(row.key, &uid)) {
+                uid = InvalidId;
+            }
+            row.key = getUsername(uid, row.key);
+        }
+        if (row.key.empty()) {
+            row.key = "-";
+        }
+        width = std::max(width, int(row.key.size()));
+    }
+
+    if (options.bucket) {
+        printf("%-19s  ", "TIME");
+    }
+    printf("%-*s %10s %12s\n", width, "KEY", "ENTRIES", "BYTES");
+    for (const CountTable::Row &row : rows) {
+        if (options.bucket) {
+            const time_t sec = row.bucket / 1000000;
+            std::tm tm;
+            localtime_r(&sec, &tm);
+            char time[32];
+            strftime(time, sizeof time, "%Y-%m-%d %H:%M:%S", &tm);
+            printf("%-19s  ", time);
+        }
+        printf("%-*s %10" PRIu64 " %12" PRIu64 "\n", width, row.key.c_str(), row.counter.entries, row.counter.bytes);
+    }
+}
+
+// Counts through libsystemd (or any other source)
+static int countEntries(JournalSource *source, const Options &options)
+{
+    int ret = options.since > 0 ? source->seekRealtime(options.since) : source->seekHead();
+    if (ret < 0) {
+        printf("Failed to seek in system journal: %s\n", strerror(-ret));
+        return -ret;
+    }
+
+    CountTable counts(options.countBy, options.bucket);
+    Entry entry;
+    while ((ret = source->next()) > 0) {
+        if (source->readEntry(&entry, options.fields) < 0) {
+            continue;
+        }
+        if (entry.realtime > options.until) {
+            break;
+        }
+        if (matches(options, entry)) {
+            counts.add(entry);
+        }
+    }
+    if (ret < 0) {
+        printf("Failed to move forward in journal: %s\n", strerror(-ret));
+        return -ret;
+    }
+
+    printCounts(counts, options);
+    return 0;
+}
+
+// Order doesn't matter when counting, so the files are split into ranges of
+// entries that are counted in parallel, each thread into its own table.
+static int countNative(const Options &options)
+{
+    const std::vector<std::string> paths = journalPaths(options);
+
+    struct Range {
+        size_t file;
+        uint64_t begin;
+        uint64_t end;
+    };
+    constexpr uint64_t rangeSize = 4096;
+    std::vector<Range> ranges;
+    for (size_t i = 0; i < paths.size(); i++) {
+        JournalSummary summary;
+        if (readJournalSummary(paths[i], &summary) < 0) {
+            continue;
+        }
+        if (summary.entryCount == 0 || summary.headRealtime > options.until ||
+                (summary.state != JournalSummary::Online && summary.tailRealtime < options.since)) {
+            continue;
+        }
+        for (uint64_t begin = 0; begin < summary.entryCount; begin += rangeSize) {
+            ranges.push_back({ i, begin, std::min(begin + rangeSize, summary.entryCount) });
+        }
     }
 
-    // fuck the _r, we don't need it: no threads and very short lived
-    passwd *pw = getpwuid(uid);
-    if (!pw) {
-        return uidString;
+    const FieldMask fields = withFallbacks(options.fields);
+    ThreadPool &pool = *threadPool;
+    std::vector<CountTable> tables(pool.size(), CountTable(options.countBy, options.bucket));
+    // The readers cache things internally, so every thread maps the files itself
+    std::vector<std::vector<std::unique_ptr<JournalFile>>> files(pool.size());
+    for (std::vector<std::unique_ptr<JournalFile>> &workerFiles : files) {
+        workerFiles.resize(paths.size());
     }
-    if (strlen(pw->pw_name) == 0) {
-        return uidString;
+    std::vector<Entry> entries(pool.size());
+    std::vector<std::vector<CompressedPayload>> deferred(pool.size());
+    std::vector<std::string> scratch(pool.size());
+
+    pool.parallelFor(ranges.size(), [&](size_t index, unsigned worker) {
+        const Range &range = ranges[index];
+        std::unique_ptr<JournalFile> &journal = files[worker][range.file];
+        if (!journal) {
+            auto file = std::make_unique<JournalFile>(paths[range.file]);
+            if (file->open() < 0) {
+                return;
+            }
+            file->setFields(fields);
+            journal = std::move(file);
+        }
+
+        Entry &entry = entries[worker];
+        for (uint64_t position = range.begin; position < range.end; position++) {
+            EntryHeader header;
+            if (journal->entryHeader(position, &header) < 0) {
+                break;
+            }
+            if (header.realtime < options.since || header.realtime > options.until) {
+                continue;
+            }
+            if (journal->readEntry(position, &entry, &deferred[worker]) < 0 ||
+                    decompressDeferred(&entry, deferred[worker], &scratch[worker], fields) < 0) {
+                continue;
+            }
+            if (matches(options, entry)) {
+                tables[worker].add(entry);
+            }
+        }
+    });
+
+    for (size_t i = 1; i < tables.size(); i++) {
+        tables[0].merge(tables[i]);
     }
-    return pw->pw_name;
+    printCounts(tables[0], options);
+    return 0;
 }
 
-static std::string fetchField(sd_journal *journal, const std::string &field)
+// Same as printReverse(), the entries are few enough that decompressing on
+// this thread is fine.
+static int printNativeReverse(JournalFileSet *journals, const Options &options)
 {
-    char *message = nullptr;
-    size_t messageLength = 0ULL;
-    for (int retries = 0; retries < 10; retries++) {
-        const int ret = sd_journal_get_data(journal, field.c_str(), (const void **) &message, &messageLength);
-        if (-ret == EAGAIN) {
+    if (options.until != UINT64_MAX) {
+        journals->seekRealtime(options.until + 1);
+    } else {
+        journals->seekTail();
+    }
+
+    Entry entry;
+    long found = 0;
+    int ret = 0;
+    while ((options.maxResults < 0 || found < options.maxResults) && (ret = journals->previous()) > 0) {
+        if (journals->readEntry(&entry) < 0) {
+            continue;
+        }
+        if (entry.realtime < options.since) {
+            break;
+        }
+        if (entry.realtime > options.until || !matches(options, entry)) {
             continue;
         }
-        if (-ret == ENOENT) { // Field does not exist
-            return "";
+        showEntry(journals, entry, options);
+        found++;
+    }
+    if (ret < 0) {
+        printf("Failed to move backwards in journal files: %s\n", strerror(-ret));
+        return -ret;
+    }
+    return 0;
+}
+
+// Prints the history straight from the journal files, and returns the cursor
+// of the last entry printed so following can pick up from there.
+static int printNativeHistory(const Options &options, std::string *lastCursor)
+{
+    const std::vector<std::string> paths = journalPaths(options);
+
+    JournalFileSet journals;
+    int failed = 0;
+    int ret = journals.open(paths, &failed);
+    if (ret < 0) {
+        printf("Failed to open any journal files: %s\n", strerror(-ret));
+        return -ret;
+    }
+    if (failed > 0) {
+        printf("Skipped %d journal files that couldn't be read\n", failed);
+    }
+    const FieldMask fields = withFallbacks(options.fields);
+    journals.setFields(fields);
+    // The indexes skip entries, and --show-loss has to see them all
+    if (!options.showLoss) {
+        useIndexes(&journals, options);
+    }
+    if (options.reverse) {
+        return printNativeReverse(&journals, options);
+    }
+
+    bool haveCurrent = false;
+    if (options.since > 0) {
+        journals.seekRealtime(options.since);
+    } else if (options.lines < 0) {
+        journals.seekHead();
+    } else {
+        if (options.until != UINT64_MAX) {
+            journals.seekRealtime(options.until + 1);
+        } else {
+            journals.seekTail();
+        }
+        long moved = 0;
+        Entry entry;
+        while (moved < options.lines && (ret = journals.previous()) > 0) {
+            if (hasFilter(options) && (journals.readEntry(&entry) < 0 || !matches(options, entry))) {
+                continue;
+            }
+            moved++;
+        }
+        if (ret < 0) {
+            printf("Failed to move backwards in journal files: %s\n", strerror(-ret));
+            return -ret;
         }
+        haveCurrent = moved > 0;
+    }
+
+    // Entries are read in batches on this thread, the compressed payloads are
+    // decompressed on the pool, and then everything is printed in order. The
+    // export output and --catalog read from the file itself, so it has to be
+    // done while we're still on the entry.
+    const size_t batchSize = options.output == Options::ExportFormat || options.catalog ? 1 : 1024;
+    ThreadPool &pool = *threadPool;
+    std::vector<Entry> batch(batchSize);
+    std::vector<std::vector<CompressedPayload>> deferred(batchSize);
+    std::vector<int> results(batchSize);
+    std::vector<std::string> scratch(pool.size());
 
+    bool atEnd = false;
+    while (!atEnd) {
+        size_t count = 0;
+        size_t compressed = 0;
+        while (count < batchSize) {
+            if (haveCurrent) {
+                haveCurrent = false;
+            } else if ((ret = journals.next()) <= 0) {
+                atEnd = true;
+                break;
+            }
+            results[count] = journals.readEntry(&batch[count], &deferred[count]);
+            if (results[count] >= 0 && batch[count].realtime > options.until) {
+                atEnd = true;
+                break;
+            }
+            compressed += deferred[count].size();
+            count++;
+        }
         if (ret < 0) {
-            perror(("Failed to fetch field " + field + "(" + strerror(-ret) + ")").c_str());
-            return "";
+            printf("Failed to read journal files: %s\n", strerror(-ret));
+            return -ret;
         }
 
-        // + 1 since the message is returned as FIELD=whatwewant
-        const size_t fieldLength = field.size() + 1;
-        const int textLength = messageLength - fieldLength;
+        if (compressed > 0) {
+            pool.parallelFor(count, [&](size_t index, unsigned worker) {
+                if (results[index] >= 0 && !deferred[index].empty()) {
+                    results[index] = decompressDeferred(&batch[index], deferred[index], &scratch[worker], fields);
+                }
+            });
+        }
 
-        return std::string(message + fieldLength, textLength);;
+        for (size_t i = 0; i < count; i++) {
+            if (results[i] < 0) {
+                continue;
+            }
+            if (lossDetector) {
+                lossDetector->check(batch[i]);
+            }
+            if (passesOn(options, batch[i])) {
+                showEntry(&journals, batch[i], options);
+            }
+            if (waitDecided()) {
+                atEnd = true;
+                break;
+            }
+        }
     }
 
-    puts(("Timeout fetching field " + field).c_str());
-    return "";
+    journals.cursor(lastCursor);
+    return 0;
 }
 
-static int print_journal_message(sd_journal *j)
+// Checks --grep against the MESSAGE straight from the journal, so entries that
+// don't match are skipped without reading any of the other fields.
+static bool messageMatches(JournalSource *source, const Options &options)
 {
-    uint64_t usec;
-    int ret = sd_journal_get_realtime_usec(j, &usec);
+    if (options.grep.empty()) {
+        return true;
+    }
+    std::string_view message;
+    if (source->data("MESSAGE", &message) < 0) {
+        return false;
+    }
+    return message.find(options.grep) != std::string_view::npos;
+}
+
+// Walks backwards from the end (or --until), printing the newest matches first
+static int printReverse(JournalSource *source, const Options &options)
+{
+    int ret = options.until != UINT64_MAX ? source->seekRealtime(options.until + 1) : source->seekTail();
     if (ret < 0) {
-        return ret;
+        printf("Failed to seek to the end of system journal: %s\n", strerror(-ret));
+        return -ret;
     }
 
-    int level = Debug;
-    try {
-        level = std::stoi(fetchField(j, "PRIORITY"));
-    } catch (const std::exception &) {}
-
-    const char *color = Color::white;
-    switch(level) {
-    case Emergency:
-        color = Color::brightRed;
-        break;
-    case Alert:
-        color = Color::red;
-        break;
-    case Critical:
-        color = Color::orange;
-        break;
-    case Error:
-        color = Color::brightYellow;
-        break;
-    case Warning:
-        color = Color::yellow;
-        break;
-    case Notice:
-        color = Color::green;
-        break;
-    case Informational:
-        color = Color::white;
-        break;
-    case Debug:
-    default:
-        color = Color::brightGray;
-        break;
-    }
-
-    time_t sec = usec / 1000000;
-    std::tm tm;
-    localtime_r(&sec, &tm);
-    std::cout << "\033[02;37m"
-        << std::put_time(&tm, "%H:%M:%S %b %d ")
-        << fetchField(j, "_HOSTNAME");
+    Entry entry;
+    long found = 0;
+    while ((options.maxResults < 0 || found < options.maxResults) && (ret = source->previous()) > 0) {
+        uint64_t realtime;
+        if (source->realtime(&realtime) < 0) {
+            continue;
+        }
+        if (realtime < options.since) {
+            break;
+        }
+        // Seeking by realtime can land a bit off when files interleave
+        if (realtime > options.until || !messageMatches(source, options)) {
+            continue;
+        }
+        if (source->readEntry(&entry, options.fields) < 0 || !options.filter.matches(entry)) {
+            continue;
+        }
+        showEntry(source, entry, options);
+        found++;
+    }
+    if (ret < 0) {
+        printf("Failed to move backwards in journal: %s\n", strerror(-ret));
+        return -ret;
+    }
+    return 0;
+}
 
-    std::string uid = fetchField(j, "_UID");
-    if (uid.empty()) {
-        uid = fetchField(j, "_AUDIT_LOGINUID");
+// Moves back over the last options.lines (matching) entries, returns how many
+static long moveBack(JournalSource *source, const Options &options, Entry *entry)
+{
+    if (!hasFilter(options)) {
+        return source->previousSkip(options.lines);
     }
 
-    if (!uid.empty()) {
-        std::cout << ":" << getUsername(uid);
+    long moved = 0;
+    int ret;
+    while (moved < options.lines && (ret = source->previous()) > 0) {
+        if (source->readEntry(entry, options.fields) >= 0 && matches(options, *entry)) {
+            moved++;
+        }
     }
+    return ret < 0 ? ret : moved;
+}
 
-    std::string identifier = fetchField(j, "SYSLOG_IDENTIFIER");
-    if (identifier.empty()) {
-        identifier = fetchField(j, "_COMM");
+template<typename Index>
+static int updateIndex(const std::string &path, const JournalSummary &summary)
+{
+    Index index(summary.fileId);
+    int ret = index.load();
+    if (ret < 0) {
+        printf("Failed to load index for %s: %s\n", path.c_str(), strerror(-ret));
+        return ret;
+    }
+    if (index.coveredEntries() >= summary.entryCount) {
+        return 0;
+    }
+    const bool archived = summary.state == JournalSummary::Archived;
+    if constexpr (std::is_same_v<Index, BloomIndex>) {
+        // Only whole chunks until the file is done
+        if (!archived && summary.entryCount - index.coveredEntries() < BloomChunkEntries) {
+            return 0;
+        }
     }
-    std::cout << " " << identifier;
 
-    const std::string pid = fetchField(j, "_PID");
-    if (!pid.empty()) {
-        std::cout << "[" << pid << "]";
+    JournalFile journal(path);
+    ret = journal.open();
+    if (ret >= 0) {
+        if constexpr (std::is_same_v<Index, BloomIndex>) {
+            ret = index.update(&journal, archived);
+        } else {
+            ret = index.update(&journal);
+        }
+    }
+    if (ret < 0) {
+        printf("Failed to index %s: %s\n", path.c_str(), strerror(-ret));
+    }
+    return 0;
+}
+
+// Brings the indexes for all journal files up to date
+static void updateIndexes(const Options &options)
+{
+    std::vector<sd_id128_t> existing;
+    for (const std::string &path : journalPaths(options)) {
+        JournalSummary summary;
+        if (readJournalSummary(path, &summary) < 0) {
+            continue;
+        }
+        existing.push_back(summary.fileId);
+
+        const int ret = options.buildIndex == Options::BloomFilters ?
+            updateIndex<BloomIndex>(path, summary) :
+            updateIndex<TextIndex>(path, summary);
+        if (ret < 0) {
+            return;
+        }
+    }
+
+    // Only when we've seen all of them, otherwise we'd delete everything else
+    if (options.files.empty() && !hasTimeRange(options)) {
+        if (options.buildIndex == Options::BloomFilters) {
+            BloomIndex::removeStale(existing);
+        } else {
+            TextIndex::removeStale(existing);
+        }
     }
+}
+
+static int runIndexer(JournalSource *source, const Options &options)
+{
+    updateIndexes(options);
+    if (!options.follow) {
+        return 0;
+    }
+
+    // Don't reindex on every single new entry, it's mostly just appending to
+    // the online file anyway
+    constexpr uint64_t interval = 10 * 1000000ULL;
+    bool dirty = false;
+    uint64_t lastUpdate = 0;
+    while (true) {
+        timespec now;
+        clock_gettime(CLOCK_MONOTONIC, &now);
+        const uint64_t nowUsec = now.tv_sec * 1000000ULL + now.tv_nsec / 1000;
+        if (dirty && nowUsec >= lastUpdate + interval) {
+            updateIndexes(options);
+            dirty = false;
+            lastUpdate = nowUsec;
+        }
 
-    std::cout << ": "
-        << color
-        << fetchField(j, "MESSAGE")
-        << Color::reset
-        << std::endl
-    ;
+        const uint64_t timeout = dirty ? lastUpdate + interval - nowUsec : -1lu;
+        const int type = source->wait(timeout);
+        if (type < 0) {
+            printf("Failed to process wait for journal event: %d (%s)\n", type, strerror(-type));
+            return -type;
+        }
+        if (type == SD_JOURNAL_APPEND || type == SD_JOURNAL_INVALIDATE) {
+            dirty = true;
+        }
+    }
 
     return 0;
 }
 
-int run(sd_journal *journal)
+// What --control can change. Only touched on the control socket's thread,
+// which works on a copy of the options of its own.
+struct ControlState {
+    Options options;
+    // As given, so the priority can be added to it
+    std::string filter;
+    // Negative for any
+    long maxPriority = -1;
+};
+
+// The options with the latest change, handed over whole to run(). It swaps
+// them in between drains, so no entry is shown with only half of a change,
+// and the filter is already parsed by then.
+static std::atomic<Options*> updatedOptions { nullptr };
+
+static bool parseSwitch(std::string_view value, bool *enabled)
+{
+    if (value == "on") {
+        *enabled = true;
+    } else if (value == "off") {
+        *enabled = false;
+    } else {
+        return false;
+    }
+    return true;
+}
+
+// Commands are "filter [EXPR]", "priority [N]", "grep [PATTERN]",
+// "identity on|off" and "process-info on|off". Leaving out the argument of
+// the first three turns them off.
+static std::string handleCommand(ControlState *state, std::string_view command)
 {
-    if (sd_journal_seek_tail(journal) < 0) {
-        perror("Failed to seek to the end of system journal");
-        return errno;
+    const size_t space = command.find(' ');
+    const std::string_view name = command.substr(0, space);
+    const std::string_view argument = space == std::string_view::npos ? std::string_view() : command.substr(space + 1);
+
+    Options updated = state->options;
+    if (name == "filter" || name == "priority") {
+        std::string filter = state->filter;
+        long maxPriority = state->maxPriority;
+        if (name == "filter") {
+            filter = argument;
+        } else if (argument.empty()) {
+            maxPriority = -1;
+        } else if (!parseNumber(argument, &maxPriority) || maxPriority < 0 || maxPriority > 7) {
+            return "Invalid priority: " + std::string(argument);
+        }
+
+        // By itself first, so the positions in the errors are in what they sent
+        updated.filter = Filter();
+        std::string error;
+        if (!filter.empty() && !updated.filter.parse(filter, &error)) {
+            return "Invalid filter: " + error;
+        }
+        if (maxPriority >= 0) {
+            std::string expression = filter.empty() ? std::string() : "(" + filter + ") && ";
+            expression += "priority<=" + std::to_string(maxPriority);
+            if (!updated.filter.parse(expression, &error)) {
+                return "Invalid filter: " + error;
+            }
+        }
+        state->filter = std::move(filter);
+        state->maxPriority = maxPriority;
+    } else if (name == "grep") {
+        updated.grep = argument;
+    } else if (!(name == "identity" && parseSwitch(argument, &updated.identity)) &&
+               !(name == "process-info" && parseSwitch(argument, &updated.processInfo))) {
+        return "Unknown command, expected filter, priority, grep, identity on|off or process-info on|off";
+    }
+
+    // Only ever more, the ones that aren't needed anymore are just ignored
+    updated.fields |= updated.filter.fields();
+    if (!updated.grep.empty()) {
+        updated.fields |= FieldMessage;
+    }
+    if (updated.identity && updated.output == Options::ShortFormat) {
+        updated.fields |= FieldGid | FieldAuditSession;
+    }
+    state->options = updated;
+    // Replaces the one that hasn't been taken yet, if any
+    delete updatedOptions.exchange(new Options(std::move(updated)));
+    return "OK";
+}
+
+static void takeUpdatedOptions(Options *options)
+{
+    const std::unique_ptr<Options> updated(updatedOptions.exchange(nullptr));
+    if (updated) {
+        *options = std::move(*updated);
+    }
+}
+
+// The options are only changed by --control, between the drains in the loop
+// that follows the journal
+int run(JournalSource *source, Options *options, const std::string &startCursor)
+{
+    if (options->reverse) {
+        return printReverse(source, *options);
+    }
+    if (options->countBy != CountByNothing) {
+        return countEntries(source, *options);
+    }
+
+    std::unique_ptr<ReplayClock> replay;
+    if (options->replaySpeed > 0) {
+        replay = std::make_unique<ReplayClock>(options->replaySpeed);
+        const int ret = replay->open();
+        if (ret < 0) {
+            printf("Failed to set up timer for replaying: %s\n", strerror(-ret));
+            return -ret;
+        }
     }
 
-    const int history = 20; // Scroll back 20 messages
-    for (int i = 0; i < history; i++) {
-        if (sd_journal_previous(journal) < 0) {
-            perror("Failed to move backwards in journal");
+    Entry entry;
+
+    if (!startCursor.empty()) {
+        if (source->seekCursor(startCursor) < 0) {
+            perror("Failed to seek to the end of the history");
+            return errno;
+        }
+        // Lands on the last entry we already printed, unless it's gone
+        if (source->next() > 0 && source->testCursor(startCursor) <= 0) {
+            if (source->readEntry(&entry, options->fields) >= 0 && passesOn(*options, entry)) {
+                showEntry(source, entry, *options);
+            }
+        }
+    } else if (options->since > 0) {
+        if (source->seekRealtime(options->since) < 0) {
+            perror("Failed to seek to the start time in system journal");
+            return errno;
+        }
+    } else if (options->lines < 0) {
+        if (source->seekHead() < 0) {
+            perror("Failed to seek to the start of system journal");
             return errno;
         }
+    } else {
+        const int ret = options->until != UINT64_MAX ? source->seekRealtime(options->until + 1) : source->seekTail();
+        if (ret < 0) {
+            perror("Failed to seek to the end of system journal");
+            return errno;
+        }
+
+        if (options->lines > 0) {
+            const long moved = moveBack(source, *options, &entry);
+            if (moved < 0) {
+                printf("Failed to move backwards in journal: %s\n", strerror(-moved));
+                return -moved;
+            }
+            // With --grep we might have ended up on a non-matching entry at the start
+            if (moved > 0 && source->readEntry(&entry, options->fields) >= 0 && passesOn(*options, entry)) {
+                if (replay) {
+                    replay->isDue(entry.realtime);
+                }
+                showEntry(source, entry, *options);
+            }
+        }
     }
 
-    while (true) {
-        const int type = sd_journal_wait(journal, -1lu);
+    // The rest of the history first, the sources that aren't libsystemd don't
+    // wake up wait() for what's already there
+    if (!waitDecided()) {
+        printNewEntries(source, &entry, *options, replay.get());
+    }
+    if (!options->follow) {
+        return 0;
+    }
+
+    while (!source->isFinished()) {
+        if (reassembler) {
+            reassembler->flushExpired();
+        }
+        if (waitCondition) {
+            waitCondition->checkTimeout();
+        }
+        if (waitDecided()) {
+            break;
+        }
+        // The export output isn't flushed after every line
+        fflush(stdout);
+        uint64_t timeout = reassembler ? reassembler->timeout() : -1lu;
+        if (waitCondition) {
+            timeout = std::min(timeout, waitCondition->timeLeft());
+        }
+        const int type = source->wait(timeout);
 
         if (type < 0) {
             printf("Failed to process wait for journal event: %d (%s)\n", type, strerror(-type));
@@ -210,9 +1022,8 @@ int run(sd_journal *journal)
             // We might have missed some events, but it seems spurious
             // The documentation suggests treating it like SD_JOURNAL_APPEND
         case SD_JOURNAL_APPEND:
-            while (sd_journal_next(journal)) {
-                print_journal_message(journal);
-            }
+            takeUpdatedOptions(options);
+            printNewEntries(source, &entry, *options);
             continue;
         default:
             printf("Unhandled type %d\n", type);
@@ -223,23 +1034,745 @@ int run(sd_journal *journal)
     return 0;
 }
 
-int main(int argc, char *argv[])
+// Looks up all the users (and groups) in the journal at once, instead of
+// while showing the entries
+static void prefetchIdentities(SdJournalSource *source, FieldMask fields)
 {
-    (void)argc;
-    (void)argv;
+    static const std::pair<const char*, FieldMask> idFields[] = {
+        { "_UID", FieldUid }, { "_GID", FieldGid }
+    };
+    for (const auto &[field, bit] : idFields) {
+        std::vector<std::string> values;
+        if (!(fields & bit) || source->uniqueValues(field, &values) < 0) {
+            continue;
+        }
+        std::vector<uint32_t> ids;
+        for (const std::string &value : values) {
+            uint32_t id;
+            if (parseNumber(value, &id)) {
+                ids.push_back(id);
+            }
+        }
+        if (bit == FieldUid) {
+            prefetchUsers(ids);
+        } else {
+            prefetchGroups(ids);
+        }
+    }
+}
 
-    if (geteuid() != 0) {
+// Annotates an export stream, e.g. from journalctl -o export on another machine
+static int runExport(Options *options)
+{
+    if (options->files.size() > 1) {
+        puts("Only one --file can be read with --input=export");
+        return EINVAL;
+    }
+    int fd = STDIN_FILENO;
+    if (!options->files.empty()) {
+        fd = open(options->files[0].c_str(), O_RDONLY | O_CLOEXEC);
+        if (fd < 0) {
+            printf("Failed to open %s: %s\n", options->files[0].c_str(), strerror(errno));
+            return errno;
+        }
+    }
+
+    ExportSource source(fd);
+    // Otherwise it keeps everything that ever came in the stream
+    if (options->follow) {
+        constexpr uint64_t followHistory = 65536;
+        source.setHistoryLimit(options->lines < 0 ? followHistory : std::max<uint64_t>(options->lines, followHistory));
+    }
+    int ret = source.open();
+    if (ret < 0) {
+        printf("Failed to read export stream: %s\n", strerror(-ret));
+        ret = -ret;
+    } else {
+        ret = run(&source, options, std::string());
+    }
+    if (fd != STDIN_FILENO) {
+        close(fd);
+    }
+    return ret;
+}
+
+// Accepts a number followed by s, sec, m, min, h, d or w
+static bool parseDuration(const char *string, uint64_t *seconds)
+{
+    char *end = nullptr;
+    const unsigned long long amount = strtoull(string, &end, 10);
+    if (!end || end == string) {
+        return false;
+    }
+    static const std::pair<const char*, uint64_t> units[] = {
+        { "s", 1 }, { "sec", 1 }, { "m", 60 }, { "min", 60 },
+        { "h", 3600 }, { "d", 86400 }, { "w", 7 * 86400 }
+    };
+    for (const auto &[unit, unitSeconds] : units) {
+        if (strcmp(end, unit) == 0) {
+            *seconds = amount * unitSeconds;
+            return true;
+        }
+    }
+    return false;
+}
+
+// Accepts "YYYY-MM-DD [HH:MM[:SS]]", "HH:MM[:SS]" (today), "@UNIXTIME",
+// "now", "today", "yesterday" and relative times like "-2h" or "-30min".
+static bool parseTime(const char *string, uint64_t *usec)
+{
+    const time_t now = time(nullptr);
+    std::tm tm;
+    localtime_r(&now, &tm);
+
+    auto startOfDay = [&](int daysAgo) {
+        tm.tm_mday -= daysAgo;
+        tm.tm_hour = tm.tm_min = tm.tm_sec = 0;
+        tm.tm_isdst = -1;
+        return uint64_t(mktime(&tm)) * 1000000ULL;
+    };
+
+    if (strcmp(string, "now") == 0) {
+        *usec = uint64_t(now) * 1000000ULL;
+        return true;
+    }
+    if (strcmp(string, "today") == 0) {
+        *usec = startOfDay(0);
+        return true;
+    }
+    if (strcmp(string, "yesterday") == 0) {
+        *usec = startOfDay(1);
+        return true;
+    }
+    if (string[0] == '@') {
+        char *end = nullptr;
+        const double seconds = strtod(string + 1, &end);
+        if (!end || *end != '\0' || seconds < 0) {
+            return false;
+        }
+        *usec = seconds * 1000000.;
+        return true;
+    }
+    if (string[0] == '-') {
+        uint64_t seconds;
+        if (!parseDuration(string + 1, &seconds)) {
+            return false;
+        }
+        *usec = (uint64_t(now) - std::min<uint64_t>(seconds, now)) * 1000000ULL;
+        return true;
+    }
+
+    static const char *formats[] = { "%Y-%m-%d %H:%M:%S", "%Y-%m-%d %H:%M", "%Y-%m-%d", "%H:%M:%S", "%H:%M" };
+    for (const char *format : formats) {
+        std::tm parsed = tm;
+        parsed.tm_hour = parsed.tm_min = parsed.tm_sec = 0;
+        const char *end = strptime(string, format, &parsed);
+        if (!end || *end != '\0') {
+            continue;
+        }
+        parsed.tm_isdst = -1;
+        *usec = uint64_t(mktime(&parsed)) * 1000000ULL;
+        return true;
+    }
+    return false;
+}
+
+static void printUsage(const char *name)
+{
+    printf("Usage: %s [OPTIONS]\n"
+           "Like journalctl -f, but with usernames.\n"
+           "\n"
+           "  -n, --lines=N          Show the N most recent entries first (default 20, \"all\" for everything)\n"
+           "      --no-follow        Exit after showing the history\n"
+           "  -S, --since=TIME       Start showing entries from TIME\n"
+           "  -U, --until=TIME       Stop showing entries after TIME, implies --no-follow\n"
+           "  -g, --grep=PATTERN     Only show entries with PATTERN in the message, which is\n"
+           "                         highlighted\n"
+           "      --filter=EXPR      Only show entries matching EXPR, e.g.\n"
+           "                         'priority<=4 && (unit~\"nginx*\" || user==\"deploy\")'\n"
+           "                         Fields: priority, hostname, uid, user, gid, group,\n"
+           "                         identifier, comm, pid, unit and message. Compare with\n"
+           "                         == != < <= > >= or ~ for a \"glob\" or /regex/, combine\n"
+           "                         with && || ! and ()\n"
+           "  -r, --reverse          Show the newest entries first, implies --no-follow\n"
+           "      --max-results=N    Stop after showing N entries with --reverse\n"
+           "      --replay[=SPEED]   Show the entries (from --since or -n) with the same time\n"
+           "                         between them as when they were logged, SPEED times\n"
+           "                         faster (default 1, \"max\" for no waiting)\n"
+           "      --reassemble[=MSEC]\n"
+           "                         Show stack traces and other lines that continue the\n"
+           "                         previous entry from the same process as one entry, if\n"
+           "                         they're logged at most MSEC apart (default 100)\n"
+           "      --process-info     Show the command line, parent and container of the\n"
+           "                         processes that are still running\n"
+           "      --identity         Show the group, and the login session (user, tty and\n"
+           "                         remote host) the entry was logged from\n"
+           "  -x, --catalog          Show the explanation from the message catalog for entries\n"
+           "                         that have one, like journalctl -x\n"
+           "      --show-loss        Show where entries are missing from the journal, and\n"
+           "                         where journald suppressed messages because of rate\n"
+           "                         limiting\n"
+           "      --wait-for=PATTERN Exit as soon as an entry with PATTERN in the message is\n"
+           "                         shown, with status 0, or 1 if the journal ends first\n"
+           "      --fail-on=PATTERN  Exit with status 3 as soon as an entry with PATTERN in\n"
+           "                         the message is shown\n"
+           "      --timeout=SECS     Exit with status 124 if nothing was matched after SECS\n"
+           "                         (or a duration like 5min). Only new entries are matched\n"
+           "                         unless -n or --since is given.\n"
+           "      --control=PATH     Listen on the unix socket PATH for commands that change\n"
+           "                         what's shown while following, one per line: \"filter\n"
+           "                         [EXPR]\", \"priority [N]\", \"grep [PATTERN]\", \"identity\n"
+           "                         on|off\" or \"process-info on|off\"\n"
+           "      --count-by=FIELD   Print the number of entries and message bytes per\n"
+           "                         identifier, unit, priority or user instead of the entries\n"
+           "      --bucket=DURATION  Count separately for every DURATION (e.g. 1m or 1h)\n"
+           "      --build-index[=TYPE]\n"
+           "                         Index the messages in the journal files, to make --grep\n"
+           "                         with --native a lot faster. Keeps the index updated until\n"
+           "                         killed, unless --no-follow is passed. TYPE is \"words\"\n"
+           "                         (default) or \"bloom\" for much smaller per chunk filters\n"
+           "  -o, --output=FORMAT    \"short\" (default), \"export\" for the journal export\n"
+           "                         format like journalctl -o export, or \"arrow\" for an\n"
+           "                         Arrow IPC file with typed columns, implies --no-follow\n"
+           "      --input=FORMAT     \"journal\" (default) or \"export\" to read the journal\n"
+           "                         export format from stdin, or from --file\n"
+           "  -D, --directory=DIR    Read journal files from DIR\n"
+           "      --file=PATH        Read the journal file PATH, can be repeated\n"
+           "      --namespace=NS     Read the journal namespace NS, through libsystemd\n"
+           "      --native           Read the history directly from the journal files instead of\n"
+           "                         through libsystemd, a lot faster for large histories\n"
+           "  -j, --threads=N        Number of threads used for decompressing with --native\n"
+           "                         (default one per core)\n"
+           "      --generate=SPEC    Read made up entries instead of a journal, for benchmarks\n"
+           "                         and testing. SPEC is a comma separated list of\n"
+           "                         entries=N, initial=N, seed=N, users=N, identifiers=N,\n"
+           "                         interval=TIME, batch=N, delay=TIME, eagain=N and\n"
+           "                         invalidate=N, see the README\n"
+           "  -h, --help             Show this help\n",
+           name);
+}
+
+// Everything after parsing the options
+static int openAndRun(Options *options)
+{
+    if (options->generate) {
+        GeneratedSource source(options->generator);
+        return run(&source, options, std::string());
+    }
+    if (options->input == Options::ExportFormat) {
+        return runExport(options);
+    }
+
+    // Would end up in the middle of the export or Arrow output
+    if (geteuid() != 0 && options->output == Options::ShortFormat) {
         puts("Not running as root, will only print user journal");
     }
 
+    std::string cursor;
+    if (options->buildIndex != Options::NoIndex && !options->follow) {
+        updateIndexes(*options);
+        return 0;
+    }
+    if (options->native && options->countBy != CountByNothing) {
+        return countNative(*options);
+    }
+    // Replaying is limited by the waiting anyway, so it always goes through libsystemd
+    if (options->native && options->buildIndex == Options::NoIndex && options->replaySpeed == 0) {
+        const int ret = printNativeHistory(*options, &cursor);
+        if (ret != 0 || !options->follow || waitDecided()) {
+            return ret;
+        }
+    }
+
     sd_journal *journal;
-    int ret = sd_journal_open(&journal, SD_JOURNAL_LOCAL_ONLY);
+    int ret;
+    if (hasTimeRange(*options) && !options->follow) {
+        // Only open the files that can contain anything in the range. Not when
+        // following, since we'd miss new files after rotation.
+        const std::vector<std::string> selected = journalPaths(*options);
+        if (selected.empty()) {
+            return 0;
+        }
+        std::vector<const char*> paths;
+        for (const std::string &path : selected) {
+            paths.push_back(path.c_str());
+        }
+        paths.push_back(nullptr);
+        ret = sd_journal_open_files(&journal, paths.data(), 0);
+    } else if (!options->directory.empty()) {
+        ret = sd_journal_open_directory(&journal, options->directory.c_str(), 0);
+    } else if (!options->journalNamespace.empty()) {
+        ret = sd_journal_open_namespace(&journal, options->journalNamespace.c_str(), SD_JOURNAL_LOCAL_ONLY);
+    } else if (!options->files.empty()) {
+        std::vector<const char*> paths;
+        for (const std::string &path : options->files) {
+            paths.push_back(path.c_str());
+        }
+        paths.push_back(nullptr);
+        ret = sd_journal_open_files(&journal, paths.data(), 0);
+    } else {
+        ret = sd_journal_open(&journal, SD_JOURNAL_LOCAL_ONLY);
+    }
     if (ret < 0) {
         perror("Failed to open system journal");
         return -ret;
     }
-    ret = run(journal);
-    sd_journal_close(journal);
+    // Same for the matches, and --control can change the filter to one that
+    // needs other entries
+    if (options->buildIndex == Options::NoIndex && !options->showLoss && options->controlPath.empty()) {
+        ret = options->filter.addJournalMatches(journal);
+        if (ret < 0) {
+            printf("Failed to add journal matches: %s\n", strerror(-ret));
+            sd_journal_close(journal);
+            return -ret;
+        }
+    }
+
+    SdJournalSource source(journal);
+    if (options->output == Options::ExportFormat) {
+        // Otherwise big fields are cut off at 64k
+        source.setDataThreshold(0);
+    }
+    if (options->buildIndex == Options::NoIndex) {
+        prefetchIdentities(&source, options->fields);
+    }
+    if (options->buildIndex != Options::NoIndex) {
+        return runIndexer(&source, *options);
+    }
+    return run(&source, options, cursor);
+}
 
+// Shows the traces that are still being put together at the end
+static int runAndFlush(Options *options)
+{
+    const int ret = openAndRun(options);
+    if (reassembler) {
+        reassembler->flushAll();
+    }
+    if (lossDetector) {
+        lossDetector->finish();
+    }
     return ret;
 }
+
+// Otherwise the entries in the system journal (and from the other users) can't
+// be read, and their seqnums look like gaps
+static bool canReadAllEntries()
+{
+    if (geteuid() == 0) {
+        return true;
+    }
+    const group *journalGroup = getgrnam("systemd-journal");
+    if (!journalGroup) {
+        return false;
+    }
+    if (getegid() == journalGroup->gr_gid) {
+        return true;
+    }
+    const int count = getgroups(0, nullptr);
+    if (count <= 0) {
+        return false;
+    }
+    std::vector<gid_t> groups(count);
+    groups.resize(std::max(getgroups(count, groups.data()), 0));
+    return std::find(groups.begin(), groups.end(), journalGroup->gr_gid) != groups.end();
+}
+
+int main(int argc, char *argv[])
+{
+    enum {
+        OptionNoFollow = 0x100,
+        OptionFile,
+        OptionNative,
+        OptionBuildIndex,
+        OptionMaxResults,
+        OptionCountBy,
+        OptionBucket,
+        OptionFilter,
+        OptionGenerate,
+        OptionInput,
+        OptionReplay,
+        OptionNamespace,
+        OptionReassemble,
+        OptionProcessInfo,
+        OptionIdentity,
+        OptionShowLoss,
+        OptionWaitFor,
+        OptionFailOn,
+        OptionTimeout,
+        OptionControl
+    };
+    static const option longOptions[] = {
+        { "lines", required_argument, nullptr, 'n' },
+        { "no-follow", no_argument, nullptr, OptionNoFollow },
+        { "since", required_argument, nullptr, 'S' },
+        { "until", required_argument, nullptr, 'U' },
+        { "grep", required_argument, nullptr, 'g' },
+        { "filter", required_argument, nullptr, OptionFilter },
+        { "reverse", no_argument, nullptr, 'r' },
+        { "max-results", required_argument, nullptr, OptionMaxResults },
+        { "count-by", required_argument, nullptr, OptionCountBy },
+        { "bucket", required_argument, nullptr, OptionBucket },
+        { "build-index", optional_argument, nullptr, OptionBuildIndex },
+        { "directory", required_argument, nullptr, 'D' },
+        { "file", required_argument, nullptr, OptionFile },
+        { "namespace", required_argument, nullptr, OptionNamespace },
+        { "native", no_argument, nullptr, OptionNative },
+        { "threads", required_argument, nullptr, 'j' },
+        { "replay", optional_argument, nullptr, OptionReplay },
+        { "reassemble", optional_argument, nullptr, OptionReassemble },
+        { "process-info", no_argument, nullptr, OptionProcessInfo },
+        { "identity", no_argument, nullptr, OptionIdentity },
+        { "catalog", no_argument, nullptr, 'x' },
+        { "show-loss", no_argument, nullptr, OptionShowLoss },
+        { "wait-for", required_argument, nullptr, OptionWaitFor },
+        { "fail-on", required_argument, nullptr, OptionFailOn },
+        { "timeout", required_argument, nullptr, OptionTimeout },
+        { "control", required_argument, nullptr, OptionControl },
+        { "output", required_argument, nullptr, 'o' },
+        { "input", required_argument, nullptr, OptionInput },
+        { "generate", required_argument, nullptr, OptionGenerate },
+        { "help", no_argument, nullptr, 'h' },
+        { nullptr, 0, nullptr, 0 }
+    };
+
+    Options options;
+    // --wait-for and --fail-on shouldn't match something from the last time
+    bool historyRequested = false;
+    // The last --filter, for --control
+    std::string filterExpression;
+    int opt;
+    while ((opt = getopt_long(argc, argv, "n:S:U:g:rxo:D:j:h", longOptions, nullptr)) != -1) {
+        switch(opt) {
+        case 'n': {
+            historyRequested = true;
+            if (strcmp(optarg, "all") == 0) {
+                options.lines = -1;
+                break;
+            }
+            char *end = nullptr;
+            options.lines = strtol(optarg, &end, 10);
+            if (!end || *end != '\0' || options.lines < 0) {
+                printf("Invalid number of lines: %s\n", optarg);
+                return EINVAL;
+            }
+            break;
+        }
+        case OptionNoFollow:
+            options.follow = false;
+            break;
+        case 'S':
+            historyRequested = true;
+            if (!parseTime(optarg, &options.since)) {
+                printf("Invalid time: %s\n", optarg);
+                return EINVAL;
+            }
+            break;
+        case 'U':
+            if (!parseTime(optarg, &options.until)) {
+                printf("Invalid time: %s\n", optarg);
+                return EINVAL;
+            }
+            options.follow = false;
+            break;
+        case 'g':
+            options.grep = optarg;
+            break;
+        case OptionFilter: {
+            std::string error;
+            if (!options.filter.parse(optarg, &error)) {
+                printf("Invalid filter: %s\n", error.c_str());
+                return EINVAL;
+            }
+            filterExpression = optarg;
+            break;
+        }
+        case 'r':
+            options.reverse = true;
+            options.follow = false;
+            break;
+        case OptionMaxResults: {
+            char *end = nullptr;
+            options.maxResults = strtol(optarg, &end, 10);
+            if (!end || *end != '\0' || options.maxResults <= 0) {
+                printf("Invalid number of results: %s\n", optarg);
+                return EINVAL;
+            }
+            break;
+        }
+        case OptionCountBy:
+            if (!parseCountField(optarg, &options.countBy)) {
+                printf("Can't count by %s\n", optarg);
+                return EINVAL;
+            }
+            options.follow = false;
+            break;
+        case OptionBucket: {
+            uint64_t seconds;
+            if (!parseDuration(optarg, &seconds) || seconds == 0) {
+                printf("Invalid bucket size: %s\n", optarg);
+                return EINVAL;
+            }
+            options.bucket = seconds * 1000000ULL;
+            break;
+        }
+        case OptionBuildIndex:
+            if (!optarg || strcmp(optarg, "words") == 0) {
+                options.buildIndex = Options::WordIndex;
+            } else if (strcmp(optarg, "bloom") == 0) {
+                options.buildIndex = Options::BloomFilters;
+            } else {
+                printf("Invalid index type: %s\n", optarg);
+                return EINVAL;
+            }
+            break;
+        case 'D':
+            options.directory = optarg;
+            break;
+        case OptionFile:
+            options.files.push_back(optarg);
+            break;
+        case OptionNamespace:
+            options.journalNamespace = optarg;
+            break;
+        case OptionNative:
+            options.native = true;
+            break;
+        case 'j': {
+            char *end = nullptr;
+            const long threads = strtol(optarg, &end, 10);
+            if (!end || *end != '\0' || threads <= 0 || threads > 1024) {
+                printf("Invalid number of threads: %s\n", optarg);
+                return EINVAL;
+            }
+            options.threads = threads;
+            break;
+        }
+        case OptionReplay:
+            options.follow = false;
+            if (!optarg) {
+                options.replaySpeed = 1;
+            } else if (strcmp(optarg, "max") == 0) {
+                options.replaySpeed = INFINITY;
+            } else {
+                char *end = nullptr;
+                options.replaySpeed = strtod(optarg, &end);
+                if (!end || *end != '\0' || !(options.replaySpeed > 0)) {
+                    printf("Invalid replay speed: %s\n", optarg);
+                    return EINVAL;
+                }
+            }
+            break;
+        case OptionReassemble: {
+            uint64_t msec = 100;
+            if (optarg && (!parseNumber(optarg, &msec) || msec == 0)) {
+                printf("Invalid reassembly window: %s\n", optarg);
+                return EINVAL;
+            }
+            options.reassembleWindow = msec * 1000;
+            break;
+        }
+        case OptionProcessInfo:
+            options.processInfo = true;
+            break;
+        case OptionIdentity:
+            options.identity = true;
+            break;
+        case 'x':
+            options.catalog = true;
+            break;
+        case OptionShowLoss:
+            options.showLoss = true;
+            break;
+        case OptionWaitFor:
+            options.waitFor = optarg;
+            break;
+        case OptionFailOn:
+            options.failOn = optarg;
+            break;
+        case OptionTimeout: {
+            uint64_t seconds;
+            if ((!parseNumber(optarg, &seconds) && !parseDuration(optarg, &seconds)) || seconds == 0) {
+                printf("Invalid timeout: %s\n", optarg);
+                return EINVAL;
+            }
+            options.timeout = seconds * 1000000ULL;
+            break;
+        }
+        case OptionControl:
+            options.controlPath = optarg;
+            break;
+        case 'o':
+            if (strcmp(optarg, "short") == 0) {
+                options.output = Options::ShortFormat;
+            } else if (strcmp(optarg, "export") == 0) {
+                options.output = Options::ExportFormat;
+            } else if (strcmp(optarg, "arrow") == 0) {
+                options.output = Options::ArrowFormat;
+                options.follow = false;
+            } else {
+                printf("Invalid output format: %s\n", optarg);
+                return EINVAL;
+            }
+            break;
+        case OptionInput:
+            if (strcmp(optarg, "journal") == 0) {
+                options.input = Options::JournalFormat;
+            } else if (strcmp(optarg, "export") == 0) {
+                options.input = Options::ExportFormat;
+            } else {
+                printf("Invalid input format: %s\n", optarg);
+                return EINVAL;
+            }
+            break;
+        case OptionGenerate: {
+            std::string error;
+            if (!parseGeneratorOptions(optarg, &options.generator, &error)) {
+                printf("Invalid generator options: %s\n", error.c_str());
+                return EINVAL;
+            }
+            options.generate = true;
+            break;
+        }
+        case 'h':
+            printUsage(argv[0]);
+            return 0;
+        default:
+            printUsage(argv[0]);
+            return EINVAL;
+        }
+    }
+
+    // The export output doesn't look at the entry, only at the raw fields
+    options.fields = options.output == Options::ExportFormat ? 0 : messageLineFields;
+    if (options.output == Options::ArrowFormat) {
+        options.fields = arrowFields;
+    } else if (options.output == Options::ShortFormat) {
+        if (options.identity) {
+            options.fields |= FieldGid | FieldAuditSession;
+        }
+        if (options.catalog) {
+            options.fields |= FieldMessageId;
+        }
+    }
+    if (options.countBy != CountByNothing) {
+        options.fields = countFields(options.countBy);
+    }
+    options.fields |= options.filter.fields();
+    if (!options.grep.empty()) {
+        options.fields |= FieldMessage;
+    }
+
+    // Always there, --control can turn on --process-info
+    ProcessCache processCache;
+    processes = &processCache;
+
+    Catalog catalog;
+    if (options.catalog) {
+        if (options.output != Options::ShortFormat) {
+            puts("--catalog only works with the short output");
+            return EINVAL;
+        }
+        messageCatalog = &catalog;
+    }
+
+    // Streams and generated entries have whatever was put in them
+    const bool countMissing = !options.showLoss || options.generate ||
+        options.input == Options::ExportFormat || canReadAllEntries();
+    LossDetector losses(countMissing);
+    if (options.showLoss) {
+        if (options.output != Options::ShortFormat || options.reverse || options.countBy != CountByNothing) {
+            puts("--show-loss only works with the short output, and not with --reverse or --count-by");
+            return EINVAL;
+        }
+        if (!countMissing) {
+            // The entries we can't read would all look missing
+            puts("Not root or in the systemd-journal group, only showing what journald suppressed");
+        }
+        options.fields |= FieldSeqnum | FieldMessageId | FieldMessage;
+        lossDetector = &losses;
+    }
+
+    const bool waiting = !options.waitFor.empty() || !options.failOn.empty() || options.timeout > 0;
+    WaitCondition condition(options.waitFor, options.failOn, options.timeout);
+    if (waiting) {
+        if (options.output == Options::ArrowFormat || options.reverse || options.countBy != CountByNothing || options.buildIndex != Options::NoIndex) {
+            puts("--wait-for, --fail-on and --timeout don't work with the Arrow output, --reverse, --count-by or --build-index");
+            return EINVAL;
+        }
+        // Not just -n 0, which can still land on the last entry in each file
+        if (!historyRequested) {
+            timespec now;
+            clock_gettime(CLOCK_REALTIME, &now);
+            options.since = now.tv_sec * 1000000ULL + now.tv_nsec / 1000;
+            // No history for it to read, following is through libsystemd anyway
+            options.native = false;
+        }
+        options.fields |= FieldMessage;
+        condition.start();
+        waitCondition = &condition;
+    }
+
+    std::unique_ptr<ThreadPool> pool;
+    if (options.native || options.output == Options::ArrowFormat) {
+        pool = std::make_unique<ThreadPool>(options.threads);
+        threadPool = pool.get();
+    }
+
+    std::unique_ptr<Reassembler> traces;
+    if (options.reassembleWindow > 0) {
+        if (options.reverse || options.output == Options::ExportFormat) {
+            puts("--reassemble only works with the short and Arrow output, and not with --reverse");
+            return EINVAL;
+        }
+        options.fields |= FieldPid | FieldMessage;
+        // Shown with the options as run() last changed them
+        traces = std::make_unique<Reassembler>(options.reassembleWindow, [&options](const Entry &entry) {
+            showAssembled(entry, options);
+        });
+        reassembler = traces.get();
+    }
+
+    // Started last, with everything that can be changed set up
+    ControlState controlState { options, filterExpression };
+    std::unique_ptr<ControlSocket> control;
+    if (!options.controlPath.empty()) {
+        if (!options.follow || options.buildIndex != Options::NoIndex) {
+            puts("--control only works when following the journal");
+            return EINVAL;
+        }
+        control = std::make_unique<ControlSocket>(options.controlPath, [&controlState](std::string_view command) {
+            return handleCommand(&controlState, command);
+        });
+        const int ret = control->open();
+        if (ret < 0) {
+            printf("Failed to listen on %s: %s\n", options.controlPath.c_str(), strerror(-ret));
+            return -ret;
+        }
+    }
+
+    if (options.output != Options::ArrowFormat || options.countBy != CountByNothing) {
+        const int ret = runAndFlush(&options);
+        return ret == 0 && waitCondition ? waitCondition->result() : ret;
+    }
+    if (isatty(STDOUT_FILENO)) {
+        puts("Not writing an Arrow file to a terminal, redirect it to a file");
+        return EINVAL;
+    }
+    ArrowWriter writer(stdout, threadPool);
+    arrowOutput = &writer;
+    int ret = writer.open();
+    if (ret >= 0) {
+        const int result = runAndFlush(&options);
+        ret = writer.finish();
+        if (result != 0) {
+            return result;
+        }
+    }
+    if (ret < 0) {
+        // Not in the middle of the file
+        fprintf(stderr, "Failed to write Arrow file: %s\n", strerror(-ret));
+        return -ret;
+    }
+    return 0;
+}
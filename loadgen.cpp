@@ -0,0 +1,506 @@
+extern "C" {
+#include <errno.h>
+#include <fcntl.h>
+#include <getopt.h>
+#include <signal.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <sys/socket.h>
+#include <sys/uio.h>
+#include <sys/un.h>
+#include <sys/wait.h>
+#include <time.h>
+#include <unistd.h>
+#include <systemd/sd-journal.h>
+} // extern "C"
+
+#include "generated-source.h"
+
+#include <algorithm>
+#include <atomic>
+#include <cinttypes>
+#include <string>
+#include <thread>
+#include <vector>
+
+// Writes generated entries to the journal at a given rate, and optionally
+// runs journal-watch on them to see how well it keeps up.
+
+struct Options {
+    GeneratorOptions generator;
+    // Entries per second, 0 for as fast as possible
+    uint64_t rate = 10000;
+    std::string journalNamespace;
+
+    // journal-watch to measure, and extra arguments for it
+    std::string watch;
+    std::vector<std::string> watchArguments;
+    // How long to wait for stragglers after sending everything, in usec
+    uint64_t drain = 5000000;
+};
+
+// In the entry that shows journal-watch is following. Not right after the tag,
+// since journal-watch --grep puts the colour codes for highlighting it in
+// between.
+static const char probeMarker[] = "[probe]";
+
+static uint64_t monotonicUsec()
+{
+    timespec now;
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    return now.tv_sec * 1000000ULL + now.tv_nsec / 1000;
+}
+
+static void sleepUntil(uint64_t usec)
+{
+    const timespec deadline = { time_t(usec / 1000000), long(usec % 1000000) * 1000 };
+    while (clock_nanosleep(CLOCK_MONOTONIC, TIMER_ABSTIME, &deadline, nullptr) == EINTR) {
+    }
+}
+
+// Sends either through libsystemd, or straight to the socket of a journal
+// namespace with the native protocol (which libsystemd can't do)
+class Sender
+{
+public:
+    ~Sender()
+    {
+        if (m_socket >= 0) {
+            close(m_socket);
+        }
+    }
+
+    int open(const std::string &journalNamespace)
+    {
+        if (journalNamespace.empty()) {
+            return 0;
+        }
+        m_socket = socket(AF_UNIX, SOCK_DGRAM | SOCK_CLOEXEC, 0);
+        if (m_socket < 0) {
+            return -errno;
+        }
+        m_address.sun_family = AF_UNIX;
+        const std::string path = "/run/systemd/journal." + journalNamespace + "/socket";
+        if (path.size() >= sizeof m_address.sun_path) {
+            return -ENAMETOOLONG;
+        }
+        strcpy(m_address.sun_path, path.c_str());
+        return 0;
+    }
+
+    // Fields starting with _ are set by journald itself, so they're skipped
+    int send(const Record &record)
+    {
+        m_fields.clear();
+        for (const auto &[name, value] : record.fields) {
+            if (name[0] != '_') {
+                m_fields.push_back(name + "=" + value);
+            }
+        }
+
+        if (m_socket < 0) {
+            m_iovecs.clear();
+            for (std::string &field : m_fields) {
+                m_iovecs.push_back({ field.data(), field.size() });
+            }
+            return sd_journal_sendv(m_iovecs.data(), m_iovecs.size());
+        }
+
+        // The generated values don't have newlines, so no need for the binary form
+        m_datagram.clear();
+        for (const std::string &field : m_fields) {
+            m_datagram += field;
+            m_datagram += '\n';
+        }
+        if (sendto(m_socket, m_datagram.data(), m_datagram.size(), 0, reinterpret_cast<const sockaddr*>(&m_address), sizeof m_address) < 0) {
+            return -errno;
+        }
+        return 0;
+    }
+
+private:
+    int m_socket = -1;
+    sockaddr_un m_address {};
+
+    std::vector<std::string> m_fields;
+    std::vector<iovec> m_iovecs;
+    std::string m_datagram;
+};
+
+// Sends entries worker, worker + workers, ... and stores the time each one
+// was sent, in usec
+static int sendEntries(const Options &options, const std::string &tag, unsigned worker, unsigned workers, uint64_t *sentAt)
+{
+    Sender sender;
+    int ret = sender.open(options.journalNamespace);
+    if (ret < 0) {
+        printf("Failed to open journal socket: %s\n", strerror(-ret));
+        return ret;
+    }
+
+    const uint64_t start = monotonicUsec();
+    Record record;
+    uint64_t sent = 0;
+    for (uint64_t index = worker; index < options.generator.entries; index += workers) {
+        if (options.rate > 0) {
+            const uint64_t due = start + sent * workers * 1000000ULL / options.rate;
+            if (due > monotonicUsec()) {
+                sleepUntil(due);
+            }
+        }
+
+        generateRecord(options.generator, index, &record);
+        for (auto &[name, value] : record.fields) {
+            if (name == "MESSAGE") {
+                value = tag + " " + value;
+            }
+        }
+        sentAt[index] = monotonicUsec();
+        ret = sender.send(record);
+        if (ret < 0) {
+            printf("Failed to send entry: %s\n", strerror(-ret));
+            return ret;
+        }
+        sent++;
+    }
+    return 0;
+}
+
+// A sender per uid, to get the uid cardinality of a real system. Needs root.
+static int sendAsUsers(const Options &options, const std::string &tag, uint64_t *sentAt)
+{
+    const unsigned workers = geteuid() == 0 ? options.generator.users : 1;
+    if (workers == 1) {
+        if (options.generator.users > 1) {
+            printf("Not running as root, everything is sent as uid %u\n", geteuid());
+        }
+        return sendEntries(options, tag, 0, 1, sentAt);
+    }
+
+    std::vector<pid_t> children;
+    for (unsigned worker = 0; worker < workers; worker++) {
+        const pid_t pid = fork();
+        if (pid < 0) {
+            perror("Failed to start sender");
+            break;
+        }
+        if (pid == 0) {
+            // Same uids as the generator uses
+            const uid_t uid = worker == 0 ? 0 : 1000 + worker - 1;
+            if (setresuid(uid, uid, uid) < 0) {
+                perror("Failed to switch user");
+                _exit(1);
+            }
+            _exit(sendEntries(options, tag, worker, workers, sentAt) < 0 ? 1 : 0);
+        }
+        children.push_back(pid);
+    }
+
+    int ret = 0;
+    for (const pid_t pid : children) {
+        int status;
+        if (waitpid(pid, &status, 0) < 0 || !WIFEXITED(status) || WEXITSTATUS(status) != 0) {
+            ret = -EIO;
+        }
+    }
+    return ret;
+}
+
+// Reads the output of journal-watch and notes when each entry showed up
+class Watcher
+{
+public:
+    Watcher(const std::string &tag, uint64_t entries) :
+        m_tag(tag),
+        m_receivedAt(entries, 0)
+    {
+    }
+
+    int start(const Options &options)
+    {
+        int fds[2];
+        if (pipe2(fds, O_CLOEXEC) < 0) {
+            return -errno;
+        }
+        m_pid = fork();
+        if (m_pid < 0) {
+            return -errno;
+        }
+        if (m_pid == 0) {
+            dup2(fds[1], STDOUT_FILENO);
+            // Only the new entries, and only ours
+            std::vector<std::string> arguments = { options.watch, "-n", "0", "--grep", m_tag };
+            arguments.insert(arguments.end(), options.watchArguments.begin(), options.watchArguments.end());
+            std::vector<char*> argv;
+            for (std::string &argument : arguments) {
+                argv.push_back(argument.data());
+            }
+            argv.push_back(nullptr);
+            execvp(argv[0], argv.data());
+            fprintf(stderr, "Failed to run %s: %s\n", argv[0], strerror(errno));
+            _exit(127);
+        }
+        close(fds[1]);
+        m_output = fdopen(fds[0], "r");
+        m_reader = std::thread(&Watcher::readOutput, this);
+        return 0;
+    }
+
+    void stop()
+    {
+        if (m_pid > 0) {
+            kill(m_pid, SIGTERM);
+            waitpid(m_pid, nullptr, 0);
+            m_pid = -1;
+        }
+        if (m_reader.joinable()) {
+            m_reader.join();
+        }
+        if (m_output) {
+            fclose(m_output);
+            m_output = nullptr;
+        }
+    }
+
+    uint64_t received() const { return m_received; }
+    bool sawProbe() const { return m_sawProbe; }
+    const std::vector<uint64_t> &receivedAt() const { return m_receivedAt; }
+
+private:
+    void readOutput()
+    {
+        char *line = nullptr;
+        size_t size = 0;
+        ssize_t length;
+        while ((length = getline(&line, &size, m_output)) > 0) {
+            const uint64_t now = monotonicUsec();
+            const std::string_view text(line, length);
+            if (text.find(m_tag) == std::string_view::npos) {
+                continue;
+            }
+            if (text.find(probeMarker) != std::string_view::npos) {
+                m_sawProbe = true;
+                continue;
+            }
+
+            // The generated messages end with #index
+            const size_t hash = text.rfind('#');
+            if (hash == std::string_view::npos) {
+                continue;
+            }
+            size_t end = hash + 1;
+            while (end < text.size() && text[end] >= '0' && text[end] <= '9') {
+                end++;
+            }
+            uint64_t index;
+            if (!parseNumber(text.substr(hash + 1, end - hash - 1), &index) || index >= m_receivedAt.size()) {
+                continue;
+            }
+            if (m_receivedAt[index] == 0) {
+                m_receivedAt[index] = now;
+                m_received++;
+            }
+        }
+        free(line);
+    }
+
+    std::string m_tag;
+    pid_t m_pid = -1;
+    FILE *m_output = nullptr;
+    std::thread m_reader;
+
+    std::vector<uint64_t> m_receivedAt;
+    std::atomic<uint64_t> m_received { 0 };
+    std::atomic<bool> m_sawProbe { false };
+};
+
+static void printReport(const Options &options, const uint64_t *sentAt, const Watcher &watcher, uint64_t sendStart, uint64_t sendEnd)
+{
+    const uint64_t entries = options.generator.entries;
+    const double sendSeconds = std::max<uint64_t>(sendEnd - sendStart, 1) / 1e6;
+    printf("Sent %" PRIu64 " entries in %.2fs (%.0f/s)\n", entries, sendSeconds, entries / sendSeconds);
+    if (options.watch.empty()) {
+        return;
+    }
+
+    std::vector<uint64_t> lags;
+    uint64_t firstReceived = UINT64_MAX;
+    uint64_t lastReceived = 0;
+    for (uint64_t i = 0; i < entries; i++) {
+        const uint64_t receivedAt = watcher.receivedAt()[i];
+        if (receivedAt == 0) {
+            continue;
+        }
+        lags.push_back(receivedAt > sentAt[i] ? receivedAt - sentAt[i] : 0);
+        firstReceived = std::min(firstReceived, receivedAt);
+        lastReceived = std::max(lastReceived, receivedAt);
+    }
+    printf("Received %zu entries, %" PRIu64 " dropped\n", lags.size(), entries - lags.size());
+    if (lags.empty()) {
+        return;
+    }
+
+    const double receiveSeconds = std::max<uint64_t>(lastReceived - firstReceived, 1) / 1e6;
+    printf("Sustained %.0f entries/s\n", lags.size() / receiveSeconds);
+
+    std::sort(lags.begin(), lags.end());
+    auto percentile = [&](double fraction) {
+        return lags[std::min<size_t>(lags.size() * fraction, lags.size() - 1)] / 1000.;
+    };
+    printf("Lag: p50 %.2fms, p99 %.2fms, max %.2fms\n", percentile(0.5), percentile(0.99), lags.back() / 1000.);
+}
+
+static void printUsage(const char *name)
+{
+    printf("Usage: %s [OPTIONS] [-- JOURNAL-WATCH-OPTIONS]\n"
+           "Writes generated entries to the journal, and measures how journal-watch keeps up.\n"
+           "\n"
+           "  -e, --entries=N        Number of entries to send (default 100000)\n"
+           "  -r, --rate=N           Entries per second, 0 for as fast as possible (default 10000)\n"
+           "      --users=N          Number of different uids to send as, needs root (default 1)\n"
+           "      --identifiers=N    Number of different SYSLOG_IDENTIFIERs (default 30)\n"
+           "      --seed=N           Seed for the generated entries (default 1)\n"
+           "      --namespace=NS     Write to the journal namespace NS, for isolated runs\n"
+           "  -w, --watch[=PATH]     Run journal-watch (default ./journal-watch) on the entries and\n"
+           "                         report throughput, lag and dropped entries\n"
+           "      --drain=SECS       How long to wait for the last entries to show up (default 5)\n"
+           "  -h, --help             Show this help\n",
+           name);
+}
+
+int main(int argc, char *argv[])
+{
+    enum {
+        OptionUsers = 0x100,
+        OptionIdentifiers,
+        OptionSeed,
+        OptionNamespace,
+        OptionDrain
+    };
+    static const option longOptions[] = {
+        { "entries", required_argument, nullptr, 'e' },
+        { "rate", required_argument, nullptr, 'r' },
+        { "users", required_argument, nullptr, OptionUsers },
+        { "identifiers", required_argument, nullptr, OptionIdentifiers },
+        { "seed", required_argument, nullptr, OptionSeed },
+        { "namespace", required_argument, nullptr, OptionNamespace },
+        { "watch", optional_argument, nullptr, 'w' },
+        { "drain", required_argument, nullptr, OptionDrain },
+        { "help", no_argument, nullptr, 'h' },
+        { nullptr, 0, nullptr, 0 }
+    };
+
+    Options options;
+    options.generator.users = 1;
+    int opt;
+    while ((opt = getopt_long(argc, argv, "e:r:w::h", longOptions, nullptr)) != -1) {
+        bool valid = true;
+        switch(opt) {
+        case 'e':
+            valid = parseNumber(optarg, &options.generator.entries);
+            break;
+        case 'r':
+            valid = parseNumber(optarg, &options.rate);
+            break;
+        case OptionUsers:
+            valid = parseNumber(optarg, &options.generator.users) && options.generator.users > 0;
+            break;
+        case OptionIdentifiers:
+            valid = parseNumber(optarg, &options.generator.identifiers) && options.generator.identifiers > 0;
+            break;
+        case OptionSeed:
+            valid = parseNumber(optarg, &options.generator.seed);
+            break;
+        case OptionNamespace:
+            options.journalNamespace = optarg;
+            break;
+        case 'w':
+            options.watch = optarg ? optarg : "./journal-watch";
+            break;
+        case OptionDrain: {
+            uint64_t seconds;
+            valid = parseNumber(optarg, &seconds);
+            options.drain = seconds * 1000000ULL;
+            break;
+        }
+        case 'h':
+            printUsage(argv[0]);
+            return 0;
+        default:
+            printUsage(argv[0]);
+            return EINVAL;
+        }
+        if (!valid) {
+            printf("Invalid value for %s: %s\n", argv[optind - 1], optarg);
+            return EINVAL;
+        }
+    }
+    for (int i = optind; i < argc; i++) {
+        options.watchArguments.push_back(argv[i]);
+    }
+    if (!options.journalNamespace.empty()) {
+        options.watchArguments.push_back("--namespace=" + options.journalNamespace);
+    }
+
+    // So we only look at our own entries
+    char tag[64];
+    snprintf(tag, sizeof tag, "loadgen-%d-%" PRIu64, getpid(), monotonicUsec());
+
+    // Shared with the senders when sending as several users
+    const size_t sentAtSize = std::max<uint64_t>(options.generator.entries, 1) * sizeof(uint64_t);
+    void *mapping = mmap(nullptr, sentAtSize, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_ANONYMOUS, -1, 0);
+    if (mapping == MAP_FAILED) {
+        perror("Failed to allocate send times");
+        return errno;
+    }
+    uint64_t *sentAt = static_cast<uint64_t*>(mapping);
+
+    Watcher watcher(tag, options.generator.entries);
+    if (!options.watch.empty()) {
+        int ret = watcher.start(options);
+        if (ret < 0) {
+            printf("Failed to start journal-watch: %s\n", strerror(-ret));
+            return -ret;
+        }
+
+        // Wait until it's following before starting
+        Sender sender;
+        ret = sender.open(options.journalNamespace);
+        Record probe;
+        probe.fields = { { "MESSAGE", std::string(tag) + " " + probeMarker } };
+        const uint64_t giveUp = monotonicUsec() + 10000000ULL;
+        while (ret >= 0 && !watcher.sawProbe() && monotonicUsec() < giveUp) {
+            ret = sender.send(probe);
+            sleepUntil(monotonicUsec() + 200000);
+        }
+        if (!watcher.sawProbe()) {
+            puts("journal-watch didn't show anything we sent");
+            watcher.stop();
+            return ETIMEDOUT;
+        }
+    }
+
+    const uint64_t sendStart = monotonicUsec();
+    const int ret = sendAsUsers(options, tag, sentAt);
+    const uint64_t sendEnd = monotonicUsec();
+
+    if (!options.watch.empty()) {
+        // Until everything is there, or nothing new has shown up for a while
+        uint64_t lastCount = 0;
+        uint64_t lastChange = monotonicUsec();
+        while (watcher.received() < options.generator.entries && monotonicUsec() - lastChange < options.drain) {
+            sleepUntil(monotonicUsec() + 10000);
+            if (watcher.received() != lastCount) {
+                lastCount = watcher.received();
+                lastChange = monotonicUsec();
+            }
+        }
+        watcher.stop();
+    }
+
+    printReport(options, sentAt, watcher, sendStart, sendEnd);
+    munmap(mapping, sentAtSize);
+    return ret < 0 ? -ret : 0;
+}
@@ -0,0 +1,222 @@
+#include "loss-detector.h"
+
+extern "C" {
+#include <stdio.h>
+} // extern "C"
+
+#include <algorithm>
+#include <string_view>
+
+namespace {
+
+// How long (in entry time) the entries from other files can be behind
+constexpr uint64_t settleTime = 1000000;
+// More than this and they're counted right away
+constexpr size_t maxHoles = 256;
+// Enough for lots of gaps, or files from lots of machines
+constexpr size_t maxRanges = 65536;
+
+// SD_MESSAGE_JOURNAL_DROPPED, "Suppressed 123 messages from foo.service"
+constexpr std::string_view droppedMessageId = "fe6faa94e7774663a0da52717891d8ef";
+// SD_MESSAGE_JOURNAL_MISSED, "Missed 123 kernel messages"
+constexpr std::string_view missedMessageId = "e9bf28e6e834481bb6f48f548ad13606";
+
+void appendCount(std::string *out, uint64_t count, const char *singular, const char *plural)
+{
+    out->append(std::to_string(count));
+    out->push_back(' ');
+    out->append(count == 1 ? singular : plural);
+}
+
+} // namespace
+
+bool LossDetector::checkSequence(const Entry &entry)
+{
+    // Nothing to go by
+    if (entry.seqnum == 0) {
+        return true;
+    }
+    countHoles(entry.realtime);
+
+    if (entry.seqnumId != m_seqnumId) {
+        if (m_seqnum != 0) {
+            m_sequences[m_seqnumId] = m_seqnum;
+        }
+        const auto it = m_sequences.find(entry.seqnumId);
+        m_seqnumId = entry.seqnumId;
+        m_seqnum = it != m_sequences.end() ? it->second : 0;
+    }
+    // The first one we see from this file
+    if (m_seqnum == 0) {
+        return true;
+    }
+    if (entry.seqnum <= m_seqnum) {
+        return false;
+    }
+    if (entry.seqnum > m_seqnum + 1) {
+        addHole(m_seqnum + 1, entry.seqnum, entry.realtime);
+    }
+    return true;
+}
+
+void LossDetector::addHole(uint64_t begin, uint64_t end, uint64_t realtime)
+{
+    if (countSeen(begin, end) == end - begin) {
+        return;
+    }
+    if (m_holes.size() >= maxHoles) {
+        countHoles(UINT64_MAX);
+    }
+    m_holes.push_back({ begin, end, realtime });
+}
+
+// Counts what's still missing from the holes that are old enough
+void LossDetector::countHoles(uint64_t realtime)
+{
+    for (auto it = m_holes.begin(); it != m_holes.end();) {
+        if (realtime != UINT64_MAX && realtime <= it->realtime + settleTime) {
+            ++it;
+            continue;
+        }
+        const uint64_t missing = it->end - it->begin - countSeen(it->begin, it->end);
+        m_missing += missing;
+        m_totalMissing += missing;
+        // So the gaps in the other files don't count them again
+        markSeen(it->begin, it->end);
+        it = m_holes.erase(it);
+    }
+}
+
+void LossDetector::markSeen(uint64_t seqnum)
+{
+    if (seqnum == 0) {
+        return;
+    }
+    // Usually it just extends the last range
+    if (m_lastSeen != m_seen.end() && m_lastSeen->second == seqnum) {
+        const auto next = std::next(m_lastSeen);
+        if (next == m_seen.end() || next->first > seqnum + 1) {
+            m_lastSeen->second++;
+            return;
+        }
+    }
+    if (m_seen.size() >= maxRanges) {
+        m_seen.erase(m_seen.begin());
+    }
+    markSeen(seqnum, seqnum + 1);
+}
+
+void LossDetector::markSeen(uint64_t begin, uint64_t end)
+{
+    // Merged with everything it overlaps or touches
+    auto it = m_seen.upper_bound(begin);
+    if (it != m_seen.begin() && std::prev(it)->second >= begin) {
+        --it;
+        begin = it->first;
+    }
+    while (it != m_seen.end() && it->first <= end) {
+        end = std::max(end, it->second);
+        it = m_seen.erase(it);
+    }
+    m_lastSeen = m_seen.emplace_hint(it, begin, end);
+}
+
+uint64_t LossDetector::countSeen(uint64_t begin, uint64_t end) const
+{
+    uint64_t count = 0;
+    auto it = m_seen.upper_bound(begin);
+    if (it != m_seen.begin()) {
+        --it;
+    }
+    for (; it != m_seen.end() && it->first < end; ++it) {
+        const uint64_t from = std::max(it->first, begin);
+        const uint64_t to = std::min(it->second, end);
+        if (from < to) {
+            count += to - from;
+        }
+    }
+    return count;
+}
+
+void LossDetector::checkMessage(const Entry &entry)
+{
+    const bool dropped = entry.messageId == droppedMessageId;
+    if (!dropped && entry.messageId != missedMessageId) {
+        return;
+    }
+
+    // The count is the second word in both
+    std::string_view message = entry.message;
+    const size_t start = message.find(' ');
+    if (start == std::string_view::npos) {
+        return;
+    }
+    message.remove_prefix(start + 1);
+    Suppressed suppressed = { entry.seqnum, 0, {} };
+    if (!parseNumber(message.substr(0, std::min(message.find(' '), message.size())), &suppressed.count)) {
+        return;
+    }
+    const size_t from = message.find(" from ");
+    if (dropped && from != std::string_view::npos) {
+        suppressed.source = message.substr(from + 6);
+    }
+    m_totalSuppressed += suppressed.count;
+    m_suppressed.push_back(std::move(suppressed));
+}
+
+void LossDetector::showPending(const Entry &next)
+{
+    printPending(next.seqnum);
+}
+
+void LossDetector::finish()
+{
+    countHoles(UINT64_MAX);
+    printPending(0);
+
+    if (m_totalMissing == 0 && m_totalSuppressed == 0) {
+        return;
+    }
+    std::string totals = "\033[02;37m-- In total ";
+    appendCount(&totals, m_totalMissing, "entry", "entries");
+    totals.append(" missing, and ");
+    appendCount(&totals, m_totalSuppressed, "message", "messages");
+    totals.append(" suppressed or missed by journald --\033[0m\n");
+    fwrite(totals.data(), 1, totals.size(), stdout);
+}
+
+void LossDetector::printPending(uint64_t nextSeqnum)
+{
+    // Like journalctl's "-- Boot ... --" lines
+    std::string markers;
+    if (m_missing > 0) {
+        markers.append("\033[02;37m-- ");
+        appendCount(&markers, m_missing, "entry", "entries");
+        markers.append(" missing from the journal (");
+        markers.append(std::to_string(m_totalMissing));
+        markers.append(" so far) --\033[0m\n");
+    }
+    for (const Suppressed &suppressed : m_suppressed) {
+        // No point in saying it right before the message that says it
+        if (suppressed.seqnum != 0 && suppressed.seqnum == nextSeqnum) {
+            continue;
+        }
+        markers.append("\033[02;37m-- journald ");
+        if (suppressed.source.empty()) {
+            markers.append("missed ");
+            appendCount(&markers, suppressed.count, "kernel message", "kernel messages");
+        } else {
+            markers.append("suppressed ");
+            appendCount(&markers, suppressed.count, "message", "messages");
+            markers.append(" from ");
+            markers.append(suppressed.source);
+        }
+        markers.append(" (");
+        markers.append(std::to_string(m_totalSuppressed));
+        markers.append(" so far) --\033[0m\n");
+    }
+    fwrite(markers.data(), 1, markers.size(), stdout);
+
+    m_missing = 0;
+    m_suppressed.clear();
+}
@@ -0,0 +1,104 @@
+#pragma once
+
+#include "entry.h"
+
+#include <cstdint>
+#include <map>
+#include <string>
+#include <unordered_map>
+#include <vector>
+
+// Notices where journald lost entries. It numbers everything it writes
+// consecutively, so a seqnum that never shows up means an entry was dropped,
+// or is in a file we can't read. When it rate limits a service, or can't keep
+// up with the kernel, it logs how many messages it didn't write.
+//
+// Gaps are looked for per __SEQNUM_ID, but the counter can be shared by files
+// with different ids, and they're merged by time, so the entries from
+// different files aren't quite in seqnum order. So a gap only counts what no
+// file has had, once the entries have moved on from it for a while.
+class LossDetector
+{
+public:
+    // Without countMissing only what journald says it dropped is shown. The
+    // gaps are meaningless when we can't read everything it wrote.
+    explicit LossDetector(bool countMissing = true) : m_countMissing(countMissing) {}
+
+    // Called for every entry in the order they're read, whether it's shown
+    // or not, which needs FieldSeqnum, FieldMessageId and FieldMessage. Only
+    // the seqnum is compared unless there's a gap, it's from another file, or
+    // it's a message from journald.
+    void check(const Entry &entry)
+    {
+        if (!m_countMissing) {
+            if (!entry.messageId.empty()) {
+                checkMessage(entry);
+            }
+            return;
+        }
+        markSeen(entry.seqnum);
+        if ((entry.seqnum != m_seqnum + 1 || entry.seqnumId != m_seqnumId || !m_holes.empty()) && !checkSequence(entry)) {
+            return;
+        }
+        m_seqnum = entry.seqnum;
+        if (!entry.messageId.empty()) {
+            checkMessage(entry);
+        }
+    }
+
+    bool hasPending() const { return m_missing > 0 || !m_suppressed.empty(); }
+
+    // Prints what was lost since the last time, before the entry is shown,
+    // unless it's the message about it
+    void showPending(const Entry &next);
+
+    // At the end, counts the gaps that haven't been filled and prints the
+    // totals if anything was lost
+    void finish();
+
+private:
+    struct Hole {
+        // Seqnums from begin up to end haven't been seen
+        uint64_t begin;
+        uint64_t end;
+        // Of the entry after it
+        uint64_t realtime;
+    };
+
+    struct Suppressed {
+        uint64_t seqnum;
+        uint64_t count;
+        // The unit, or empty for kernel messages
+        std::string source;
+    };
+
+    // False if it's been seen already
+    bool checkSequence(const Entry &entry);
+    void checkMessage(const Entry &entry);
+    void addHole(uint64_t begin, uint64_t end, uint64_t realtime);
+    void countHoles(uint64_t realtime);
+    void markSeen(uint64_t seqnum);
+    void markSeen(uint64_t begin, uint64_t end);
+    uint64_t countSeen(uint64_t begin, uint64_t end) const;
+    void printPending(uint64_t nextSeqnum);
+
+    bool m_countMissing;
+    uint64_t m_seqnum = 0;
+    uint64_t m_seqnumId = 0;
+    // The last seqnum in the other files, and from other machines or journald
+    // installations
+    std::unordered_map<uint64_t, uint64_t> m_sequences;
+
+    // All the seqnums from any file, as ranges from begin up to end. They're
+    // mostly consecutive, so it's usually just extending the last one.
+    std::map<uint64_t, uint64_t> m_seen;
+    std::map<uint64_t, uint64_t>::iterator m_lastSeen = m_seen.end();
+    std::vector<Hole> m_holes;
+
+    // Not shown yet
+    uint64_t m_missing = 0;
+    std::vector<Suppressed> m_suppressed;
+
+    uint64_t m_totalMissing = 0;
+    uint64_t m_totalSuppressed = 0;
+};
@@ -0,0 +1,266 @@
+#include "process-info.h"
+
+extern "C" {
+#include <fcntl.h>
+#include <poll.h>
+#include <sys/resource.h>
+#include <sys/syscall.h>
+#include <time.h>
+#include <unistd.h>
+} // extern "C"
+
+#include <algorithm>
+#include <string_view>
+#include <vector>
+
+namespace {
+
+// Anything more than this running at the same time and we start over
+constexpr size_t maxProcesses = 4096;
+// At most this many pidfds, and a quarter of the file descriptor limit
+constexpr size_t maxPidfds = 1024;
+// How often (in usec) we check which processes have exited
+constexpr uint64_t sweepInterval = 1000000;
+constexpr size_t maxCommandLine = 80;
+
+uint64_t clockUsec(clockid_t clock)
+{
+    timespec now;
+    clock_gettime(clock, &now);
+    return now.tv_sec * 1000000ULL + now.tv_nsec / 1000;
+}
+
+// The start times in /proc are in ticks since boot
+uint64_t startRealtime(uint64_t startTime)
+{
+    static const uint64_t boot = clockUsec(CLOCK_REALTIME) - clockUsec(CLOCK_BOOTTIME);
+    static const uint64_t ticks = sysconf(_SC_CLK_TCK);
+    return boot + startTime * 1000000 / ticks;
+}
+
+bool readFile(const std::string &path, std::string *contents)
+{
+    const int fd = open(path.c_str(), O_RDONLY | O_CLOEXEC);
+    if (fd < 0) {
+        return false;
+    }
+    contents->clear();
+    char buffer[4096];
+    ssize_t ret;
+    while ((ret = read(fd, buffer, sizeof buffer)) > 0) {
+        contents->append(buffer, ret);
+    }
+    close(fd);
+    return ret == 0;
+}
+
+// The parent and the start time, in ticks since boot
+bool readStat(uint32_t pid, uint32_t *parentPid, uint64_t *startTime)
+{
+    std::string stat;
+    if (!readFile("/proc/" + std::to_string(pid) + "/stat", &stat)) {
+        return false;
+    }
+    // The name can have spaces and parentheses in it
+    const size_t nameEnd = stat.rfind(')');
+    if (nameEnd == std::string::npos) {
+        return false;
+    }
+    std::string_view rest = std::string_view(stat).substr(nameEnd + 1);
+    // state is the third field, ppid the fourth and starttime the 22nd
+    std::vector<std::string_view> fields;
+    while (!rest.empty() && fields.size() < 20) {
+        const size_t start = rest.find_first_not_of(' ');
+        if (start == std::string_view::npos) {
+            break;
+        }
+        rest = rest.substr(start);
+        const size_t end = std::min(rest.find(' '), rest.size());
+        fields.push_back(rest.substr(0, end));
+        rest = rest.substr(end);
+    }
+    return fields.size() == 20 && parseNumber(fields[1], parentPid) && parseNumber(fields[19], startTime);
+}
+
+// Docker, podman, containerd and kubernetes all put the 64 character id
+// somewhere in the cgroup path
+std::string containerId(const std::string &cgroups)
+{
+    size_t run = 0;
+    for (size_t i = 0; i < cgroups.size(); i++) {
+        const char c = cgroups[i];
+        if ((c >= '0' && c <= '9') || (c >= 'a' && c <= 'f')) {
+            run++;
+            continue;
+        }
+        if (run == 64) {
+            return cgroups.substr(i - run, 12);
+        }
+        run = 0;
+    }
+    return run == 64 ? cgroups.substr(cgroups.size() - run, 12) : std::string();
+}
+
+int openPidfd(uint32_t pid)
+{
+#ifdef SYS_pidfd_open
+    return syscall(SYS_pidfd_open, pid, 0);
+#else
+    (void)pid;
+    return -1;
+#endif
+}
+
+bool readProcess(uint32_t pid, ProcessInfo *info)
+{
+    // Opened first, so if it's alive after reading everything we know that
+    // what we read is from the process the pidfd refers to
+    info->pidfd = openPidfd(pid);
+
+    uint64_t startTime;
+    const std::string directory = "/proc/" + std::to_string(pid) + "/";
+    std::string cgroups;
+    if (!readStat(pid, &info->parentPid, &startTime) ||
+            !readFile(directory + "cmdline", &info->commandLine) ||
+            !readFile(directory + "cgroup", &cgroups)) {
+        return false;
+    }
+    info->startRealtime = startRealtime(startTime);
+
+    // The arguments are separated by (and end with) nuls
+    while (!info->commandLine.empty() && info->commandLine.back() == '\0') {
+        info->commandLine.pop_back();
+    }
+    std::replace(info->commandLine.begin(), info->commandLine.end(), '\0', ' ');
+    if (info->commandLine.size() > maxCommandLine) {
+        // Not in the middle of a UTF-8 sequence
+        size_t end = maxCommandLine - 3;
+        while (end > 0 && (static_cast<unsigned char>(info->commandLine[end]) & 0xc0) == 0x80) {
+            end--;
+        }
+        info->commandLine.resize(end);
+        info->commandLine += "...";
+    }
+    info->container = containerId(cgroups);
+
+    if (readFile("/proc/" + std::to_string(info->parentPid) + "/comm", &info->parentName) && !info->parentName.empty()) {
+        info->parentName.pop_back();
+    }
+
+    if (info->pidfd >= 0) {
+        pollfd pollFd = { info->pidfd, POLLIN, 0 };
+        if (poll(&pollFd, 1, 0) != 0) {
+            return false;
+        }
+    }
+    return true;
+}
+
+} // namespace
+
+ProcessCache::ProcessCache()
+{
+    rlimit limit;
+    if (getrlimit(RLIMIT_NOFILE, &limit) == 0) {
+        m_maxPidfds = limit.rlim_cur == RLIM_INFINITY ? maxPidfds : std::min<size_t>(limit.rlim_cur / 4, maxPidfds);
+    }
+}
+
+ProcessCache::~ProcessCache()
+{
+    clear();
+}
+
+const ProcessInfo *ProcessCache::lookup(const Entry &entry)
+{
+    if (entry.pidNumber == InvalidId) {
+        return nullptr;
+    }
+    if (clockUsec(CLOCK_MONOTONIC_COARSE) - m_lastSweep >= sweepInterval) {
+        sweep();
+    }
+
+    auto it = m_processes.find(entry.pidNumber);
+    if (it == m_processes.end()) {
+        if (m_processes.size() >= maxProcesses) {
+            clear();
+        }
+        ProcessInfo info;
+        if (!readProcess(entry.pidNumber, &info)) {
+            if (info.pidfd >= 0) {
+                close(info.pidfd);
+            }
+            // Remembered until the next sweep, so we don't look for it for every line
+            info = ProcessInfo();
+            info.exited = true;
+        } else if (info.pidfd >= 0 && m_pidfds >= m_maxPidfds) {
+            close(info.pidfd);
+            info.pidfd = -1;
+        } else if (info.pidfd >= 0) {
+            m_pidfds++;
+        }
+        it = m_processes.emplace(entry.pidNumber, std::move(info)).first;
+    }
+
+    const ProcessInfo &info = it->second;
+    // Allows for the start time only being in ticks
+    if (info.exited || entry.realtime + 10000 < info.startRealtime) {
+        return nullptr;
+    }
+    return &info;
+}
+
+void ProcessCache::sweep()
+{
+    m_lastSweep = clockUsec(CLOCK_MONOTONIC_COARSE);
+
+    std::vector<pollfd> pidfds;
+    std::vector<uint32_t> pids;
+    for (auto it = m_processes.begin(); it != m_processes.end();) {
+        const ProcessInfo &info = it->second;
+        if (info.exited) {
+            it = m_processes.erase(it);
+            continue;
+        }
+        if (info.pidfd >= 0) {
+            pidfds.push_back({ info.pidfd, POLLIN, 0 });
+            pids.push_back(it->first);
+            ++it;
+            continue;
+        }
+        // No pidfds, so check that it's still the same process
+        uint32_t parentPid;
+        uint64_t startTime;
+        if (!readStat(it->first, &parentPid, &startTime) || startRealtime(startTime) != info.startRealtime) {
+            it = m_processes.erase(it);
+        } else {
+            ++it;
+        }
+    }
+
+    // A pidfd is readable when the process has exited
+    if (pidfds.empty() || poll(pidfds.data(), pidfds.size(), 0) <= 0) {
+        return;
+    }
+    for (size_t i = 0; i < pidfds.size(); i++) {
+        if (pidfds[i].revents) {
+            evict(m_processes.find(pids[i]));
+        }
+    }
+}
+
+void ProcessCache::evict(std::unordered_map<uint32_t, ProcessInfo>::iterator it)
+{
+    if (it->second.pidfd >= 0) {
+        close(it->second.pidfd);
+        m_pidfds--;
+    }
+    m_processes.erase(it);
+}
+
+void ProcessCache::clear()
+{
+    while (!m_processes.empty()) {
+        evict(m_processes.begin());
+    }
+}
@@ -0,0 +1,56 @@
+#pragma once
+
+#include "entry.h"
+
+#include <cstdint>
+#include <string>
+#include <unordered_map>
+
+// What /proc knows about the process that logged an entry
+struct ProcessInfo {
+    std::string commandLine;
+    uint32_t parentPid = InvalidId;
+    std::string parentName;
+    // Shortened container id, empty if it's not in a container
+    std::string container;
+
+    // When it started, in realtime usec, so entries from an earlier process
+    // with the same pid aren't attributed to it
+    uint64_t startRealtime = 0;
+    // Not running (anymore) when we looked
+    bool exited = false;
+    // For noticing when it exits, -1 if pidfds aren't supported
+    int pidfd = -1;
+};
+
+// Reads /proc once per process and keeps it until the process exits, which
+// is noticed by polling the pidfds (or rereading the start time without them)
+// every now and then. So the lookup for every entry is just a hash lookup.
+// There are only pidfds for as many processes as the file descriptor limit
+// leaves room for.
+class ProcessCache
+{
+public:
+    ProcessCache();
+    ~ProcessCache();
+
+    ProcessCache(const ProcessCache &) = delete;
+    ProcessCache &operator=(const ProcessCache &) = delete;
+
+    // Null if the process that logged it isn't running anymore
+    const ProcessInfo *lookup(const Entry &entry);
+
+private:
+    void sweep();
+    void evict(std::unordered_map<uint32_t, ProcessInfo>::iterator it);
+    void clear();
+
+    std::unordered_map<uint32_t, ProcessInfo> m_processes;
+    // The pidfds are file descriptors, which libsystemd needs as well, so
+    // only a part of them is used. The other processes fall back to checking
+    // the start time.
+    size_t m_maxPidfds = 0;
+    size_t m_pidfds = 0;
+    // Monotonic usec
+    uint64_t m_lastSweep = 0;
+};
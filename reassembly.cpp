@@ -0,0 +1,159 @@
+#include "reassembly.h"
+
+extern "C" {
+#include <time.h>
+} // extern "C"
+
+#include <algorithm>
+
+namespace {
+
+// Traces longer than this are shown in parts, and so are the ones that are
+// still going after maxDelay when following.
+constexpr size_t maxLines = 500;
+constexpr size_t maxBytes = 256 * 1024;
+constexpr uint64_t maxDelay = 1000000;
+// More processes than this logging at the same time and the oldest is shown
+constexpr size_t maxGroups = 256;
+
+uint64_t monotonicUsec()
+{
+    timespec now;
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    return now.tv_sec * 1000000ULL + now.tv_nsec / 1000;
+}
+
+bool startsWith(std::string_view string, std::string_view prefix)
+{
+    return string.substr(0, prefix.size()) == prefix;
+}
+
+// "ValueError: ..." or "requests.exceptions.ConnectionError"
+bool looksLikeException(std::string_view line)
+{
+    const std::string_view name = line.substr(0, line.find(':'));
+    if (name.empty() || name.find(' ') != std::string_view::npos) {
+        return false;
+    }
+    static const std::string_view suffixes[] = { "Error", "Exception", "Interrupt", "Exit" };
+    return std::any_of(std::begin(suffixes), std::end(suffixes), [&](std::string_view suffix) {
+        return name.size() >= suffix.size() && name.substr(name.size() - suffix.size()) == suffix;
+    });
+}
+
+} // namespace
+
+Reassembler::Reassembler(uint64_t window, std::function<void(const Entry &entry)> show) :
+    m_window(window),
+    m_show(std::move(show))
+{
+}
+
+bool Reassembler::isContinuation(std::string_view line, bool inTraceback)
+{
+    if (!line.empty() && (line[0] == ' ' || line[0] == '\t')) {
+        return true;
+    }
+    // Java, in case the tabs have been stripped
+    if (startsWith(line, "at ") || startsWith(line, "Caused by: ") || startsWith(line, "Suppressed: ") || startsWith(line, "... ")) {
+        return true;
+    }
+    if (!inTraceback) {
+        return false;
+    }
+    // The exception at the end, and chained exceptions
+    return line.empty() || looksLikeException(line) ||
+        startsWith(line, "Traceback (most recent call last)") ||
+        startsWith(line, "During handling of the above exception") ||
+        startsWith(line, "The above exception was the direct cause");
+}
+
+void Reassembler::add(const Entry &entry)
+{
+    const uint64_t now = monotonicUsec();
+
+    // Nothing can be added to what's older than the window
+    for (Group &group : m_groups) {
+        if (entry.realtime > group.lastRealtime + m_window) {
+            group.finished = true;
+        }
+    }
+
+    auto group = std::find_if(m_groups.begin(), m_groups.end(), [&](const Group &group) {
+        return !group.finished && group.entry.pidNumber == entry.pidNumber;
+    });
+    if (entry.pidNumber != InvalidId && group != m_groups.end()) {
+        if (isContinuation(entry.message, group->inTraceback) && group->lines < maxLines &&
+                group->entry.message.size() + entry.message.size() < maxBytes) {
+            group->entry.message += '\n';
+            group->entry.message += entry.message;
+            group->lines++;
+            group->lastRealtime = std::max(group->lastRealtime, entry.realtime);
+            group->lastArrival = now;
+            group->inTraceback = group->inTraceback || startsWith(entry.message, "Traceback (most recent call last)");
+            showFinished();
+            return;
+        }
+        group->finished = true;
+    }
+
+    if (m_groups.size() >= maxGroups) {
+        m_groups.front().finished = true;
+        showFinished();
+    }
+    // Without a _PID there's nothing to join it with, but it still has to
+    // wait for what came before it
+    m_groups.push_back({ entry, 1, entry.realtime, now, now, startsWith(entry.message, "Traceback (most recent call last)"), entry.pidNumber == InvalidId });
+    showFinished();
+}
+
+uint64_t Reassembler::deadline(const Group &group) const
+{
+    return std::min(group.lastArrival + m_window, group.firstArrival + maxDelay);
+}
+
+void Reassembler::flushExpired()
+{
+    const uint64_t now = monotonicUsec();
+    for (Group &group : m_groups) {
+        if (deadline(group) <= now) {
+            group.finished = true;
+        }
+    }
+    showFinished();
+}
+
+void Reassembler::flushAll()
+{
+    for (Group &group : m_groups) {
+        group.finished = true;
+    }
+    showFinished();
+}
+
+uint64_t Reassembler::timeout() const
+{
+    uint64_t first = UINT64_MAX;
+    for (const Group &group : m_groups) {
+        if (!group.finished) {
+            first = std::min(first, deadline(group));
+        }
+    }
+    if (first == UINT64_MAX) {
+        return uint64_t(-1);
+    }
+    const uint64_t now = monotonicUsec();
+    return first > now ? first - now : 0;
+}
+
+// Finished groups wait for the ones that started before them, so the order
+// is kept
+void Reassembler::showFinished()
+{
+    size_t count = 0;
+    while (count < m_groups.size() && m_groups[count].finished) {
+        m_show(m_groups[count].entry);
+        count++;
+    }
+    m_groups.erase(m_groups.begin(), m_groups.begin() + count);
+}
@@ -0,0 +1,53 @@
+#pragma once
+
+#include "entry.h"
+
+#include <cstdint>
+#include <functional>
+#include <string_view>
+#include <vector>
+
+// Stack traces from Java and Python end up as one entry per line. This groups
+// the lines that look like the continuation of the previous entry from the
+// same _PID into one entry, with the messages joined by newlines, so they're
+// shown with a single prefix.
+class Reassembler
+{
+public:
+    // window is how far apart (in usec) the lines of one trace can be logged
+    Reassembler(uint64_t window, std::function<void(const Entry &entry)> show);
+
+    void add(const Entry &entry);
+
+    // Shows what can't get any more lines, or has been held back for too long
+    void flushExpired();
+    void flushAll();
+
+    // Usec until flushExpired() has something to do, -1 if nothing is held back
+    uint64_t timeout() const;
+
+    static bool isContinuation(std::string_view line, bool inTraceback);
+
+private:
+    struct Group {
+        Entry entry;
+        size_t lines;
+        uint64_t lastRealtime;
+        // Monotonic usec, for the latency cap when following
+        uint64_t firstArrival;
+        uint64_t lastArrival;
+        // Python tracebacks end with an unindented line with the exception
+        bool inTraceback;
+        // Nothing more can be added, but it might be waiting to be shown
+        bool finished;
+    };
+
+    uint64_t deadline(const Group &group) const;
+    void showFinished();
+
+    uint64_t m_window;
+    std::function<void(const Entry &entry)> m_show;
+
+    // In the order they started, there's rarely more than a few
+    std::vector<Group> m_groups;
+};
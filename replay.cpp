@@ -0,0 +1,110 @@
+#include "replay.h"
+
+extern "C" {
+#include <errno.h>
+#include <sys/epoll.h>
+#include <sys/timerfd.h>
+#include <time.h>
+#include <unistd.h>
+} // extern "C"
+
+#include <cmath>
+
+namespace {
+
+uint64_t monotonicNsec()
+{
+    timespec now;
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    return now.tv_sec * 1000000000ULL + now.tv_nsec;
+}
+
+} // namespace
+
+ReplayClock::ReplayClock(double speed) :
+    m_speed(speed)
+{
+}
+
+ReplayClock::~ReplayClock()
+{
+    if (m_timer >= 0) {
+        close(m_timer);
+    }
+    if (m_epoll >= 0) {
+        close(m_epoll);
+    }
+}
+
+int ReplayClock::open()
+{
+    m_timer = timerfd_create(CLOCK_MONOTONIC, TFD_CLOEXEC);
+    if (m_timer < 0) {
+        return -errno;
+    }
+    m_epoll = epoll_create1(EPOLL_CLOEXEC);
+    if (m_epoll < 0) {
+        return -errno;
+    }
+    epoll_event event = {};
+    event.events = EPOLLIN;
+    event.data.fd = m_timer;
+    if (epoll_ctl(m_epoll, EPOLL_CTL_ADD, m_timer, &event) < 0) {
+        return -errno;
+    }
+    return 0;
+}
+
+uint64_t ReplayClock::dueTime(uint64_t realtime) const
+{
+    // Entries can be a bit out of order when files are interleaved
+    const uint64_t offset = realtime > m_firstRealtime ? realtime - m_firstRealtime : 0;
+    return m_start + uint64_t(offset * 1000. / m_speed);
+}
+
+bool ReplayClock::isDue(uint64_t realtime)
+{
+    if (!m_started) {
+        m_started = true;
+        m_firstRealtime = realtime;
+        m_start = m_now = monotonicNsec();
+        return true;
+    }
+    if (std::isinf(m_speed)) {
+        return true;
+    }
+
+    const uint64_t due = dueTime(realtime);
+    if (due <= m_now) {
+        return true;
+    }
+    m_now = monotonicNsec();
+    return due <= m_now;
+}
+
+int ReplayClock::waitUntilDue(uint64_t realtime)
+{
+    const uint64_t due = dueTime(realtime);
+    itimerspec deadline = {};
+    deadline.it_value.tv_sec = due / 1000000000ULL;
+    deadline.it_value.tv_nsec = due % 1000000000ULL;
+    if (timerfd_settime(m_timer, TFD_TIMER_ABSTIME, &deadline, nullptr) < 0) {
+        return -errno;
+    }
+
+    epoll_event event;
+    int ret;
+    do {
+        ret = epoll_wait(m_epoll, &event, 1, -1);
+    } while (ret < 0 && errno == EINTR);
+    if (ret < 0) {
+        return -errno;
+    }
+
+    uint64_t expirations;
+    if (read(m_timer, &expirations, sizeof expirations) < 0 && errno != EAGAIN) {
+        return -errno;
+    }
+    m_now = due;
+    return 0;
+}
@@ -0,0 +1,42 @@
+#pragma once
+
+#include <cstdint>
+
+// Paces entries for --replay, so they come out with the same time between
+// them as when they were logged, divided by the speed. Waiting is done with a
+// timerfd with an absolute deadline in an epoll, so it doesn't drift however
+// long the output takes.
+class ReplayClock
+{
+public:
+    // Infinite speed never waits
+    explicit ReplayClock(double speed);
+    ~ReplayClock();
+
+    ReplayClock(const ReplayClock &) = delete;
+    ReplayClock &operator=(const ReplayClock &) = delete;
+
+    int open();
+
+    // Whether the entry logged at realtime should be shown by now. Entries
+    // that are already due are let through without even reading the clock,
+    // so catching up after a wait goes as fast as the output. The first entry
+    // is always due, and starts the clock.
+    bool isDue(uint64_t realtime);
+
+    // Sleeps until the entry is due
+    int waitUntilDue(uint64_t realtime);
+
+private:
+    uint64_t dueTime(uint64_t realtime) const;
+
+    double m_speed;
+    int m_epoll = -1;
+    int m_timer = -1;
+
+    bool m_started = false;
+    uint64_t m_firstRealtime = 0;
+    // CLOCK_MONOTONIC in nsec
+    uint64_t m_start = 0;
+    uint64_t m_now = 0;
+};
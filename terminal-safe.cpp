@@ -0,0 +1,157 @@
+#include "terminal-safe.h"
+
+#ifdef __SSE2__
+#include <emmintrin.h>
+#endif
+
+namespace {
+
+bool isContinuation(unsigned char c)
+{
+    return (c & 0xc0) == 0x80;
+}
+
+// The length of the UTF-8 sequence at text[i], 0 if it's invalid (overlong,
+// a surrogate, past U+10FFFF or cut off), or a C1 control character unless
+// they're allowed
+size_t sequenceLength(std::string_view text, size_t i, bool allowC1 = false)
+{
+    const unsigned char c = text[i];
+    const size_t left = text.size() - i;
+    if (c >= 0xc2 && c <= 0xdf) {
+        if (left < 2 || !isContinuation(text[i + 1])) {
+            return 0;
+        }
+        // U+0080 to U+009F
+        return !allowC1 && c == 0xc2 && (unsigned char)text[i + 1] < 0xa0 ? 0 : 2;
+    }
+    if (c >= 0xe0 && c <= 0xef) {
+        if (left < 3 || !isContinuation(text[i + 1]) || !isContinuation(text[i + 2])) {
+            return 0;
+        }
+        const unsigned char second = text[i + 1];
+        if ((c == 0xe0 && second < 0xa0) || (c == 0xed && second >= 0xa0)) {
+            return 0;
+        }
+        return 3;
+    }
+    if (c >= 0xf0 && c <= 0xf4) {
+        if (left < 4 || !isContinuation(text[i + 1]) || !isContinuation(text[i + 2]) || !isContinuation(text[i + 3])) {
+            return 0;
+        }
+        const unsigned char second = text[i + 1];
+        if ((c == 0xf0 && second < 0x90) || (c == 0xf4 && second >= 0x90)) {
+            return 0;
+        }
+        return 4;
+    }
+    return 0;
+}
+
+bool isSafeAscii(unsigned char c)
+{
+    return (c >= 0x20 && c < 0x7f) || c == '\n' || c == '\t';
+}
+
+} // namespace
+
+size_t firstUnsafe(std::string_view text, size_t start)
+{
+    size_t i = start;
+    while (i < text.size()) {
+#ifdef __SSE2__
+        // Skips ahead to the first byte that is a control character or not
+        // ASCII. The comparison is signed, so the latter are below 0x20 too.
+        const __m128i space = _mm_set1_epi8(0x20);
+        const __m128i del = _mm_set1_epi8(0x7f);
+        const __m128i newline = _mm_set1_epi8('\n');
+        const __m128i tab = _mm_set1_epi8('\t');
+        while (i + 16 <= text.size()) {
+            const __m128i chunk = _mm_loadu_si128(reinterpret_cast<const __m128i *>(text.data() + i));
+            const __m128i special = _mm_or_si128(_mm_cmplt_epi8(chunk, space), _mm_cmpeq_epi8(chunk, del));
+            const __m128i allowed = _mm_or_si128(_mm_cmpeq_epi8(chunk, newline), _mm_cmpeq_epi8(chunk, tab));
+            const unsigned mask = _mm_movemask_epi8(_mm_andnot_si128(allowed, special));
+            if (mask) {
+                i += __builtin_ctz(mask);
+                break;
+            }
+            i += 16;
+        }
+        if (i == text.size()) {
+            break;
+        }
+#endif
+        const unsigned char c = text[i];
+        if (isSafeAscii(c)) {
+            i++;
+            continue;
+        }
+        const size_t length = c >= 0x80 ? sequenceLength(text, i) : 0;
+        if (length == 0) {
+            return i;
+        }
+        i += length;
+    }
+    return text.size();
+}
+
+size_t firstInvalidUtf8(std::string_view text, size_t start)
+{
+    size_t i = start;
+    while (i < text.size()) {
+#ifdef __SSE2__
+        // Skips ahead over ASCII
+        while (i + 16 <= text.size()) {
+            const __m128i chunk = _mm_loadu_si128(reinterpret_cast<const __m128i *>(text.data() + i));
+            const unsigned mask = _mm_movemask_epi8(chunk);
+            if (mask) {
+                i += __builtin_ctz(mask);
+                break;
+            }
+            i += 16;
+        }
+        if (i == text.size()) {
+            break;
+        }
+#endif
+        if ((unsigned char)text[i] < 0x80) {
+            i++;
+            continue;
+        }
+        const size_t length = sequenceLength(text, i, true);
+        if (length == 0) {
+            return i;
+        }
+        i += length;
+    }
+    return text.size();
+}
+
+void appendValidUtf8(std::string_view text, std::string *out)
+{
+    size_t i = firstInvalidUtf8(text);
+    out->append(text.substr(0, i));
+    while (i < text.size()) {
+        out->append("\xef\xbf\xbd");
+        const size_t next = firstInvalidUtf8(text, i + 1);
+        out->append(text.substr(i + 1, next - i - 1));
+        i = next;
+    }
+}
+
+void appendTerminalSafe(std::string_view text, std::string *out)
+{
+    static const char hex[] = "0123456789abcdef";
+
+    size_t i = firstUnsafe(text);
+    out->append(text.substr(0, i));
+    while (i < text.size()) {
+        const unsigned char c = text[i];
+        out->append("\\x");
+        out->push_back(hex[c >> 4]);
+        out->push_back(hex[c & 0xf]);
+        const size_t next = firstUnsafe(text, i + 1);
+        out->append(text.substr(i + 1, next - i - 1));
+        i = next;
+    }
+}
@@ -0,0 +1,23 @@
+#pragma once
+
+#include <cstddef>
+#include <string>
+#include <string_view>
+
+// Messages come straight from whatever logged them, so they can have escape
+// sequences, nuls and broken UTF-8 that mess up the terminal. Everything but
+// newlines, tabs and valid UTF-8 that isn't a control character is escaped as
+// \xNN, byte by byte. Checked 16 bytes at a time where possible, and appended
+// as it is when there's nothing to escape, which is almost always.
+void appendTerminalSafe(std::string_view text, std::string *out);
+
+// Where the first byte that has to be escaped is, or text.size()
+size_t firstUnsafe(std::string_view text, size_t start = 0);
+
+// Where the first byte that isn't part of valid UTF-8 is, or text.size().
+// Unlike firstUnsafe() control characters are fine.
+size_t firstInvalidUtf8(std::string_view text, size_t start = 0);
+
+// For what has to be UTF-8 but doesn't care about the terminal, every byte
+// that isn't valid is replaced with U+FFFD
+void appendValidUtf8(std::string_view text, std::string *out);
@@ -0,0 +1,452 @@
+#include "text-index.h"
+#include "header-cache.h"
+#include "journal-file.h"
+
+extern "C" {
+#include <endian.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <string.h>
+#include <unistd.h>
+} // extern "C"
+
+#include <algorithm>
+#include <fstream>
+#include <iterator>
+#include <sstream>
+
+// File: "JWTI", le32 version, file ID, then segments:
+// "JWSG", le32 term count, le64 first position, le64 entry count,
+// le64 dictionary size, le64 postings size, dictionary, postings
+//
+// Each dictionary entry is varint term length, term, varint postings offset
+// and varint postings size. Terms are sorted. Postings are varint deltas
+// between positions, starting from the first position of the segment.
+namespace {
+
+const char fileMagic[4] = { 'J', 'W', 'T', 'I' };
+const char segmentMagic[4] = { 'J', 'W', 'S', 'G' };
+constexpr uint32_t formatVersion = 1;
+constexpr size_t fileHeaderSize = 4 + 4 + 16;
+constexpr size_t segmentHeaderSize = 4 + 4 + 8 * 4;
+
+// Bounds the memory used while indexing
+constexpr uint64_t segmentEntries = 65536;
+
+// Small segments from incremental updates get merged when there are this many
+constexpr size_t maxSmallSegments = 16;
+
+void writeVarint(std::string *out, uint64_t value)
+{
+    while (value >= 0x80) {
+        out->push_back(char(value | 0x80));
+        value >>= 7;
+    }
+    out->push_back(char(value));
+}
+
+bool readVarint(std::string_view data, size_t *position, uint64_t *value)
+{
+    *value = 0;
+    for (int shift = 0; shift < 64; shift += 7) {
+        if (*position >= data.size()) {
+            return false;
+        }
+        const uint8_t byte = data[(*position)++];
+        *value |= uint64_t(byte & 0x7f) << shift;
+        if (!(byte & 0x80)) {
+            return true;
+        }
+    }
+    return false;
+}
+
+void write32(std::string *out, uint32_t value)
+{
+    value = htole32(value);
+    out->append(reinterpret_cast<const char*>(&value), sizeof value);
+}
+
+void write64(std::string *out, uint64_t value)
+{
+    value = htole64(value);
+    out->append(reinterpret_cast<const char*>(&value), sizeof value);
+}
+
+uint32_t read32(const char *data)
+{
+    uint32_t value;
+    memcpy(&value, data, sizeof value);
+    return le32toh(value);
+}
+
+uint64_t read64(const char *data)
+{
+    uint64_t value;
+    memcpy(&value, data, sizeof value);
+    return le64toh(value);
+}
+
+// Intersection of two sorted lists
+std::vector<uint64_t> intersect(const std::vector<uint64_t> &a, const std::vector<uint64_t> &b)
+{
+    std::vector<uint64_t> result;
+    std::set_intersection(a.begin(), a.end(), b.begin(), b.end(), std::back_inserter(result));
+    return result;
+}
+
+} // namespace
+
+TextIndex::TextIndex(const sd_id128_t &fileId) :
+    m_fileId(fileId)
+{
+    const std::string directory = cacheSubdirectory("index", false);
+    if (!directory.empty()) {
+        char id[SD_ID128_STRING_MAX];
+        m_path = directory + "/" + sd_id128_to_string(fileId, id);
+    }
+}
+
+int TextIndex::load()
+{
+    m_contents.clear();
+    m_segments.clear();
+    m_validSize = 0;
+    m_coveredEntries = 0;
+    if (m_path.empty()) {
+        return -ENOENT;
+    }
+
+    std::ifstream file(m_path, std::ios::binary);
+    if (!file) {
+        return 0;
+    }
+    std::ostringstream buffer;
+    buffer << file.rdbuf();
+    m_contents = buffer.str();
+
+    const std::string_view contents = m_contents;
+    if (contents.size() < fileHeaderSize ||
+            memcmp(contents.data(), fileMagic, sizeof fileMagic) != 0 ||
+            read32(contents.data() + 4) != formatVersion ||
+            memcmp(contents.data() + 8, &m_fileId, sizeof m_fileId) != 0) {
+        // Unusable, will be rewritten from scratch
+        m_contents.clear();
+        return 0;
+    }
+
+    size_t offset = fileHeaderSize;
+    m_validSize = offset;
+    while (contents.size() - offset >= segmentHeaderSize) {
+        const char *header = contents.data() + offset;
+        if (memcmp(header, segmentMagic, sizeof segmentMagic) != 0) {
+            break;
+        }
+        Segment segment;
+        const uint32_t termCount = read32(header + 4);
+        segment.firstPosition = read64(header + 8);
+        segment.entryCount = read64(header + 16);
+        const uint64_t dictionarySize = read64(header + 24);
+        const uint64_t postingsSize = read64(header + 32);
+
+        // Segments are only valid if they continue where the last one stopped
+        const size_t available = contents.size() - offset - segmentHeaderSize;
+        if (segment.firstPosition != m_coveredEntries || dictionarySize > available || postingsSize > available - dictionarySize) {
+            break;
+        }
+        const std::string_view dictionary = contents.substr(offset + segmentHeaderSize, dictionarySize);
+        segment.postings = contents.substr(offset + segmentHeaderSize + dictionarySize, postingsSize);
+
+        bool valid = true;
+        size_t position = 0;
+        segment.terms.reserve(termCount);
+        for (uint32_t i = 0; i < termCount && valid; i++) {
+            uint64_t length;
+            Term term;
+            valid = readVarint(dictionary, &position, &length) && length <= dictionary.size() - position;
+            if (!valid) {
+                break;
+            }
+            term.term = dictionary.substr(position, length);
+            position += length;
+            valid = readVarint(dictionary, &position, &term.postingsOffset) &&
+                readVarint(dictionary, &position, &term.postingsSize) &&
+                term.postingsOffset <= postingsSize &&
+                term.postingsSize <= postingsSize - term.postingsOffset;
+            segment.terms.push_back(term);
+        }
+        if (!valid) {
+            break;
+        }
+
+        offset += segmentHeaderSize + dictionarySize + postingsSize;
+        m_validSize = offset;
+        m_coveredEntries += segment.entryCount;
+        m_segments.push_back(std::move(segment));
+    }
+
+    return 0;
+}
+
+void TextIndex::lookup(std::string_view term, Match match, std::vector<uint64_t> *positions) const
+{
+    auto matches = [&](std::string_view candidate) {
+        switch(match) {
+        case Exact:
+            return candidate == term;
+        case Prefix:
+            return candidate.substr(0, term.size()) == term;
+        case Suffix:
+            // Can't tell for truncated words, so include them
+            return candidate.size() >= MaxTermLength ||
+                (candidate.size() >= term.size() && candidate.substr(candidate.size() - term.size()) == term);
+        case Substring:
+            return candidate.size() >= MaxTermLength || candidate.find(term) != std::string_view::npos;
+        }
+        return false;
+    };
+
+    for (const Segment &segment : m_segments) {
+        const size_t segmentStart = positions->size();
+
+        // Exact and prefix matches are found by binary search, the rest needs
+        // to go through the dictionary, which is still a lot smaller than
+        // going through all the messages.
+        auto it = segment.terms.begin();
+        if (match == Exact || match == Prefix) {
+            it = std::lower_bound(segment.terms.begin(), segment.terms.end(), term, [](const Term &a, std::string_view b) {
+                return a.term < b;
+            });
+        }
+        for (; it != segment.terms.end(); ++it) {
+            if (!matches(it->term)) {
+                if (match == Exact || match == Prefix) {
+                    break;
+                }
+                continue;
+            }
+            const std::string_view postings = segment.postings.substr(it->postingsOffset, it->postingsSize);
+            size_t offset = 0;
+            uint64_t position = segment.firstPosition;
+            uint64_t delta;
+            while (offset < postings.size() && readVarint(postings, &offset, &delta)) {
+                position += delta;
+                positions->push_back(position);
+            }
+        }
+
+        if (match != Exact) {
+            std::sort(positions->begin() + segmentStart, positions->end());
+            positions->erase(std::unique(positions->begin() + segmentStart, positions->end()), positions->end());
+        }
+    }
+}
+
+bool TextIndex::candidates(std::string_view pattern, std::vector<uint64_t> *positions) const
+{
+    // A word with a non-word character on both sides in the pattern must be a
+    // whole word in the message. Words at the edges of the pattern can be a
+    // part of a longer word in the message.
+    bool usable = false;
+    size_t i = 0;
+    while (i < pattern.size()) {
+        if (!isTermCharacter(pattern[i])) {
+            i++;
+            continue;
+        }
+        const size_t start = i;
+        while (i < pattern.size() && isTermCharacter(pattern[i])) {
+            i++;
+        }
+        const bool wordStart = start > 0;
+        const bool wordEnd = i < pattern.size();
+
+        std::string term;
+        forEachTerm(pattern.substr(start, i - start), [&](std::string_view t) { term = t; });
+
+        Match match = Substring;
+        if (wordStart && wordEnd && term.size() < MaxTermLength) {
+            match = Exact;
+        } else if (wordStart) {
+            match = Prefix;
+        } else if (wordEnd) {
+            match = Suffix;
+        }
+
+        std::vector<uint64_t> found;
+        lookup(term, match, &found);
+        *positions = usable ? intersect(*positions, found) : std::move(found);
+        usable = true;
+
+        if (positions->empty()) {
+            break;
+        }
+    }
+    return usable;
+}
+
+int TextIndex::appendSegment(uint64_t firstPosition, uint64_t entryCount, const Postings &postings)
+{
+    std::string dictionary;
+    std::string encodedPostings;
+    for (const auto &[term, termPositions] : postings) {
+        const size_t offset = encodedPostings.size();
+        uint64_t previous = firstPosition;
+        for (const uint64_t position : termPositions) {
+            writeVarint(&encodedPostings, position - previous);
+            previous = position;
+        }
+        writeVarint(&dictionary, term.size());
+        dictionary += term;
+        writeVarint(&dictionary, offset);
+        writeVarint(&dictionary, encodedPostings.size() - offset);
+    }
+
+    std::string data;
+    if (m_validSize == 0) {
+        data.append(fileMagic, sizeof fileMagic);
+        write32(&data, formatVersion);
+        data.append(reinterpret_cast<const char*>(&m_fileId), sizeof m_fileId);
+    }
+    data.append(segmentMagic, sizeof segmentMagic);
+    write32(&data, postings.size());
+    write64(&data, firstPosition);
+    write64(&data, entryCount);
+    write64(&data, dictionary.size());
+    write64(&data, encodedPostings.size());
+    data += dictionary;
+    data += encodedPostings;
+
+    cacheSubdirectory("index", true);
+    const int fd = open(m_path.c_str(), O_WRONLY | O_CREAT | O_CLOEXEC, 0600);
+    if (fd < 0) {
+        return -errno;
+    }
+    // Throw away anything half written by an earlier run that got killed
+    if (ftruncate(fd, m_validSize) < 0 || lseek(fd, m_validSize, SEEK_SET) < 0) {
+        const int ret = -errno;
+        close(fd);
+        return ret;
+    }
+    size_t written = 0;
+    while (written < data.size()) {
+        const ssize_t ret = write(fd, data.data() + written, data.size() - written);
+        if (ret < 0) {
+            if (errno == EINTR) {
+                continue;
+            }
+            const int error = -errno;
+            close(fd);
+            return error;
+        }
+        written += ret;
+    }
+    close(fd);
+
+    m_validSize += data.size();
+    return 0;
+}
+
+int TextIndex::update(JournalFile *journal)
+{
+    const uint64_t end = journal->entryCount();
+    uint64_t position = m_coveredEntries;
+    if (position >= end) {
+        return 0;
+    }
+
+    journal->setFields(FieldMessage);
+    Entry entry;
+    Postings postings;
+    uint64_t segmentStart = position;
+    for (; position < end; position++) {
+        // Either still being written or broken, either way we can't skip it
+        // since the index has to cover everything up to where it stops.
+        if (journal->readEntry(position, &entry) < 0) {
+            break;
+        }
+        forEachTerm(entry.message, [&](std::string_view term) {
+            std::vector<uint64_t> &termPositions = postings[std::string(term)];
+            if (termPositions.empty() || termPositions.back() != position) {
+                termPositions.push_back(position);
+            }
+        });
+
+        if (position + 1 - segmentStart >= segmentEntries) {
+            const int ret = appendSegment(segmentStart, position + 1 - segmentStart, postings);
+            if (ret < 0) {
+                return ret;
+            }
+            postings.clear();
+            segmentStart = position + 1;
+        }
+    }
+    if (position > segmentStart) {
+        const int ret = appendSegment(segmentStart, position - segmentStart, postings);
+        if (ret < 0) {
+            return ret;
+        }
+    }
+
+    int ret = load();
+    if (ret < 0) {
+        return ret;
+    }
+
+    size_t smallSegments = 0;
+    for (const Segment &segment : m_segments) {
+        if (segment.entryCount < segmentEntries) {
+            smallSegments++;
+        }
+    }
+    if (smallSegments >= maxSmallSegments) {
+        ret = compact();
+    }
+    return ret;
+}
+
+int TextIndex::compact()
+{
+    // Keep the leading full segments as they are, merge everything after them
+    size_t keep = 0;
+    while (keep < m_segments.size() && m_segments[keep].entryCount >= segmentEntries) {
+        keep++;
+    }
+    if (keep >= m_segments.size()) {
+        return 0;
+    }
+
+    const uint64_t firstPosition = m_segments[keep].firstPosition;
+    Postings postings;
+    for (size_t i = keep; i < m_segments.size(); i++) {
+        const Segment &segment = m_segments[i];
+        for (const Term &term : segment.terms) {
+            std::vector<uint64_t> &termPositions = postings[std::string(term.term)];
+            const std::string_view encoded = segment.postings.substr(term.postingsOffset, term.postingsSize);
+            size_t offset = 0;
+            uint64_t position = segment.firstPosition;
+            uint64_t delta;
+            while (offset < encoded.size() && readVarint(encoded, &offset, &delta)) {
+                position += delta;
+                termPositions.push_back(position);
+            }
+        }
+    }
+
+    // Chop off the merged segments and append them again as one
+    m_validSize = fileHeaderSize;
+    if (keep > 0) {
+        const Segment &lastKept = m_segments[keep - 1];
+        m_validSize = size_t(lastKept.postings.data() - m_contents.data()) + lastKept.postings.size();
+    }
+    const int ret = appendSegment(firstPosition, m_coveredEntries - firstPosition, postings);
+    if (ret < 0) {
+        return ret;
+    }
+    return load();
+}
+
+void TextIndex::removeStale(const std::vector<sd_id128_t> &existing)
+{
+    removeStaleCaches("index", existing);
+}
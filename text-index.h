@@ -0,0 +1,108 @@
+#pragma once
+
+extern "C" {
+#include <systemd/sd-id128.h>
+} // extern "C"
+
+#include <cstdint>
+#include <map>
+#include <string>
+#include <string_view>
+#include <vector>
+
+class JournalFile;
+
+static inline bool isTermCharacter(unsigned char c)
+{
+    return (c >= 'a' && c <= 'z') || (c >= 'A' && c <= 'Z') || (c >= '0' && c <= '9') || c == '_' || c >= 0x80;
+}
+
+// Longer words are truncated, both when indexing and when looking up
+constexpr size_t MaxTermLength = 64;
+
+// Splits text into the lowercase words we index, calling function(term) for each.
+template<typename Function>
+void forEachTerm(std::string_view text, Function function)
+{
+    std::string term;
+    size_t i = 0;
+    while (i < text.size()) {
+        if (!isTermCharacter(text[i])) {
+            i++;
+            continue;
+        }
+        term.clear();
+        while (i < text.size() && isTermCharacter(text[i])) {
+            if (term.size() < MaxTermLength) {
+                char c = text[i];
+                if (c >= 'A' && c <= 'Z') {
+                    c += 'a' - 'A';
+                }
+                term.push_back(c);
+            }
+            i++;
+        }
+        function(std::string_view(term));
+    }
+}
+
+// Inverted index of the MESSAGE words in one journal file, mapping each word
+// to the positions (in the entry array) of the entries containing it.
+//
+// Stored next to the other caches as ~/.cache/journal-watch/index/<file id>,
+// as a list of segments that are only ever appended, so indexing a file that's
+// still being written just adds another segment for the new entries.
+class TextIndex
+{
+public:
+    explicit TextIndex(const sd_id128_t &fileId);
+
+    // Returns 0 if there's no index yet as well
+    int load();
+
+    // Everything before this position is covered by the index
+    uint64_t coveredEntries() const { return m_coveredEntries; }
+
+    // Positions of all entries that can contain pattern as a substring. Returns
+    // false if the pattern doesn't contain any words we can look up.
+    bool candidates(std::string_view pattern, std::vector<uint64_t> *positions) const;
+
+    // Indexes the entries between what's covered and the end of the file
+    int update(JournalFile *journal);
+
+    // Removes indexes of journal files that don't exist anymore
+    static void removeStale(const std::vector<sd_id128_t> &existing);
+
+private:
+    struct Term {
+        std::string_view term;
+        uint64_t postingsOffset;
+        uint64_t postingsSize;
+    };
+    struct Segment {
+        uint64_t firstPosition;
+        uint64_t entryCount;
+        std::vector<Term> terms;
+        std::string_view postings;
+    };
+    enum Match {
+        Exact,
+        Prefix,
+        Suffix,
+        Substring
+    };
+    using Postings = std::map<std::string, std::vector<uint64_t>>;
+
+    void lookup(std::string_view term, Match match, std::vector<uint64_t> *positions) const;
+    int appendSegment(uint64_t firstPosition, uint64_t entryCount, const Postings &postings);
+    int compact();
+
+    std::string m_path;
+    sd_id128_t m_fileId;
+
+    // Backing storage for the string_views in the segments
+    std::string m_contents;
+    size_t m_validSize = 0;
+    std::vector<Segment> m_segments;
+    uint64_t m_coveredEntries = 0;
+};
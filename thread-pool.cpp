@@ -0,0 +1,95 @@
+#include "thread-pool.h"
+
+#include <algorithm>
+
+ThreadPool::ThreadPool(unsigned threads)
+{
+    if (threads == 0) {
+        threads = std::max(std::thread::hardware_concurrency(), 1u);
+    }
+    for (unsigned i = 0; i < threads - 1; i++) {
+        m_threads.emplace_back(&ThreadPool::workerLoop, this, i);
+    }
+}
+
+ThreadPool::~ThreadPool()
+{
+    {
+        std::lock_guard<std::mutex> lock(m_mutex);
+        m_quit = true;
+    }
+    m_wakeup.notify_all();
+    for (std::thread &thread : m_threads) {
+        thread.join();
+    }
+}
+
+void ThreadPool::work(unsigned worker)
+{
+    const size_t chunkSize = m_chunkSize;
+    while (true) {
+        const size_t begin = m_nextIndex.fetch_add(chunkSize, std::memory_order_relaxed);
+        if (begin >= m_count) {
+            return;
+        }
+        const size_t end = std::min(begin + chunkSize, m_count);
+        for (size_t i = begin; i < end; i++) {
+            (*m_function)(i, worker);
+        }
+    }
+}
+
+void ThreadPool::workerLoop(unsigned worker)
+{
+    uint64_t seenGeneration = 0;
+    while (true) {
+        {
+            std::unique_lock<std::mutex> lock(m_mutex);
+            m_wakeup.wait(lock, [&]() { return m_quit || m_generation != seenGeneration; });
+            if (m_quit) {
+                return;
+            }
+            seenGeneration = m_generation;
+        }
+
+        work(worker);
+
+        std::lock_guard<std::mutex> lock(m_mutex);
+        m_busy--;
+        if (m_busy == 0) {
+            m_done.notify_one();
+        }
+    }
+}
+
+void ThreadPool::parallelFor(size_t count, const std::function<void(size_t index, unsigned worker)> &function, size_t chunkSize)
+{
+    if (count == 0) {
+        return;
+    }
+
+    // Not worth waking anyone up for
+    if (m_threads.empty() || count == 1) {
+        for (size_t i = 0; i < count; i++) {
+            function(i, 0);
+        }
+        return;
+    }
+
+    {
+        std::lock_guard<std::mutex> lock(m_mutex);
+        m_function = &function;
+        m_count = count;
+        m_chunkSize = std::max<size_t>(chunkSize, 1);
+        m_nextIndex = 0;
+        m_busy = m_threads.size();
+        m_generation++;
+    }
+    m_wakeup.notify_all();
+
+    work(m_threads.size());
+
+    std::unique_lock<std::mutex> lock(m_mutex);
+    m_done.wait(lock, [&]() { return m_busy == 0; });
+    m_function = nullptr;
+}
@@ -0,0 +1,51 @@
+#pragma once
+
+#include <atomic>
+#include <condition_variable>
+#include <cstddef>
+#include <cstdint>
+#include <functional>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+// Minimal fork/join pool for the batch processing in the history paths, the
+// calling thread takes part in the work as well.
+class ThreadPool
+{
+public:
+    // 0 means one thread per core
+    explicit ThreadPool(unsigned threads = 0);
+    ~ThreadPool();
+
+    ThreadPool(const ThreadPool &) = delete;
+    ThreadPool &operator=(const ThreadPool &) = delete;
+
+    // Number of workers, including the calling thread
+    unsigned size() const { return m_threads.size() + 1; }
+
+    // Runs function(index, worker) for every index below count, and returns
+    // when all of them are done. worker is below size(), for per-thread state.
+    // The threads take chunkSize indexes at a time. Small by default, since
+    // the cost per item varies a lot (compressed or not etc.), 1 for a few big
+    // items.
+    void parallelFor(size_t count, const std::function<void(size_t index, unsigned worker)> &function, size_t chunkSize = 16);
+
+private:
+    void workerLoop(unsigned worker);
+    void work(unsigned worker);
+
+    std::vector<std::thread> m_threads;
+
+    std::mutex m_mutex;
+    std::condition_variable m_wakeup;
+    std::condition_variable m_done;
+    uint64_t m_generation = 0;
+    unsigned m_busy = 0;
+    bool m_quit = false;
+
+    const std::function<void(size_t, unsigned)> *m_function = nullptr;
+    size_t m_count = 0;
+    size_t m_chunkSize = 0;
+    std::atomic<size_t> m_nextIndex { 0 };
+};
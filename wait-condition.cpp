@@ -0,0 +1,62 @@
+#include "wait-condition.h"
+
+extern "C" {
+#include <time.h>
+} // extern "C"
+
+#include <string_view>
+#include <utility>
+
+namespace {
+
+uint64_t monotonicUsec()
+{
+    timespec now;
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    return now.tv_sec * 1000000ULL + now.tv_nsec / 1000;
+}
+
+} // namespace
+
+WaitCondition::WaitCondition(std::string waitFor, std::string failOn, uint64_t timeout) :
+    m_waitFor(std::move(waitFor)),
+    m_failOn(std::move(failOn)),
+    m_timeout(timeout)
+{
+}
+
+void WaitCondition::start()
+{
+    if (m_timeout > 0) {
+        m_deadline = monotonicUsec() + m_timeout;
+    }
+}
+
+void WaitCondition::check(const Entry &entry)
+{
+    if (isDecided()) {
+        return;
+    }
+    const std::string_view message = entry.message;
+    if (!m_failOn.empty() && message.find(m_failOn) != std::string_view::npos) {
+        m_result = Failed;
+    } else if (!m_waitFor.empty() && message.find(m_waitFor) != std::string_view::npos) {
+        m_result = Found;
+    }
+}
+
+void WaitCondition::checkTimeout()
+{
+    if (!isDecided() && m_deadline != 0 && monotonicUsec() >= m_deadline) {
+        m_result = TimedOut;
+    }
+}
+
+uint64_t WaitCondition::timeLeft() const
+{
+    if (m_deadline == 0) {
+        return uint64_t(-1);
+    }
+    const uint64_t now = monotonicUsec();
+    return m_deadline > now ? m_deadline - now : 0;
+}
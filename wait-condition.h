@@ -0,0 +1,52 @@
+#pragma once
+
+#include "entry.h"
+
+#include <cstdint>
+#include <string>
+
+// For --wait-for, --fail-on and --timeout, so deploy scripts know as soon as a
+// service is up or has failed, without the buffering of piping into grep -m1.
+// The patterns are looked for in the MESSAGE as it is in the journal, before
+// anything is escaped for the terminal.
+class WaitCondition
+{
+public:
+    // What journal-watch exits with
+    enum Result {
+        Found = 0,
+        // The journal ended first, with --no-follow
+        NotFound = 1,
+        Failed = 3,
+        // Same as timeout(1)
+        TimedOut = 124
+    };
+
+    // The timeout is in usec, 0 for none
+    WaitCondition(std::string waitFor, std::string failOn, uint64_t timeout);
+
+    // Starts the clock for the timeout
+    void start();
+
+    // Decides on the result if the entry matches, --fail-on wins if both do.
+    // Nothing more should be shown after that.
+    void check(const Entry &entry);
+    // Decides on TimedOut once the time is up
+    void checkTimeout();
+
+    bool isDecided() const { return m_result >= 0; }
+
+    // How long to wait for new entries at most, in usec, -1 for forever
+    uint64_t timeLeft() const;
+
+    // What to exit with, also when the entries ran out without a decision
+    int result() const { return isDecided() ? m_result : m_waitFor.empty() ? 0 : NotFound; }
+
+private:
+    std::string m_waitFor;
+    std::string m_failOn;
+    uint64_t m_timeout;
+    // CLOCK_MONOTONIC in usec, 0 for none
+    uint64_t m_deadline = 0;
+    int m_result = -1;
+};